@@ -0,0 +1,179 @@
+/*
+ * associations.cpp
+ * objc_getAssociatedObject() and objc_setAssociatedObject() under
+ * concurrent getters and setters, and the memory and latency of 
+ * objects with one to eight associations, through objc-references.mm.
+ *
+ * Values use OBJC_ASSOCIATION_RETAIN: the getter retains and
+ * autoreleases, and the benchmark releases what it gets as an
+ * autorelease pool would. Getters abort if they return a
+ * deallocated value.
+ */
+
+#include "bench.h"
+#include "objects.h"
+
+#include <objc/runtime.h>
+
+using namespace bench;
+
+extern id _object_get_associative_reference(id object, void *key);
+extern void _object_set_associative_reference(id object, void *key,
+                                              id value, uintptr_t policy);
+extern void _object_remove_assocations(id object);
+
+static const char * const Name = "associations";
+
+static char Keys[8];
+
+
+// objc-internal.h's entry points for objects without RR overrides.
+
+id objc_retain(id obj)
+{
+    if (obj  &&  !obj->rootTryRetainFast()) {
+        fprintf(stderr, "retained a deallocating object\n");
+        abort();
+    }
+    return obj;
+}
+
+void objc_release(id obj)
+{
+    if (obj  &&  obj->rootRelease()) deallocObject(obj);
+}
+
+id objc_autorelease(id obj)
+{
+    return obj;
+}
+
+
+/***********************************************************************
+* Driver
+**********************************************************************/
+
+// -n objects each get keyCount associations, as objects gain them 
+// over their lives. Reports the memory per object, and the latency 
+// of getting and of replacing random associations.
+static void runKeys(const Options& options, size_t keyCount, Random& random)
+{
+    size_t n = options.entries;
+    std::vector<id> owners(n);
+    for (auto& owner : owners) owner = newObject();
+    id value = newObject();
+
+    size_t before = heapBytes();
+    for (id owner : owners) {
+        for (size_t k = 0; k < keyCount; k++) {
+            _object_set_associative_reference(owner, &Keys[k], value,
+                                              OBJC_ASSOCIATION_RETAIN);
+        }
+    }
+    double bytes = (double)(heapBytes() - before) / n;
+
+    std::vector<size_t> stream(options.lookups);
+    for (auto& i : stream) i = random.below(n * keyCount);
+
+    Result r = measure(stream.size(), [&](size_t i) {
+        id owner = owners[stream[i] / keyCount];
+        id got = _object_get_associative_reference
+            (owner, &Keys[stream[i] % keyCount]);
+        if (got != value) {
+            fprintf(stderr, "getter returned %p instead of %p\n", got, value);
+            abort();
+        }
+        objc_release(got);
+    });
+
+    char keys[32];
+    snprintf(keys, sizeof(keys), "%zux%zu", n, keyCount);
+    print(Name, keys, "get", r, bytes);
+
+    r = measure(stream.size(), [&](size_t i) {
+        id owner = owners[stream[i] / keyCount];
+        _object_set_associative_reference(owner, &Keys[stream[i] % keyCount],
+                                          value, OBJC_ASSOCIATION_RETAIN);
+    });
+    print(Name, keys, "set", r);
+
+    for (id owner : owners) {
+        _object_remove_assocations(owner);
+        objc_release(owner);
+    }
+    objc_release(value);
+}
+
+// Readers get the value of random objects and release it. Writers
+// give random objects new values, which releases the old ones.
+static void run(const Options& options, size_t objects,
+                unsigned readers, unsigned writers)
+{
+    std::vector<id> owners(objects);
+    for (auto& owner : owners) {
+        owner = newObject();
+        id value = newObject();
+        _object_set_associative_reference(owner, &Keys[0], value,
+                                          OBJC_ASSOCIATION_RETAIN);
+        objc_release(value);
+    }
+
+    std::vector<std::vector<size_t>> streams(readers + writers);
+    Random random;
+    for (auto& stream : streams) {
+        stream.resize(4096);
+        for (auto& i : stream) i = random.below(objects);
+    }
+
+    ConcurrentResult r = measureConcurrent(readers, options.lookups, writers,
+        []{},
+        [&](unsigned t, size_t i) {
+            id owner = owners[streams[t][i % 4096]];
+            id value = _object_get_associative_reference(owner, &Keys[0]);
+            checkLive(value, "getter");
+            objc_release(value);
+        },
+        [&](unsigned t, size_t i) {
+            id owner = owners[streams[readers + t][i % 4096]];
+            id value = newObject();
+            _object_set_associative_reference(owner, &Keys[0], value,
+                                              OBJC_ASSOCIATION_RETAIN);
+            objc_release(value);
+        });
+
+    char keys[32], op[32];
+    snprintf(keys, sizeof(keys), "%zu", objects);
+    snprintf(op, sizeof(op), "get r%uw%u", readers, writers);
+    print(Name, keys, op, r.reads);
+    if (writers) {
+        snprintf(op, sizeof(op), "set r%uw%u", readers, writers);
+        print(Name, keys, op, r.writes);
+    }
+
+    for (id owner : owners) {
+        _object_remove_assocations(owner);
+        objc_release(owner);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+    if (!options.wants(Name)) return 0;
+
+    printf("# %zu gets per reader thread, %u CPUs\n",
+           options.lookups, std::thread::hardware_concurrency());
+    printHeader();
+
+    static const size_t objectCounts[] = { 1, 1024 };
+    static const unsigned threads[][2] = { {1, 0}, {4, 0}, {4, 1}, {1, 4} };
+    for (size_t objects : objectCounts) {
+        for (auto& t : threads) run(options, objects, t[0], t[1]);
+    }
+
+    Random random;
+    static const size_t keyCounts[] = { 1, 2, 3, 4, 8 };
+    for (size_t keyCount : keyCounts) runKeys(options, keyCount, random);
+    return 0;
+}
@@ -0,0 +1,733 @@
+/*
+ * autoreleasepools.cpp
+ * Autorelease pool push, autorelease and pop in bursts, with pages
+ * from malloc and with NSObject.mm's PoolPageCache, with
+ * repeated autoreleases of one object coalesced into one entry, and
+ * with pop() releasing entries one at a time and in batches, and
+ * with OBJC_PRINT_POOL_SITES's profile of push sites and callers.
+ *
+ * The model mirrors AutoreleasePoolPage: a stack of 4096-byte pages
+ * per thread, POOL_BOUNDARY entries for pool tokens, and pop()'s
+ * policy of freeing the children of a page left less than half full.
+ * Each burst pushes a pool, retains and autoreleases burst objects
+ * and pops the pool, autoreleasing each object one or more times in
+ * a row. The runs check that every retain was released.
+ */
+
+#include "bench.h"
+#include "objects.h"
+
+#include <dlfcn.h>
+#include <execinfo.h>
+
+using namespace bench;
+
+enum { PageSize = 4096 };
+
+#define POOL_BOUNDARY nil
+
+
+/***********************************************************************
+* Page allocation
+* Each variant supplies AutoreleasePoolPage's operator new and delete.
+**********************************************************************/
+
+// malloc_zone_memalign() and free() for every page.
+struct MallocPages {
+    static void *alloc() {
+        return aligned_alloc(PageSize, PageSize);
+    }
+
+    static void dealloc(void *p) {
+        free(p);
+    }
+};
+
+// PoolPageCache: up to 4 free pages per thread, then a global stack
+// of up to 64. A lock stands in for OSAtomicEnqueue's lock-free stack.
+struct CachedPages {
+    enum { ThreadLimit = 4, GlobalLimit = 64 };
+
+    struct FreePage {
+        FreePage *next;
+        unsigned int count;  // length of this thread's list from here
+    };
+
+    // Gives the thread's pages to the global stack when the thread exits.
+    struct ThreadPages {
+        FreePage *head = nullptr;
+
+        ~ThreadPages() {
+            while (FreePage *page = head) {
+                head = page->next;
+                if (!putGlobal(page)) free(page);
+            }
+        }
+    };
+
+    static thread_local ThreadPages threadPages;
+    static spinlock_t globalLock;
+    static FreePage *globalPages;
+    static unsigned int globalCount;
+
+    static void *alloc() {
+        if (FreePage *page = threadPages.head) {
+            threadPages.head = page->next;
+            return page;
+        }
+        globalLock.lock();
+        FreePage *page = globalPages;
+        if (page) {
+            globalPages = page->next;
+            globalCount--;
+        }
+        globalLock.unlock();
+        if (page) return page;
+        return aligned_alloc(PageSize, PageSize);
+    }
+
+    static void dealloc(void *p) {
+        FreePage *page = (FreePage *)p;
+        FreePage *head = threadPages.head;
+        unsigned int count = head ? head->count : 0;
+        if (count < ThreadLimit) {
+            page->next = head;
+            page->count = count + 1;
+            threadPages.head = page;
+            return;
+        }
+        if (!putGlobal(page)) free(page);
+    }
+
+    static bool putGlobal(FreePage *page) {
+        globalLock.lock();
+        bool cached = globalCount < GlobalLimit;
+        if (cached) {
+            page->next = globalPages;
+            globalPages = page;
+            globalCount++;
+        }
+        globalLock.unlock();
+        return cached;
+    }
+};
+
+thread_local CachedPages::ThreadPages CachedPages::threadPages;
+spinlock_t CachedPages::globalLock;
+CachedPages::FreePage *CachedPages::globalPages;
+unsigned int CachedPages::globalCount;
+
+
+/***********************************************************************
+* Pool site profile
+* PoolSiteProfile from NSObject.mm, with thread_local standing in for
+* its thread key. The benchmark is a single image, so the first frame
+* counts as outside libobjc; the runtime skips its own two or three.
+**********************************************************************/
+
+static unsigned int PoolSiteSampleInterval = 64;
+
+struct PoolSiteProfile {
+    enum { MaxDepth = 64, SiteCount = 512, SampleCount = 4096,
+           MaxProbes = 32, CallerFrames = 16 };
+
+    // One pushed pool on this thread.
+    struct Frame {
+        void *token;
+        void *site;
+        uint64_t start;   // thread's autoreleases when pushed
+        uint64_t nested;  // autoreleases drained by nested pools
+    };
+
+    struct ThreadState {
+        unsigned int countdown;
+        unsigned int depth;    // may exceed MaxDepth; deeper pools untracked
+        uint64_t autoreleases;
+        Frame frames[MaxDepth];
+    };
+
+    struct Site {
+        std::atomic<void *> site;
+        std::atomic<uint64_t> pops;
+        std::atomic<uint64_t> objects;
+        std::atomic<uint64_t> maxObjects;
+    };
+
+    // Keyed by a hash of all three fields. Colliding triples
+    // share an entry, which is acceptable for a profile.
+    struct Sample {
+        std::atomic<uintptr_t> key;
+        std::atomic<void *> site;
+        std::atomic<void *> caller;
+        std::atomic<Class> cls;
+        std::atomic<uint64_t> samples;
+    };
+
+    // Frees the thread's state at thread exit, as tls_create(&free) does.
+    struct ThreadStateHolder {
+        ThreadState *state = nullptr;
+        ~ThreadStateHolder() { free(state); }
+    };
+
+    // Starts a new profile.
+    static void init()
+    {
+        if (PoolSiteSampleInterval == 0) PoolSiteSampleInterval = 1;
+        free(sites);
+        free(samples);
+        sites = (Site *)calloc(SiteCount, sizeof(Site));
+        samples = (Sample *)calloc(SampleCount, sizeof(Sample));
+        droppedPops.store(0, std::memory_order_relaxed);
+        droppedSamples.store(0, std::memory_order_relaxed);
+    }
+
+    static ThreadState *threadState()
+    {
+        ThreadState *state = threadStateHolder.state;
+        if (!state) {
+            state = (ThreadState *)calloc(1, sizeof(ThreadState));
+            if (!state) return nil;
+            state->countdown = PoolSiteSampleInterval;
+            threadStateHolder.state = state;
+        }
+        return state;
+    }
+
+    static void pushed(void *token, void *site)
+    {
+        ThreadState *state = threadState();
+        if (!state) return;
+        if (state->depth < MaxDepth) {
+            Frame& frame = state->frames[state->depth];
+            frame.token = token;
+            frame.site = site;
+            frame.start = state->autoreleases;
+            frame.nested = 0;
+        }
+        state->depth++;
+    }
+
+    static void popping(void *token)
+    {
+        ThreadState *state = threadState();
+        if (!state) return;
+
+        // Popping a pool also pops any pools still pushed inside it.
+        unsigned int tracked = std::min(state->depth, (unsigned int)MaxDepth);
+        unsigned int i = tracked;
+        while (i > 0  &&  state->frames[i-1].token != token) i--;
+        if (i == 0) {
+            if (state->depth > MaxDepth) state->depth--;
+            return;
+        }
+
+        for (unsigned int j = tracked; j-- > i-1; ) {
+            Frame& frame = state->frames[j];
+            uint64_t inclusive = state->autoreleases - frame.start;
+            if (j > 0) state->frames[j-1].nested += inclusive;
+            recordPop(frame.site, inclusive - frame.nested);
+        }
+        state->depth = i-1;
+    }
+
+    static void autoreleased(id obj)
+    {
+        ThreadState *state = threadState();
+        if (!state) return;
+        state->autoreleases++;
+        if (--state->countdown > 0) return;
+        state->countdown = PoolSiteSampleInterval;
+
+        unsigned int tracked = std::min(state->depth, (unsigned int)MaxDepth);
+        void *site = tracked ? state->frames[tracked-1].site : nil;
+        recordSample(site, callerOutsideRuntime(), obj->ISA());
+    }
+
+    static void *callerOutsideRuntime()
+    {
+        void *stack[CallerFrames];
+        int count = backtrace(stack, CallerFrames);
+        for (int i = 0; i < count; i++) {
+            Dl_info info;
+            if (!dladdr(stack[i], &info)  ||  info.dli_fbase != runtimeImage) {
+                return stack[i];
+            }
+        }
+        return count ? stack[count-1] : nil;
+    }
+
+    static void recordPop(void *site, uint64_t objects)
+    {
+        uintptr_t h = hash(site, nil, nil);
+        for (unsigned int probe = 0; probe < MaxProbes; probe++) {
+            Site& entry = sites[(h + probe) & (SiteCount-1)];
+            void *current = entry.site.load(std::memory_order_relaxed);
+            if (current == nil  &&  site != nil) {
+                if (!entry.site.compare_exchange_strong
+                    (current, site, std::memory_order_relaxed))
+                {
+                    // Claimed by another thread; current is its site.
+                    if (current != site) continue;
+                }
+            } else if (current != site) {
+                continue;
+            }
+
+            entry.pops.fetch_add(1, std::memory_order_relaxed);
+            entry.objects.fetch_add(objects, std::memory_order_relaxed);
+            uint64_t max = entry.maxObjects.load(std::memory_order_relaxed);
+            while (objects > max  &&
+                   !entry.maxObjects.compare_exchange_weak
+                   (max, objects, std::memory_order_relaxed))
+                { }
+            return;
+        }
+        droppedPops.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void recordSample(void *site, void *caller, Class cls)
+    {
+        uintptr_t key = hash(site, caller, cls) | 1;  // 0 means empty
+        for (unsigned int probe = 0; probe < MaxProbes; probe++) {
+            Sample& entry = samples[(key + probe) & (SampleCount-1)];
+            uintptr_t current = entry.key.load(std::memory_order_acquire);
+            if (current == 0) {
+                if (entry.key.compare_exchange_strong
+                    (current, key, std::memory_order_relaxed))
+                {
+                    entry.site.store(site, std::memory_order_relaxed);
+                    entry.caller.store(caller, std::memory_order_relaxed);
+                    entry.cls.store(cls, std::memory_order_relaxed);
+                    entry.samples.fetch_add(1, std::memory_order_release);
+                    return;
+                }
+            }
+            if (current == key) {
+                entry.samples.fetch_add(1, std::memory_order_release);
+                return;
+            }
+        }
+        droppedSamples.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static uintptr_t hash(void *site, void *caller, Class cls)
+    {
+        uintptr_t h = (uintptr_t)site;
+        h = (h ^ (h >> 17)) * 0x9E3779B97F4A7C15ULL + (uintptr_t)caller;
+        h = (h ^ (h >> 17)) * 0x9E3779B97F4A7C15ULL + (uintptr_t)cls;
+        return h ^ (h >> 29);
+    }
+
+    // Totals over every push site and every sample.
+    static void totals(uint64_t *pops, uint64_t *objects, uint64_t *sampled)
+    {
+        *pops = *objects = *sampled = 0;
+        for (unsigned int i = 0; i < SiteCount; i++) {
+            *pops += sites[i].pops.load(std::memory_order_relaxed);
+            *objects += sites[i].objects.load(std::memory_order_relaxed);
+        }
+        for (unsigned int i = 0; i < SampleCount; i++) {
+            *sampled += samples[i].samples.load(std::memory_order_relaxed);
+        }
+    }
+
+    static thread_local ThreadStateHolder threadStateHolder;
+    static void *runtimeImage;
+    static Site *sites;
+    static Sample *samples;
+    static std::atomic<uint64_t> droppedPops;
+    static std::atomic<uint64_t> droppedSamples;
+};
+
+thread_local PoolSiteProfile::ThreadStateHolder PoolSiteProfile::threadStateHolder;
+void *PoolSiteProfile::runtimeImage;
+PoolSiteProfile::Site *PoolSiteProfile::sites;
+PoolSiteProfile::Sample *PoolSiteProfile::samples;
+std::atomic<uint64_t> PoolSiteProfile::droppedPops;
+std::atomic<uint64_t> PoolSiteProfile::droppedSamples;
+
+
+/***********************************************************************
+* Pools
+* One thread's stack of pages, with AutoreleasePoolPage's push(),
+* autorelease() and pop(). Config supplies the Pages, whether
+* add() coalesces repeated autoreleases as
+* SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS does, whether releaseUntil()
+* takes RELEASE_BATCH entries off the page at once, and the
+* PoolSiteSampleInterval of the push site profile, or 0 for none.
+**********************************************************************/
+
+// objc_object::rootTryReleaseMany(): one update for count releases,
+// or none if they would deallocate the object.
+static bool tryReleaseMany(id obj, uintptr_t count)
+{
+    uintptr_t rc = __atomic_load_n(&obj->extra_rc, __ATOMIC_RELAXED);
+    do {
+        if (rc < count * BENCH_RC_ONE) return false;
+    } while (!__atomic_compare_exchange_n(&obj->extra_rc, &rc,
+                                          rc - count * BENCH_RC_ONE,
+                                          true, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+    return true;
+}
+
+// objc_releaseArray() for nonpointer objects: rootRelease() of each,
+// then -dealloc of the ones that reached zero.
+static void releaseArray(id *objs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (objs[i]->rootRelease()) deallocObject(objs[i]);
+    }
+}
+
+template <typename Config>
+class Pool {
+    typedef typename Config::Pages Pages;
+
+    static size_t const RELEASE_BATCH = 64;  // entries released at once
+
+    // A pool entry for an object autoreleased count+1 times in a row.
+    struct AutoreleasePoolEntry {
+        uintptr_t ptr: 48;
+        uintptr_t count: 16;
+
+        static const uintptr_t maxCount = 65535;  // 2^16 - 1
+    };
+
+    struct Page {
+        Page *parent;
+        Page *child;
+        id *next;
+
+        id *begin() { return (id *)(this + 1); }
+        id *end() { return (id *)((uint8_t *)this + PageSize); }
+        bool empty() { return next == begin(); }
+        bool full() { return next == end(); }
+        bool lessThanHalfFull() {
+            return (next - begin() < (end() - begin()) / 2);
+        }
+    };
+
+    Page *hot;
+    size_t pages;
+
+ public:
+    size_t maxPages;
+
+ private:
+    Page *newPage(Page *parent) {
+        Page *page = (Page *)Pages::alloc();
+        maxPages = std::max(maxPages, ++pages);
+        page->parent = parent;
+        page->child = nullptr;
+        page->next = page->begin();
+        if (parent) parent->child = page;
+        return page;
+    }
+
+    // Frees page and its children, coldest last.
+    void kill(Page *page) {
+        Page *last = page;
+        while (last->child) last = last->child;
+        if (page->parent) page->parent->child = nullptr;
+        for (;;) {
+            Page *parent = last->parent;
+            Pages::dealloc(last);
+            pages--;
+            if (last == page) break;
+            last = parent;
+        }
+    }
+
+    static Page *pageForPointer(id *p) {
+        return (Page *)((uintptr_t)p & ~(uintptr_t)(PageSize - 1));
+    }
+
+    id *add(id obj) {
+        if (Config::Coalesce  &&  obj != POOL_BOUNDARY  &&  !hot->empty()) {
+            AutoreleasePoolEntry *topEntry = (AutoreleasePoolEntry *)hot->next - 1;
+            if (topEntry->ptr == (uintptr_t)obj  &&
+                topEntry->count < AutoreleasePoolEntry::maxCount)
+            {
+                topEntry->count++;
+                return (id *)topEntry;
+            }
+        }
+
+        if (hot->full()) {
+            Page *page = hot->child ? hot->child : newPage(hot);
+            hot = page;
+        }
+        id *ret = hot->next;
+        *hot->next++ = obj;
+        return ret;
+    }
+
+    static void release(id obj) {
+        if (obj->rootRelease()) deallocObject(obj);
+    }
+
+    static id entryObject(id *entry, uintptr_t *releases) {
+        if (!Config::Coalesce) {
+            *releases = 1;
+            return *entry;
+        }
+        AutoreleasePoolEntry poolEntry = *(AutoreleasePoolEntry *)entry;
+        *releases = poolEntry.count + 1;
+        return (id)(uintptr_t)poolEntry.ptr;
+    }
+
+    static void releaseRepeated(id obj, uintptr_t count) {
+        if (count > 1  &&  tryReleaseMany(obj, count)) return;
+        while (count--) release(obj);
+    }
+
+    void releaseUntil(id *stop) {
+        if (Config::Batch) {
+            releaseUntilBatched(stop);
+            return;
+        }
+        while (pageForPointer(stop)->next != stop) {
+            Page *page = hot;
+            while (page->empty()) {
+                page = page->parent;
+                hot = page;
+            }
+            uintptr_t releases;
+            id obj = entryObject(--page->next, &releases);
+            memset((void *)page->next, 0xA3, sizeof(*page->next));
+            if (obj != POOL_BOUNDARY) releaseRepeated(obj, releases);
+        }
+        hot = pageForPointer(stop);
+    }
+
+    // releaseUntil() with entries taken off the hot page RELEASE_BATCH
+    // at a time, hottest first, and released with objc_releaseArray().
+    void releaseUntilBatched(id *stop) {
+        id batch[RELEASE_BATCH];
+        uint16_t extra[RELEASE_BATCH];
+        Page *stopPage = pageForPointer(stop);
+
+        while (stopPage->next != stop) {
+            Page *page = hot;
+            while (page->empty()) {
+                page = page->parent;
+                hot = page;
+            }
+
+            id *end = page->next;
+            id *start = end - std::min(end - page->begin(), (ptrdiff_t)RELEASE_BATCH);
+            if (page == stopPage  &&  start < stop) start = stop;
+
+            size_t count = 0;
+            bool repeated = false;
+            for (id *p = end; p > start; ) {
+                uintptr_t releases;
+                id obj = entryObject(--p, &releases);
+                if (obj == POOL_BOUNDARY) continue;
+                batch[count] = obj;
+                extra[count] = (uint16_t)(releases - 1);
+                if (releases > 1) repeated = true;
+                count++;
+            }
+
+            page->next = start;
+            memset((void *)start, 0xA3, (end - start) * sizeof(*start));
+
+            if (slowpath(repeated)) {
+                for (size_t i = 0; i < count; i++) {
+                    if (extra[i]) releaseRepeated(batch[i], extra[i]);
+                }
+            }
+            if (count == 1) release(batch[0]);
+            else if (count > 1) releaseArray(batch, count);
+        }
+        hot = stopPage;
+    }
+
+ public:
+    Pool() : pages(0), maxPages(0) { hot = newPage(nullptr); }
+
+    ~Pool() { kill(hot = coldPage()); }
+
+    Page *coldPage() {
+        Page *page = hot;
+        while (page->parent) page = page->parent;
+        return page;
+    }
+
+    id *push() {
+        id *token = add(POOL_BOUNDARY);
+        if (Config::SiteInterval) {
+            PoolSiteProfile::pushed(token, __builtin_return_address(0));
+        }
+        return token;
+    }
+
+    void autorelease(id obj) {
+        if (Config::SiteInterval) PoolSiteProfile::autoreleased(obj);
+        add(obj);
+    }
+
+    void pop(id *token) {
+        if (Config::SiteInterval) PoolSiteProfile::popping(token);
+        releaseUntil(token);
+        Page *page = pageForPointer(token);
+        if (page->child) {
+            // Keep one empty child page as hysteresis.
+            if (page->lessThanHalfFull()) kill(page->child);
+            else if (page->child->child) kill(page->child->child);
+        }
+    }
+};
+
+
+/***********************************************************************
+* Driver
+**********************************************************************/
+
+struct MallocPool {
+    static constexpr const char *name = "malloc pages";
+    typedef MallocPages Pages;
+    enum { Coalesce = 0, Batch = 0, SiteInterval = 0 };
+};
+
+struct CachedPool {
+    static constexpr const char *name = "PoolPageCache";
+    typedef CachedPages Pages;
+    enum { Coalesce = 0, Batch = 0, SiteInterval = 0 };
+};
+
+struct CoalescedPool {
+    static constexpr const char *name = "coalesced entries";
+    typedef CachedPages Pages;
+    enum { Coalesce = 1, Batch = 0, SiteInterval = 0 };
+};
+
+struct BatchedPool {
+    static constexpr const char *name = "batched pop";
+    typedef CachedPages Pages;
+    enum { Coalesce = 1, Batch = 1, SiteInterval = 0 };
+};
+
+// BatchedPool under OBJC_PRINT_POOL_SITES, sampling one autorelease
+// in 64 (the default) and every autorelease.
+struct SampledPool {
+    static constexpr const char *name = "pool sites 1/64";
+    typedef CachedPages Pages;
+    enum { Coalesce = 1, Batch = 1, SiteInterval = 64 };
+};
+
+struct EveryPool {
+    static constexpr const char *name = "pool sites 1/1";
+    typedef CachedPages Pages;
+    enum { Coalesce = 1, Batch = 1, SiteInterval = 1 };
+};
+
+// Each thread pushes a pool, retains and autoreleases burst objects of
+// its own and pops the pool. Each object is autoreleased repeat times
+// in a row, as a getter called in a loop autoreleases its result.
+// Mops/s counts autoreleases; latencies are per burst. Bytes are the
+// pool pages per autorelease at the deepest point.
+template <typename Config>
+static void run(const Options& options, size_t burst, size_t repeat,
+                unsigned threads)
+{
+    if (!options.wants(Config::name)) return;
+
+    std::vector<Pool<Config>> pools(threads);
+    std::vector<std::vector<id>> objects(threads);
+    for (auto& objs : objects) {
+        objs.resize(burst / repeat);
+        for (auto& obj : objs) obj = newObject();
+    }
+
+    size_t bursts = std::max(options.lookups / burst, (size_t)1);
+    if (Config::SiteInterval) {
+        PoolSiteSampleInterval = Config::SiteInterval;
+        PoolSiteProfile::init();
+    }
+    ConcurrentResult r = measureConcurrent(threads, bursts, 0,
+        []{},
+        [&](unsigned t, size_t) {
+            auto& pool = pools[t];
+            id *token = pool.push();
+            for (id obj : objects[t]) {
+                for (size_t k = 0; k < repeat; k++) {
+                    obj->rootTryRetainFast();
+                    pool.autorelease(obj);
+                }
+            }
+            pool.pop(token);
+        },
+        [](unsigned, size_t) { });
+
+    for (auto& objs : objects) {
+        for (id obj : objs) {
+            if (obj->extra_rc != 0) {
+                fprintf(stderr, "object %p has extra_rc %lu after pop\n",
+                        obj, (unsigned long)obj->extra_rc);
+                abort();
+            }
+            if (obj->rootRelease()) deallocObject(obj);
+        }
+    }
+
+    // Both passes' pools, all from one push site.
+    if (Config::SiteInterval) {
+        uint64_t pops, popped, sampled;
+        PoolSiteProfile::totals(&pops, &popped, &sampled);
+        uint64_t expected = 2 * bursts * threads;
+        if (pops != expected  ||  popped != expected * burst  ||
+            sampled != expected * burst / Config::SiteInterval)
+        {
+            fprintf(stderr, "pool site profile has %llu pops of %llu objects "
+                    "and %llu samples; expected %llu pops of %llu objects\n",
+                    (unsigned long long)pops, (unsigned long long)popped,
+                    (unsigned long long)sampled, (unsigned long long)expected,
+                    (unsigned long long)(expected * burst));
+            abort();
+        }
+    }
+
+    char keys[32], op[32];
+    snprintf(keys, sizeof(keys), "%zux%zu", burst, repeat);
+    snprintf(op, sizeof(op), "burst t%u", threads);
+    r.reads.mops *= burst;
+    print(Config::name, keys, op, r.reads,
+          (double)(pools[0].maxPages * PageSize) / burst);
+}
+
+template <typename Config>
+static void runAll(const Options& options)
+{
+    // Within the first page, two pages, and past the thread cache.
+    static const size_t bursts[] = { 16, 1024, 4096 };
+    static const unsigned threadCounts[] = { 1, 4 };
+    for (size_t burst : bursts) {
+        for (unsigned threads : threadCounts) {
+            run<Config>(options, burst, 1, threads);
+        }
+    }
+
+    static const size_t repeats[] = { 4, 16 };
+    for (size_t repeat : repeats) run<Config>(options, 1024, repeat, 1);
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+
+    printf("# %zu autoreleases per thread, %u CPUs\n",
+           options.lookups, std::thread::hardware_concurrency());
+    printHeader();
+
+    runAll<MallocPool>(options);
+    runAll<CachedPool>(options);
+    runAll<CoalescedPool>(options);
+    runAll<BatchedPool>(options);
+    runAll<SampledPool>(options);
+    runAll<EveryPool>(options);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * bench-runtime.cpp
+ * Definitions for the runtime functions declared by bench-runtime.h.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+malloc_zone_t *malloc_default_zone(void)
+{
+    return nullptr;
+}
+
+malloc_zone_t *malloc_zone_from_ptr(const void *ptr __unused)
+{
+    return nullptr;
+}
+
+void *malloc_zone_malloc(malloc_zone_t *zone __unused, size_t size)
+{
+    return malloc(size);
+}
+
+void *malloc_zone_calloc(malloc_zone_t *zone __unused, size_t count, size_t size)
+{
+    return calloc(count, size);
+}
+
+void *malloc_zone_realloc(malloc_zone_t *zone __unused, void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void malloc_zone_free(malloc_zone_t *zone __unused, void *ptr)
+{
+    free(ptr);
+}
+
+
+static void _objc_vinform(const char *fmt, va_list ap)
+{
+    fprintf(stderr, "objc[%d]: ", (int)getpid());
+    vfprintf(stderr, fmt, ap);
+    if (fmt[0]  &&  fmt[strlen(fmt)-1] != '\n') fputc('\n', stderr);
+}
+
+void _objc_inform(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    _objc_vinform(fmt, ap);
+    va_end(ap);
+}
+
+void _objc_inform_now_and_on_crash(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    _objc_vinform(fmt, ap);
+    va_end(ap);
+}
+
+void _objc_fatal(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    _objc_vinform(fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+
+extern "C" void __NXMAPTABLE_CORRUPTED__
+(const void *table, const void *buckets __unused, uint64_t count __unused,
+ uint64_t nbBucketsMinusOne __unused, uint64_t badkeys __unused, 
+ uint64_t index __unused, uint64_t index2 __unused, 
+ uint64_t pairIndexes __unused, const void *key1 __unused,
+ const void *value1 __unused, const void *key2 __unused, 
+ const void *value2 __unused, const void *key3 __unused, 
+ const void *value3 __unused)
+{
+    _objc_fatal("NXMapTable %p is corrupted", table);
+}
+
+
+// Objects in the benchmarks never have custom retain/release,
+// so the weak table never asks them about weak references.
+
+SEL SEL_allowsWeakReference = nil;
+
+// Nor do they copy associated values.
+
+SEL SEL_copy = nil;
+
+extern "C" void objc_msgSend(void)
+{
+    _objc_fatal("objc_msgSend is not available");
+}
+
+IMP object_getMethodImplementation(id obj __unused, SEL name __unused)
+{
+    _objc_fatal("object_getMethodImplementation is not available");
+}
+
+const char *object_getClassName(id obj __unused)
+{
+    return "BenchObject";
+}
+
+void _objc_msgForward(void)
+{
+    _objc_fatal("_objc_msgForward is not available");
+}
+
+
+void SideTableLocksSucceedLock(const void *oldlock __unused)
+{
+}
+
+
+static pthread_key_t BenchDirectKeys[BenchDirectKeyCount];
+
+int pthread_key_init_np(int k, void (*destructor)(void *))
+{
+    if (k < 0  ||  k >= BenchDirectKeyCount) return EINVAL;
+    return pthread_key_create(&BenchDirectKeys[k], destructor);
+}
+
+void *tls_get_direct(tls_key_t k)
+{
+    return pthread_getspecific(BenchDirectKeys[k]);
+}
+
+void tls_set_direct(tls_key_t k, void *value)
+{
+    pthread_setspecific(BenchDirectKeys[k], value);
+}
+
+
+// Never freed: the benchmarks' threads leave no SyncCache entries behind.
+static thread_local _objc_pthread_data BenchPthreadData;
+
+_objc_pthread_data *_objc_fetch_pthread_data(bool create __unused)
+{
+    return &BenchPthreadData;
+}
@@ -0,0 +1,420 @@
+/*
+ * bench-runtime.h
+ * Stands in for objc-private.h when the benchmarks compile runtime 
+ * sources outside the runtime. Each source is compiled with 
+ * `-include bench-runtime.h`, which defines objc-private.h's and 
+ * objc-os.h's include guards so the real headers are skipped, 
+ * and supplies the few runtime declarations the containers use.
+ *
+ * Definitions copied from objc-private.h must be kept in sync with it.
+ */
+
+#ifndef _BENCH_RUNTIME_H_
+#define _BENCH_RUNTIME_H_
+
+#define _OBJC_PRIVATE_H_
+#define _OBJC_OS_H
+
+#ifndef __has_feature
+#   define __has_feature(x) 0
+#endif
+#define _Nonnull
+#define _Nullable
+#define _Null_unspecified
+#define __unused __attribute__((unused))
+
+#include "objc-config.h"
+
+// Build the chained NXHashTable instead of the default one,
+// for comparing the two layouts.
+#if BENCH_CHAINED_HASHTABLE
+#   undef SUPPORT_FLAT_HASHTABLE
+#   define SUPPORT_FLAT_HASHTABLE 0
+#endif
+
+// Build @synchronized with table records only, without thin records.
+#if BENCH_NO_THIN_SYNC
+#   undef SUPPORT_THIN_SYNC
+#   define SUPPORT_THIN_SYNC 0
+#endif
+
+#define OBJC_TYPES_DEFINED 1
+#undef OBJC_OLD_DISPATCH_PROTOTYPES
+#define OBJC_OLD_DISPATCH_PROTOTYPES 0
+
+#include <cstddef>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <sys/param.h>
+#include <malloc/malloc.h>
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+// As objc-os.h does.
+#include <vector>
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+struct objc_class;
+struct objc_object;
+
+typedef struct objc_class *Class;
+typedef struct objc_object *id;
+typedef struct method_t *Method;
+typedef struct ivar_t *Ivar;
+typedef struct category_t *Category;
+typedef struct property_t *objc_property_t;
+
+#define nil nullptr
+#define Nil nullptr
+
+#include <objc/objc.h>
+
+#define OBJC_EXTERN extern "C"
+
+#define BREAKPOINT_FUNCTION(prototype)                             \
+    OBJC_EXTERN __attribute__((noinline, used, visibility("hidden"))) \
+    prototype { asm(""); }
+
+// Objects handed to the weak table are plain memory with 
+// default retain/release that is never deallocating.
+// Benchmarks that retain objects keep the count in extra_rc, 
+// which stands in for isa's extra_rc and deallocating bits.
+struct objc_class {
+    bool hasCustomRR() { return false; }
+};
+
+#define BENCH_RC_ONE          2
+#define BENCH_RC_DEALLOCATING 1
+
+struct objc_object {
+    Class isa;
+    uintptr_t extra_rc;
+
+    Class ISA() { return isa; }
+    bool isTaggedPointer() { return false; }
+    bool rootIsDeallocating() { 
+        return __atomic_load_n(&extra_rc, __ATOMIC_RELAXED) & BENCH_RC_DEALLOCATING;
+    }
+
+    // Same contract as objc-object.h: never retains an object that 
+    // is deallocating.
+    bool rootTryRetainFast() {
+        uintptr_t rc = __atomic_load_n(&extra_rc, __ATOMIC_RELAXED);
+        do {
+            if (rc & BENCH_RC_DEALLOCATING) return false;
+        } while (!__atomic_compare_exchange_n(&extra_rc, &rc, rc + BENCH_RC_ONE,
+                                              true, __ATOMIC_RELAXED, 
+                                              __ATOMIC_RELAXED));
+        return true;
+    }
+
+    // Returns true if the object is now deallocating.
+    bool rootRelease() {
+        uintptr_t rc = __atomic_load_n(&extra_rc, __ATOMIC_RELAXED);
+        uintptr_t next;
+        do {
+            next = rc < BENCH_RC_ONE ? BENCH_RC_DEALLOCATING : rc - BENCH_RC_ONE;
+        } while (!__atomic_compare_exchange_n(&extra_rc, &rc, next,
+                                              true, __ATOMIC_RELEASE, 
+                                              __ATOMIC_RELAXED));
+        return next == BENCH_RC_DEALLOCATING;
+    }
+
+    // Benchmarks remove associations themselves instead of 
+    // deallocating through the runtime, so nothing needs the bit.
+    void setHasAssociatedObjects() { }
+};
+
+#define fastpath(x) (__builtin_expect(bool(x), 1))
+#define slowpath(x) (__builtin_expect(bool(x), 0))
+
+enum { CacheLineSize = 64 };
+
+// Stand-ins for objc-os.h's direct thread keys, backed by 
+// pthread keys so their destructors run at thread exit.
+#define SUPPORT_DIRECT_THREAD_KEYS 1
+typedef int tls_key_t;
+#define OBJECT_HAZARD_KEY     ((tls_key_t)0)
+#define SYNC_DATA_DIRECT_KEY  ((tls_key_t)1)
+#define SYNC_COUNT_DIRECT_KEY ((tls_key_t)2)
+enum { BenchDirectKeyCount = 3 };
+
+// Linux has no directed yield. A short sleep lets a preempted 
+// thread run, as depressing this thread's priority does.
+typedef unsigned int mach_port_t;
+#define SWITCH_OPTION_DEPRESS 1
+static inline mach_port_t mach_thread_self_direct(void) { return 0; }
+static inline int thread_switch(mach_port_t, int, unsigned int) {
+    return usleep(1);
+}
+
+extern void *tls_get_direct(tls_key_t k);
+extern void tls_set_direct(tls_key_t k, void *value);
+extern int pthread_key_init_np(int k, void (*destructor)(void *));
+
+__BEGIN_DECLS
+
+extern void _objc_inform(const char *fmt, ...) 
+    __attribute__((format(printf, 1, 2)));
+extern void _objc_inform_now_and_on_crash(const char *fmt, ...) 
+    __attribute__((format(printf, 1, 2)));
+extern void _objc_fatal(const char *fmt, ...) 
+    __attribute__((noreturn, format(printf, 1, 2)));
+
+extern IMP object_getMethodImplementation(id obj, SEL name);
+extern const char *object_getClassName(id obj);
+extern void _objc_msgForward(void);
+
+__END_DECLS
+
+extern SEL SEL_allowsWeakReference;
+extern SEL SEL_copy;
+
+// objc-internal.h's entry points. Benchmarks that link runtime 
+// sources calling them define them for their objects.
+extern "C" id objc_retain(id obj);
+extern "C" void objc_release(id obj);
+extern "C" id objc_autorelease(id obj);
+
+
+// Stand-ins for objc-os.h's locks, built on pthread mutexes.
+// spinlock_t blocks like os_unfair_lock instead of spinning.
+
+struct fork_unsafe_lock_t {
+    constexpr fork_unsafe_lock_t() = default;
+};
+static constexpr fork_unsafe_lock_t fork_unsafe_lock;
+
+class spinlock_t {
+    pthread_mutex_t mLock;
+ public:
+    constexpr spinlock_t(const fork_unsafe_lock_t) 
+        : mLock(PTHREAD_MUTEX_INITIALIZER) { }
+    constexpr spinlock_t() : mLock(PTHREAD_MUTEX_INITIALIZER) { }
+    spinlock_t(const spinlock_t&) = delete;
+
+    void lock() { pthread_mutex_lock(&mLock); }
+    bool tryLock() { return pthread_mutex_trylock(&mLock) == 0; }
+    void unlock() { pthread_mutex_unlock(&mLock); }
+    void forceReset() { pthread_mutex_init(&mLock, nullptr); }
+};
+
+class recursive_mutex_t {
+    pthread_mutex_t mLock;
+ public:
+    recursive_mutex_t(const fork_unsafe_lock_t) 
+        : mLock(PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP) { }
+    recursive_mutex_t(const recursive_mutex_t&) = delete;
+
+    void lock() { pthread_mutex_lock(&mLock); }
+    void unlock() { pthread_mutex_unlock(&mLock); }
+
+    // Fails if this thread does not hold the lock.
+    bool tryUnlock() { return pthread_mutex_unlock(&mLock) == 0; }
+};
+
+// No lock ordering is checked.
+static inline void lockdebug_lock_precedes_lock(const void *, const void *) { }
+
+// No side tables either.
+extern void SideTableLocksSucceedLock(const void *oldlock);
+
+// Copied from objc-private.h.
+template<typename T>
+class StripedMap {
+    enum { StripeCount = 64 };
+
+    struct PaddedT {
+        T value alignas(CacheLineSize);
+    };
+
+    PaddedT array[StripeCount];
+
+    static unsigned int indexForPointer(const void *p) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+        return ((addr >> 4) ^ (addr >> 9)) % StripeCount;
+    }
+
+ public:
+    T& operator[] (const void *p) { 
+        return array[indexForPointer(p)].value; 
+    }
+
+    // Shortcuts for StripedMaps of locks.
+    void lockAll() {
+        for (unsigned int i = 0; i < StripeCount; i++) {
+            array[i].value.lock();
+        }
+    }
+
+    void unlockAll() {
+        for (unsigned int i = 0; i < StripeCount; i++) {
+            array[i].value.unlock();
+        }
+    }
+
+    void forceResetAll() {
+        for (unsigned int i = 0; i < StripeCount; i++) {
+            array[i].value.forceReset();
+        }
+    }
+
+    void defineLockOrder() {
+        for (unsigned int i = 1; i < StripeCount; i++) {
+            lockdebug_lock_precedes_lock(&array[i-1].value, &array[i].value);
+        }
+    }
+
+    void precedeLock(const void *newlock) {
+        lockdebug_lock_precedes_lock(&array[StripeCount-1].value, newlock);
+    }
+
+    void succeedLock(const void *oldlock) {
+        lockdebug_lock_precedes_lock(oldlock, &array[0].value);
+    }
+
+    const void *getLock(int i) {
+        if (i < StripeCount) return &array[i].value;
+        else return nil;
+    }
+};
+
+// The parts of objc-private.h's per-thread data the benchmarks use.
+struct SyncCache;
+typedef struct {
+    struct SyncCache *syncCache;
+} _objc_pthread_data;
+
+extern _objc_pthread_data *_objc_fetch_pthread_data(bool create);
+
+// objc-env.h options.
+static const bool DebugNilSync = false;
+
+
+// Copied from objc-private.h. The DisguisedPtr comparisons convert 
+// both sides explicitly because id and objc_object* are the same type here.
+
+static __inline uint32_t _objc_strhash(const char *s) {
+    uint32_t hash = 0;
+    for (;;) {
+    int a = *s++;
+    if (0 == a) break;
+    hash += (hash << 8) + a;
+    }
+    return hash;
+}
+
+template <typename T>
+static inline T log2u(T x) {
+    return (x<2) ? 0 : log2u(x>>1)+1;
+}
+
+template <typename T>
+static inline T exp2u(T x) {
+    return (1 << x);
+}
+
+template <typename T>
+static T exp2m1u(T x) { 
+    return (1 << x) - 1; 
+}
+
+template <typename T>
+class DisguisedPtr {
+    uintptr_t value;
+
+    static uintptr_t disguise(T* ptr) {
+        return -(uintptr_t)ptr;
+    }
+
+    static T* undisguise(uintptr_t val) {
+        return (T*)-val;
+    }
+
+ public:
+    DisguisedPtr() { }
+    DisguisedPtr(T* ptr) 
+        : value(disguise(ptr)) { }
+    DisguisedPtr(const DisguisedPtr<T>& ptr) 
+        : value(ptr.value) { }
+
+    DisguisedPtr<T>& operator = (T* rhs) {
+        value = disguise(rhs);
+        return *this;
+    }
+    DisguisedPtr<T>& operator = (const DisguisedPtr<T>& rhs) {
+        value = rhs.value;
+        return *this;
+    }
+
+    operator T* () const {
+        return undisguise(value);
+    }
+    T* operator -> () const { 
+        return undisguise(value);
+    }
+    T& operator * () const { 
+        return *undisguise(value);
+    }
+    T& operator [] (size_t i) const {
+        return undisguise(value)[i];
+    }
+};
+
+static inline bool operator == (DisguisedPtr<objc_object> lhs, id rhs) {
+    return (objc_object *)lhs == (objc_object *)rhs;
+}
+static inline bool operator != (DisguisedPtr<objc_object> lhs, id rhs) {
+    return (objc_object *)lhs != (objc_object *)rhs;
+}
+
+// Copied from objc-os.h, with all memory treated as mutable.
+
+static inline char *
+strdupIfMutable(const char *str)
+{
+    return strdup(str);
+}
+
+static inline void
+freeIfMutable(char *str)
+{
+    free(str);
+}
+
+// maptable.mm defines __NXMAPTABLE_CORRUPTED__ in Mach-O assembly,
+// which ELF assemblers reject. The Makefile sets BENCH_NO_TOPLEVEL_ASM
+// for that file and bench-runtime.cpp defines the function instead.
+#if BENCH_NO_TOPLEVEL_ASM
+#   define asm(...)
+#endif
+
+#if __LP64__
+static inline uint32_t ptr_hash(uint64_t key)
+{
+    key ^= key >> 4;
+    key *= 0x8a970be7488fda55;
+    key ^= __builtin_bswap64(key);
+    return (uint32_t)key;
+}
+#else
+static inline uint32_t ptr_hash(uint32_t key)
+{
+    key ^= key >> 4;
+    key *= 0x5052acdb;
+    key ^= __builtin_bswap32(key);
+    return key;
+}
+#endif
+
+#endif
@@ -0,0 +1,445 @@
+/*
+ * bench.h
+ * Timing, latency, memory and key generation shared by the benchmarks.
+ *
+ * Every benchmark reports one line per measured operation:
+ *   table  keys  op  Mops/s  p50  p99  p99.9  [bytes/entry]
+ * Throughput comes from a pass with one timer around the whole loop.
+ * Latencies come from a second pass that times each operation
+ * separately, minus the cost of reading the clock.
+ * Concurrent benchmarks time the readers while writers run alongside.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace bench {
+
+static inline uint64_t nanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Keep the compiler from discarding a result.
+template <typename T>
+static inline void keep(T const& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Bytes currently allocated from the malloc heap, including
+// malloc's own per-block overhead. Large blocks are mmapped and
+// counted apart from the heap's arena.
+static inline size_t heapBytes()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+
+/***********************************************************************
+* Random numbers and key distributions
+**********************************************************************/
+
+class Random {
+    uint64_t state;
+
+public:
+    Random(uint64_t seed = 0x9e3779b97f4a7c15ull) : state(seed | 1) { }
+
+    uint64_t next() {
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dull;
+    }
+
+    size_t below(size_t n) {
+        return (size_t)(((unsigned __int128)next() * n) >> 64);
+    }
+
+    template <typename T>
+    void shuffle(std::vector<T>& v) {
+        for (size_t i = v.size(); i > 1; i--) {
+            std::swap(v[i-1], v[below(i)]);
+        }
+    }
+};
+
+// Zipf-distributed ranks in [0, n). A few keys take most lookups,
+// as a few classes, selectors and objects do in a real process.
+class Zipf {
+    std::vector<double> cdf;
+
+public:
+    Zipf(size_t n, double s = 0.99) : cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / pow((double)(i + 1), s);
+            cdf[i] = sum;
+        }
+        for (size_t i = 0; i < n; i++) cdf[i] /= sum;
+    }
+
+    size_t next(Random& r) {
+        double u = (double)(r.next() >> 11) / (double)(1ull << 53);
+        size_t i = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return i < cdf.size() ? i : cdf.size() - 1;
+    }
+};
+
+// Addresses of live heap blocks sized like typical object instances,
+// in allocation order. Keys are real heap addresses so pointer hashes
+// see the same alignment and clustering as the runtime does.
+static inline std::vector<void *> objectKeys(size_t n, Random& r)
+{
+    static const size_t sizes[] = { 16, 16, 32, 32, 32, 48, 64, 64, 96, 128, 256 };
+    std::vector<void *> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = calloc(1, sizes[r.below(sizeof(sizes)/sizeof(sizes[0]))]);
+    }
+    return keys;
+}
+
+static inline void freeObjectKeys(std::vector<void *>& keys)
+{
+    for (void *key : keys) free(key);
+    keys.clear();
+}
+
+// Unique selector-like names such as "setObject:forKey:" or
+// "initWithFrameAndStyle:", built from Cocoa-style words.
+static inline std::vector<char *> selectorKeys(size_t n, Random& r)
+{
+    static const char * const verbs[] = {
+        "init", "set", "get", "is", "copy", "mutableCopy", "add", "remove",
+        "insert", "replace", "perform", "load", "draw", "update", "will",
+        "did", "should", "can", "object", "value", "array", "dictionary",
+        "string", "number", "view", "layout", "encode", "decode", "handle",
+        "notify",
+    };
+    static const char * const nouns[] = {
+        "Object", "Value", "Key", "Index", "Frame", "Bounds", "Color",
+        "Font", "Title", "Delegate", "DataSource", "Target", "Action",
+        "Selector", "Name", "Path", "URL", "Data", "String", "Count",
+        "Range", "Size", "Origin", "Layer", "Window", "View", "Controller",
+        "Item", "Row", "Section", "Cell", "Image", "State", "Style",
+        "Options", "Error", "Handler", "Queue", "Context", "Coder",
+    };
+    static const char * const joins[] = { "With", "For", "At", "From", "To", "In" };
+    const size_t nverbs = sizeof(verbs)/sizeof(verbs[0]);
+    const size_t nnouns = sizeof(nouns)/sizeof(nouns[0]);
+    const size_t njoins = sizeof(joins)/sizeof(joins[0]);
+
+    std::unordered_set<std::string> seen;
+    std::vector<char *> keys;
+    keys.reserve(n);
+    while (keys.size() < n) {
+        std::string name = verbs[r.below(nverbs)];
+        name += nouns[r.below(nnouns)];
+        size_t args = r.below(4);
+        if (args > 0) {
+            name += joins[r.below(njoins)];
+            name += nouns[r.below(nnouns)];
+            name += ":";
+        }
+        for (size_t i = 1; i < args; i++) {
+            std::string part = nouns[r.below(nnouns)];
+            part[0] = (char)(part[0] - 'A' + 'a');
+            name += part;
+            name += ":";
+        }
+        if (seen.size() > n * 4) {
+            // Ran out of combinations; number the rest.
+            name += std::to_string(keys.size());
+        }
+        if (seen.insert(name).second) {
+            keys.push_back(strdup(name.c_str()));
+        }
+    }
+    return keys;
+}
+
+static inline void freeSelectorKeys(std::vector<char *>& keys)
+{
+    for (char *key : keys) free(key);
+    keys.clear();
+}
+
+// Copies of keys at different addresses, so string lookups
+// compare characters instead of hitting the pointer-equality shortcut.
+static inline std::vector<char *> copyKeys(const std::vector<char *>& keys)
+{
+    std::vector<char *> copies(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) copies[i] = strdup(keys[i]);
+    return copies;
+}
+
+// A lookup stream of n indexes into keys, Zipf-skewed over a
+// random permutation so hot keys are scattered through the table.
+static inline std::vector<size_t> zipfStream(size_t keys, size_t n, Random& r)
+{
+    std::vector<size_t> perm(keys);
+    for (size_t i = 0; i < keys; i++) perm[i] = i;
+    r.shuffle(perm);
+    Zipf zipf(keys);
+    std::vector<size_t> stream(n);
+    for (size_t i = 0; i < n; i++) stream[i] = perm[zipf.next(r)];
+    return stream;
+}
+
+static inline std::vector<size_t> shuffledIndexes(size_t n, Random& r)
+{
+    std::vector<size_t> v(n);
+    for (size_t i = 0; i < n; i++) v[i] = i;
+    r.shuffle(v);
+    return v;
+}
+
+
+/***********************************************************************
+* Measurement
+**********************************************************************/
+
+class Latencies {
+    std::vector<uint32_t> samples;
+
+public:
+    void reserve(size_t n) { samples.reserve(n); }
+    void add(uint64_t ns) { samples.push_back(ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns); }
+    void merge(const Latencies& other) {
+        samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+    }
+
+    // Call once after all samples are added.
+    uint32_t percentile(double p) {
+        if (samples.empty()) return 0;
+        size_t i = (size_t)(p / 100.0 * (samples.size() - 1));
+        std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+        return samples[i];
+    }
+};
+
+// The cheapest observed back-to-back clock read, subtracted
+// from every per-operation sample.
+static inline uint64_t clockOverhead()
+{
+    static uint64_t overhead = UINT64_MAX;
+    if (overhead == UINT64_MAX) {
+        for (int i = 0; i < 10000; i++) {
+            uint64_t a = nanoseconds();
+            uint64_t b = nanoseconds();
+            overhead = std::min(overhead, b - a);
+        }
+    }
+    return overhead;
+}
+
+struct Result {
+    double mops;
+    uint32_t p50, p99, p999, max;
+};
+
+static inline void printHeader()
+{
+    printf("%-24s %-10s %-12s %9s %7s %7s %7s %8s %12s\n",
+           "table", "keys", "op", "Mops/s", "p50ns", "p99ns", "p99.9ns",
+           "maxns", "bytes/entry");
+}
+
+static inline void print(const char *table, const char *keys, const char *op,
+                         const Result& r, double bytesPerEntry = -1)
+{
+    printf("%-24s %-10s %-12s %9.2f %7u %7u %7u %8u",
+           table, keys, op, r.mops, r.p50, r.p99, r.p999, r.max);
+    if (bytesPerEntry >= 0) printf(" %12.1f", bytesPerEntry);
+    printf("\n");
+    fflush(stdout);
+}
+
+// Runs op(0..count-1) twice: once timed as a whole for throughput,
+// once with each call timed for latency. setup() runs before each pass
+// and is not timed.
+template <typename Setup, typename Op>
+static inline Result measure(size_t count, Setup setup, Op op)
+{
+    Result result;
+    uint64_t overhead = clockOverhead();
+
+    setup();
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < count; i++) op(i);
+    uint64_t elapsed = nanoseconds() - start;
+    result.mops = elapsed ? (double)count * 1000.0 / (double)elapsed : 0;
+
+    Latencies latencies;
+    latencies.reserve(count);
+    setup();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t a = nanoseconds();
+        op(i);
+        uint64_t b = nanoseconds();
+        uint64_t ns = b - a;
+        latencies.add(ns > overhead ? ns - overhead : 0);
+    }
+    result.p50 = latencies.percentile(50);
+    result.p99 = latencies.percentile(99);
+    result.p999 = latencies.percentile(99.9);
+    result.max = latencies.percentile(100);
+    return result;
+}
+
+template <typename Op>
+static inline Result measure(size_t count, Op op)
+{
+    return measure(count, []{}, op);
+}
+
+
+// Runs read(reader, i) for i in [0, count) on each of readers threads 
+// while writers threads call write(writer, i) until every reader is done.
+// Like measure(), there is one pass for throughput and one that times 
+// each read and write. setup() runs before each pass and is not timed.
+// Throughputs are the combined rates of all readers and all writers.
+struct ConcurrentResult {
+    Result reads;
+    Result writes;
+};
+
+template <typename Setup, typename Read, typename Write>
+static inline ConcurrentResult 
+measureConcurrent(unsigned readers, size_t count, unsigned writers, 
+                  Setup setup, Read read, Write write)
+{
+    ConcurrentResult result;
+    uint64_t overhead = clockOverhead();
+
+    for (int timed = 0; timed < 2; timed++) {
+        std::atomic<unsigned> ready(0);
+        std::atomic<unsigned> running(readers);
+        std::atomic<bool> go(false);
+        std::atomic<size_t> writeCount(0);
+        std::vector<Latencies> latencies(readers + writers);
+        std::vector<std::thread> threads;
+
+        setup();
+        for (unsigned t = 0; t < readers; t++) {
+            threads.emplace_back([&, t]{
+                if (timed) latencies[t].reserve(count);
+                ready++;
+                while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+                for (size_t i = 0; i < count; i++) {
+                    if (timed) {
+                        uint64_t a = nanoseconds();
+                        read(t, i);
+                        uint64_t ns = nanoseconds() - a;
+                        latencies[t].add(ns > overhead ? ns - overhead : 0);
+                    } else {
+                        read(t, i);
+                    }
+                }
+                running--;
+            });
+        }
+        for (unsigned t = 0; t < writers; t++) {
+            threads.emplace_back([&, t]{
+                size_t i = 0;
+                Latencies& mine = latencies[readers + t];
+                ready++;
+                while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+                while (running.load(std::memory_order_relaxed)) {
+                    if (timed) {
+                        uint64_t a = nanoseconds();
+                        write(t, i++);
+                        uint64_t ns = nanoseconds() - a;
+                        mine.add(ns > overhead ? ns - overhead : 0);
+                    } else {
+                        write(t, i++);
+                    }
+                }
+                writeCount += i;
+            });
+        }
+        while (ready.load() != readers + writers) std::this_thread::yield();
+
+        uint64_t start = nanoseconds();
+        go.store(true, std::memory_order_release);
+        for (auto& thread : threads) thread.join();
+        uint64_t elapsed = nanoseconds() - start;
+
+        if (!timed) {
+            result.reads.mops = elapsed 
+                ? (double)count * readers * 1000.0 / (double)elapsed : 0;
+            result.writes.mops = elapsed 
+                ? (double)writeCount.load() * 1000.0 / (double)elapsed : 0;
+        } else {
+            Latencies reads, writes;
+            reads.reserve(count * readers);
+            for (unsigned t = 0; t < readers; t++) reads.merge(latencies[t]);
+            for (unsigned t = 0; t < writers; t++) writes.merge(latencies[readers + t]);
+            result.reads.p50 = reads.percentile(50);
+            result.reads.p99 = reads.percentile(99);
+            result.reads.p999 = reads.percentile(99.9);
+            result.reads.max = reads.percentile(100);
+            result.writes.p50 = writes.percentile(50);
+            result.writes.p99 = writes.percentile(99);
+            result.writes.p999 = writes.percentile(99.9);
+            result.writes.max = writes.percentile(100);
+        }
+    }
+    return result;
+}
+
+
+/***********************************************************************
+* Command line
+**********************************************************************/
+
+struct Options {
+    size_t entries = 100000;
+    size_t lookups = 1000000;
+    const char *only = nullptr;
+
+    Options(int argc, char **argv) {
+        for (int i = 1; i < argc; i++) {
+            if (0 == strcmp(argv[i], "-n")  &&  i+1 < argc) {
+                entries = strtoul(argv[++i], nullptr, 0);
+            } else if (0 == strcmp(argv[i], "-l")  &&  i+1 < argc) {
+                lookups = strtoul(argv[++i], nullptr, 0);
+            } else if (0 == strcmp(argv[i], "-t")  &&  i+1 < argc) {
+                only = argv[++i];
+            } else {
+                fprintf(stderr, "usage: %s [-n entries] [-l lookups] "
+                        "[-t table]\n", argv[0]);
+                exit(1);
+            }
+        }
+        if (entries == 0) entries = 1;
+    }
+
+    bool wants(const char *table) const {
+        return !only  ||  strstr(table, only);
+    }
+};
+
+};
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ * hashtables.cpp
+ * Insert, lookup and erase costs of the runtime's internal hash tables:
+ * NXHashTable (hashtable2.mm), NXMapTable (maptable.mm),
+ * DenseMap and GroupProbedDenseMap (llvm-DenseMap.h),
+ * the old-ABI selector set (objc-sel-set.mm) and the weak table
+ * (objc-weak.mm).
+ *
+ * Pointer keys are live heap blocks sized like object instances.
+ * String keys are selector-like names; lookups use copies of the keys
+ * so string compares are not skipped by pointer equality.
+ * Hit lookups follow a Zipf distribution; miss lookups use keys
+ * that were never inserted. Erases run in random order.
+ */
+
+#include "bench.h"
+
+#include "hashtable2.h"
+#include "maptable.h"
+#include "llvm-DenseMap.h"
+#include "objc-weak.h"
+
+using namespace bench;
+
+// objc-sel-set.mm is compiled as the old ABI, where objc-sel-set.h
+// declares these, but this file is compiled as the new ABI.
+extern "C" {
+struct __objc_sel_set;
+extern struct __objc_sel_set *__objc_sel_set_create(size_t selrefCount);
+extern SEL __objc_sel_set_get(struct __objc_sel_set *sset, SEL candidate);
+extern void __objc_sel_set_add(struct __objc_sel_set *sset, SEL value);
+}
+
+
+/***********************************************************************
+* Tables under test
+* Each wraps one container as a set of keys with insert, lookup, erase.
+**********************************************************************/
+
+struct NXHashTablePointers {
+    static constexpr const char *name = "NXHashTable";
+    static const bool canErase = true;
+    NXHashTable *table;
+    NXHashTablePointers() : table(NXCreateHashTable(NXPtrPrototype, 0, nil)) { }
+    ~NXHashTablePointers() { NXFreeHashTable(table); }
+    void insert(const void *key) { NXHashInsert(table, key); }
+    bool lookup(const void *key) { return NXHashGet(table, key) != nil; }
+    void erase(const void *key) { NXHashRemove(table, key); }
+};
+
+struct NXHashTableStrings {
+    static constexpr const char *name = "NXHashTable";
+    static const bool canErase = true;
+    NXHashTable *table;
+    NXHashTableStrings() : table(NXCreateHashTable(NXStrPrototype, 0, nil)) { }
+    ~NXHashTableStrings() { NXFreeHashTable(table); }
+    void insert(const char *key) { NXHashInsert(table, key); }
+    bool lookup(const char *key) { return NXHashGet(table, key) != nil; }
+    void erase(const char *key) { NXHashRemove(table, key); }
+};
+
+struct NXMapTablePointers {
+    static constexpr const char *name = "NXMapTable";
+    static const bool canErase = true;
+    NXMapTable *table;
+    NXMapTablePointers() : table(NXCreateMapTable(NXPtrValueMapPrototype, 0)) { }
+    ~NXMapTablePointers() { NXFreeMapTable(table); }
+    void insert(const void *key) { NXMapInsert(table, key, key); }
+    bool lookup(const void *key) { return NXMapGet(table, key) != nil; }
+    void erase(const void *key) { NXMapRemove(table, key); }
+};
+
+struct NXMapTableStrings {
+    static constexpr const char *name = "NXMapTable";
+    static const bool canErase = true;
+    NXMapTable *table;
+    NXMapTableStrings() : table(NXCreateMapTable(NXStrValueMapPrototype, 0)) { }
+    ~NXMapTableStrings() { NXFreeMapTable(table); }
+    void insert(const char *key) { NXMapInsert(table, key, key); }
+    bool lookup(const char *key) { return NXMapGet(table, key) != nil; }
+    void erase(const char *key) { NXMapRemove(table, key); }
+};
+
+// Used like SideTable::refcnts: disguised object keys, size_t values.
+template <typename Map>
+struct RefcountTable {
+    static const bool canErase = true;
+    Map map;
+    void insert(const void *key) { map[DisguisedPtr<objc_object>((objc_object *)key)] += 2; }
+    bool lookup(const void *key) {
+        return map.find(DisguisedPtr<objc_object>((objc_object *)key)) != map.end();
+    }
+    void erase(const void *key) { map.erase(DisguisedPtr<objc_object>((objc_object *)key)); }
+};
+
+struct DenseMapPointers
+    : RefcountTable<objc::DenseMap<DisguisedPtr<objc_object>,size_t,true>>
+{
+    static constexpr const char *name = "DenseMap";
+};
+
+struct GroupProbedDenseMapPointers
+    : RefcountTable<objc::GroupProbedDenseMap<DisguisedPtr<objc_object>,size_t,true>>
+{
+    static constexpr const char *name = "GroupProbedDenseMap";
+};
+
+// The selector set has no erase or free; each instance is leaked.
+struct SelectorSetStrings {
+    static constexpr const char *name = "objc_sel_set";
+    static const bool canErase = false;
+    struct __objc_sel_set *set;
+    SelectorSetStrings() : set(__objc_sel_set_create(0)) { }
+    void insert(const char *key) { __objc_sel_set_add(set, (SEL)key); }
+    bool lookup(const char *key) { return __objc_sel_set_get(set, (SEL)key) != nil; }
+    void erase(const char *) { }
+};
+
+
+/***********************************************************************
+* Driver
+**********************************************************************/
+
+template <typename Table, typename Key>
+static void run(const Options& options, const char *keyName,
+                const std::vector<Key>& keys, const std::vector<Key>& probes,
+                const std::vector<Key>& misses, Random& random)
+{
+    if (!options.wants(Table::name)) return;
+
+    size_t n = keys.size();
+    Table *table = nullptr;
+
+    auto fresh = [&]{
+        delete table;
+        table = new Table;
+    };
+    auto full = [&]{
+        fresh();
+        for (size_t i = 0; i < n; i++) table->insert(keys[i]);
+    };
+
+    size_t before = heapBytes();
+    full();
+    double bytes = (double)(heapBytes() - before) / n;
+
+    Result r = measure(n, fresh, [&](size_t i) { table->insert(keys[i]); });
+    print(Table::name, keyName, "insert", r, bytes);
+
+    std::vector<size_t> stream = zipfStream(n, options.lookups, random);
+    r = measure(options.lookups, [&](size_t i) {
+        keep(table->lookup(probes[stream[i]]));
+    });
+    print(Table::name, keyName, "lookup", r);
+
+    r = measure(options.lookups, [&](size_t i) {
+        keep(table->lookup(misses[i % misses.size()]));
+    });
+    print(Table::name, keyName, "lookup-miss", r);
+
+    if (Table::canErase) {
+        std::vector<size_t> order = shuffledIndexes(n, random);
+        r = measure(n, full, [&](size_t i) { table->erase(keys[order[i]]); });
+        print(Table::name, keyName, "erase", r);
+    }
+
+    delete table;
+}
+
+
+// The weak table keyed by referent. Each object gets one __weak
+// variable, then half of them get a second one, which moves them
+// from the singles table to a weak_entry_t.
+static void freeWeakTable(weak_table_t *table)
+{
+    free(table->entries.weak_entries);
+    free(table->entries.old_entries);
+    free(table->singles.weak_entries);
+    free(table->singles.old_entries);
+    bzero(table, sizeof(*table));
+}
+
+static void runWeakTable(const Options& options,
+                         const std::vector<void *>& objects, Random& random)
+{
+    if (!options.wants("weak_table")) return;
+
+    size_t n = objects.size();
+    size_t half = n / 2;
+    std::vector<id> first(n), second(n);
+    weak_table_t table;
+    bzero(&table, sizeof(table));
+
+    auto reg = [&](std::vector<id>& slots, size_t i) {
+        slots[i] = (id)objects[i];
+        weak_register_no_lock(&table, slots[i], &slots[i], false);
+    };
+    auto clearAll = [&]{
+        for (size_t i = 0; i < n; i++) {
+            if (first[i]  ||  second[i]) weak_clear_no_lock(&table, (id)objects[i]);
+        }
+        freeWeakTable(&table);
+    };
+    // Finish any incremental resize, so that each row times only its
+    // own operations. Unregistering an object that has no weak
+    // references migrates buckets and does nothing else.
+    auto settle = [&]{
+        while (table.entries.old_entries  ||  table.singles.old_entries) {
+            weak_unregister_no_lock(&table, (id)&table, nil);
+        }
+    };
+    auto registered = [&]{
+        clearAll();
+        for (size_t i = 0; i < n; i++) reg(first, i);
+        settle();
+    };
+    auto doubled = [&]{
+        registered();
+        for (size_t i = 0; i < half; i++) reg(second, i);
+        settle();
+    };
+
+    size_t before = heapBytes();
+    registered();
+    double bytes = (double)(ssize_t)(heapBytes() - before) / n;
+    Result r = measure(n, clearAll, [&](size_t i) { reg(first, i); });
+    print("weak_table", "objects", "register", r, bytes);
+
+    // Bytes per object that gains a second variable.
+    registered();
+    before = heapBytes();
+    for (size_t i = 0; i < half; i++) reg(second, i);
+    settle();
+    bytes = (double)(ssize_t)(heapBytes() - before) / half;
+    r = measure(half, registered, [&](size_t i) { reg(second, i); });
+    print("weak_table", "objects", "register2", r, bytes);
+
+    std::vector<size_t> order = shuffledIndexes(half, random);
+    r = measure(half, doubled, [&](size_t i) {
+        size_t k = order[i];
+        weak_unregister_no_lock(&table, (id)objects[k], &second[k]);
+        second[k] = nil;
+    });
+    print("weak_table", "objects", "unregister", r);
+
+    order = shuffledIndexes(n, random);
+    r = measure(n, doubled, [&](size_t i) {
+        size_t k = order[i];
+        weak_clear_no_lock(&table, (id)objects[k]);
+    });
+    print("weak_table", "objects", "clear", r);
+
+    for (size_t i = 0; i < n; i++) first[i] = second[i] = nil;
+    freeWeakTable(&table);
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+    Random random;
+
+    std::vector<void *> objects = objectKeys(options.entries, random);
+    std::vector<void *> otherObjects = objectKeys(options.entries, random);
+    std::vector<char *> selectors = selectorKeys(options.entries * 2, random);
+    std::vector<char *> otherSelectors(selectors.begin() + options.entries,
+                                       selectors.end());
+    selectors.resize(options.entries);
+    std::vector<char *> selectorCopies = copyKeys(selectors);
+
+    printf("# %zu entries, %zu lookups\n", options.entries, options.lookups);
+    printHeader();
+
+    run<NXHashTablePointers>(options, "pointers", objects, objects, otherObjects, random);
+    run<NXHashTableStrings>(options, "strings", selectors, selectorCopies, otherSelectors, random);
+    run<NXMapTablePointers>(options, "pointers", objects, objects, otherObjects, random);
+    run<NXMapTableStrings>(options, "strings", selectors, selectorCopies, otherSelectors, random);
+    run<DenseMapPointers>(options, "pointers", objects, objects, otherObjects, random);
+    run<GroupProbedDenseMapPointers>(options, "pointers", objects, objects, otherObjects, random);
+    run<SelectorSetStrings>(options, "strings", selectors, selectorCopies, otherSelectors, random);
+    runWeakTable(options, objects, random);
+
+    freeSelectorKeys(selectorCopies);
+    freeSelectorKeys(otherSelectors);
+    freeSelectorKeys(selectors);
+    freeObjectKeys(otherObjects);
+    freeObjectKeys(objects);
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Availability.h for building runtime sources on Linux.
+ * Availability annotations are irrelevant to the benchmarks.
+ */
+
+#ifndef _BENCH_AVAILABILITY_H_
+#define _BENCH_AVAILABILITY_H_
+
+#define __OSX_AVAILABLE(...)
+#define __OSX_AVAILABLE_STARTING(...)
+#define __OSX_AVAILABLE_BUT_DEPRECATED(...)
+#define __OSX_AVAILABLE_BUT_DEPRECATED_MSG(...)
+#define __OSX_DEPRECATED(...)
+#define __OSX_UNAVAILABLE
+#define __IOS_AVAILABLE(...)
+#define __IOS_DEPRECATED(...)
+#define __IOS_UNAVAILABLE
+#define __TVOS_AVAILABLE(...)
+#define __TVOS_DEPRECATED(...)
+#define __TVOS_UNAVAILABLE
+#define __WATCHOS_AVAILABLE(...)
+#define __WATCHOS_DEPRECATED(...)
+#define __WATCHOS_UNAVAILABLE
+#define __BRIDGEOS_AVAILABLE(...)
+#define __BRIDGEOS_DEPRECATED(...)
+#define __BRIDGEOS_UNAVAILABLE
+#define __API_AVAILABLE(...)
+#define __API_DEPRECATED(...)
+#define __API_DEPRECATED_WITH_REPLACEMENT(...)
+#define __API_UNAVAILABLE(...)
+#define API_AVAILABLE(...)
+#define API_DEPRECATED(...)
+#define API_UNAVAILABLE(...)
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * AvailabilityMacros.h for building runtime sources on Linux.
+ */
+
+#ifndef _BENCH_AVAILABILITYMACROS_H_
+#define _BENCH_AVAILABILITYMACROS_H_
+
+#include <Availability.h>
+
+#define DEPRECATED_ATTRIBUTE
+#define UNAVAILABLE_ATTRIBUTE
+
+#endif
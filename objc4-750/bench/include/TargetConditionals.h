@@ -0,0 +1,24 @@
+/*
+ * TargetConditionals.h for building runtime sources on Linux.
+ * The benchmarks configure the runtime as it is built for macOS.
+ */
+
+#ifndef _BENCH_TARGETCONDITIONALS_H_
+#define _BENCH_TARGETCONDITIONALS_H_
+
+#define TARGET_OS_MAC           1
+#define TARGET_OS_OSX           1
+#define TARGET_OS_IPHONE        0
+#define TARGET_OS_IOS           0
+#define TARGET_OS_IOSMAC        0
+#define TARGET_OS_TV            0
+#define TARGET_OS_WATCH         0
+#define TARGET_OS_BRIDGE        0
+#define TARGET_OS_SIMULATOR     0
+#define TARGET_OS_EMBEDDED      0
+#define TARGET_OS_WIN32         0
+#define TARGET_OS_UNIX          0
+#define TARGET_OS_LINUX         1
+#define TARGET_IPHONE_SIMULATOR 0
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * libkern/OSAtomic.h for building runtime sources on Linux.
+ * Only the calls the runtime sources built by the benchmarks use.
+ */
+
+#ifndef _BENCH_LIBKERN_OSATOMIC_H_
+#define _BENCH_LIBKERN_OSATOMIC_H_
+
+#include <stdint.h>
+
+static inline int32_t OSAtomicIncrement32Barrier(volatile int32_t *value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t OSAtomicDecrement32Barrier(volatile int32_t *value)
+{
+    return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,4 @@
+/*
+ * mach/thread_switch.h for building runtime sources on Linux.
+ * bench-runtime.h stands in for thread_switch().
+ */
@@ -0,0 +1,30 @@
+/*
+ * malloc/malloc.h for building runtime sources on Linux.
+ * Zones are not available, so every zone is the default heap.
+ * The functions are defined in bench-runtime.cpp.
+ */
+
+#ifndef _BENCH_MALLOC_MALLOC_H_
+#define _BENCH_MALLOC_MALLOC_H_
+
+#include <stddef.h>
+#include <malloc.h>
+
+__BEGIN_DECLS
+
+typedef struct _malloc_zone_t malloc_zone_t;
+
+extern malloc_zone_t *malloc_default_zone(void);
+extern malloc_zone_t *malloc_zone_from_ptr(const void *ptr);
+extern void *malloc_zone_malloc(malloc_zone_t *zone, size_t size);
+extern void *malloc_zone_calloc(malloc_zone_t *zone, size_t count, size_t size);
+extern void *malloc_zone_realloc(malloc_zone_t *zone, void *ptr, size_t size);
+extern void malloc_zone_free(malloc_zone_t *zone, void *ptr);
+
+static inline size_t malloc_size(const void *ptr) {
+    return malloc_usable_size((void *)ptr);
+}
+
+__END_DECLS
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * objects.h
+ * Reference-counted objects for the concurrent benchmarks.
+ *
+ * A live object's isa is LiveClass; a deallocated one's is DeadClass.
+ * Deallocated objects are poisoned and kept for a while before
+ * their memory is reused, so a reader that retains or returns a
+ * deallocated object aborts instead of passing silently.
+ */
+
+#ifndef _BENCH_OBJECTS_H_
+#define _BENCH_OBJECTS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <deque>
+#include <mutex>
+
+namespace bench {
+
+static objc_class LiveClassStorage, DeadClassStorage;
+static Class const LiveClass = &LiveClassStorage;
+static Class const DeadClass = &DeadClassStorage;
+
+// Deallocated objects wait here until GraveyardSize newer ones arrive.
+enum { GraveyardSize = 4096 };
+static std::mutex GraveyardLock;
+static std::deque<objc_object *> Graveyard;
+
+// A new object with a retain count of 1.
+static inline id newObject()
+{
+    objc_object *obj = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(GraveyardLock);
+        if (Graveyard.size() >= GraveyardSize) {
+            obj = Graveyard.front();
+            Graveyard.pop_front();
+        }
+    }
+    if (!obj) obj = (objc_object *)calloc(1, 64);
+    obj->extra_rc = 0;
+    __atomic_store_n(&obj->isa, LiveClass, __ATOMIC_RELEASE);
+    return obj;
+}
+
+static inline void deallocObject(objc_object *obj)
+{
+    __atomic_store_n(&obj->isa, DeadClass, __ATOMIC_RELAXED);
+    std::lock_guard<std::mutex> lock(GraveyardLock);
+    Graveyard.push_back(obj);
+}
+
+static inline bool isLive(id obj)
+{
+    return __atomic_load_n(&obj->isa, __ATOMIC_RELAXED) == LiveClass;
+}
+
+// Aborts if obj is non-nil and was deallocated.
+static inline void checkLive(id obj, const char *what)
+{
+    if (obj  &&  !isLive(obj)) {
+        fprintf(stderr, "%s returned deallocated object %p\n", what, obj);
+        abort();
+    }
+}
+
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * properties.cpp
+ * Atomic object properties under concurrent getters and setters,
+ * with objc-accessors.mm's lock-free getter built on objc-hazard.mm
+ * and with PropertyLocks alone.
+ *
+ * The getter and setter mirror objc_getProperty() and
+ * reallySetProperty() for an atomic, non-copy property.
+ * objc_retain and objc_release are the prelude's rootTryRetainFast()
+ * and rootRelease(), and PropertyLocks is 64 striped mutexes.
+ * Getters abort if they return a deallocated object.
+ */
+
+#include "bench.h"
+#include "objects.h"
+
+#include <mutex>
+
+#include "objc-hazard.h"
+
+using namespace bench;
+
+extern void hazard_init(void);
+
+enum { StripeCount = 64 };
+
+static unsigned int indexForPointer(const void *p) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+    return ((addr >> 4) ^ (addr >> 9)) % StripeCount;
+}
+
+struct alignas(CacheLineSize) PropertyLock {
+    std::mutex lock;
+};
+
+static PropertyLock PropertyLocks[StripeCount];
+
+static std::mutex& propertyLock(id *slot) {
+    return PropertyLocks[indexForPointer(slot)].lock;
+}
+
+
+// objc_retain() and objc_release() for objects without RR overrides.
+static id retainObject(id obj)
+{
+    if (obj  &&  !obj->rootTryRetainFast()) {
+        fprintf(stderr, "retained a deallocating object\n");
+        abort();
+    }
+    return obj;
+}
+
+static void releaseObject(id obj)
+{
+    if (obj  &&  obj->rootRelease()) deallocObject(obj);
+}
+
+
+/***********************************************************************
+* Accessors
+**********************************************************************/
+
+struct LockedProperty {
+    static constexpr const char *name = "PropertyLocks";
+
+    static id get(id *slot) {
+        std::mutex& slotlock = propertyLock(slot);
+        slotlock.lock();
+        id value = retainObject(*slot);
+        slotlock.unlock();
+        return value;
+    }
+
+    static void set(id *slot, id newValue) {
+        std::mutex& slotlock = propertyLock(slot);
+        slotlock.lock();
+        id oldValue = *slot;
+        *slot = newValue;
+        slotlock.unlock();
+        releaseObject(oldValue);
+    }
+};
+
+struct HazardProperty {
+    static constexpr const char *name = "ObjectHazard";
+
+    static id get(id *slot) {
+        ObjectHazard *hazard = objectHazardForThread();
+        id value = (id)objectHazardAcquire(hazard, slot);
+        if (value  &&  !value->isTaggedPointer()) {
+            bool retained =
+                !value->ISA()->hasCustomRR()  &&  value->rootTryRetainFast();
+            objectHazardRelease(hazard);
+            if (!retained) {
+                std::mutex& slotlock = propertyLock(slot);
+                slotlock.lock();
+                value = retainObject(*slot);
+                slotlock.unlock();
+            }
+        }
+        return value;
+    }
+
+    static void set(id *slot, id newValue) {
+        std::mutex& slotlock = propertyLock(slot);
+        slotlock.lock();
+        id oldValue = __atomic_exchange_n(slot, newValue, __ATOMIC_SEQ_CST);
+        slotlock.unlock();
+        objectHazardsWait(oldValue);
+        releaseObject(oldValue);
+    }
+};
+
+
+/***********************************************************************
+* Driver
+**********************************************************************/
+
+// Readers get random properties of a set of owners and release the
+// values, as an autorelease pool would. Writers replace random
+// properties with new objects.
+template <typename Property>
+static void run(const Options& options, size_t properties,
+                unsigned readers, unsigned writers)
+{
+    if (!options.wants(Property::name)) return;
+
+    std::vector<id> slots(properties);
+    for (auto& slot : slots) slot = newObject();
+
+    std::vector<std::vector<size_t>> streams(readers + writers);
+    Random random;
+    for (auto& stream : streams) {
+        stream.resize(4096);
+        for (auto& i : stream) i = random.below(properties);
+    }
+
+    ConcurrentResult r = measureConcurrent(readers, options.lookups, writers,
+        []{},
+        [&](unsigned t, size_t i) {
+            id value = Property::get(&slots[streams[t][i % 4096]]);
+            checkLive(value, "getter");
+            releaseObject(value);
+        },
+        [&](unsigned t, size_t i) {
+            Property::set(&slots[streams[readers + t][i % 4096]], newObject());
+        });
+
+    char keys[32], op[32];
+    snprintf(keys, sizeof(keys), "%zu", properties);
+    snprintf(op, sizeof(op), "get r%uw%u", readers, writers);
+    print(Property::name, keys, op, r.reads);
+    if (writers) {
+        snprintf(op, sizeof(op), "set r%uw%u", readers, writers);
+        print(Property::name, keys, op, r.writes);
+    }
+
+    for (auto& slot : slots) releaseObject(slot);
+}
+
+template <typename Property>
+static void runAll(const Options& options)
+{
+    static const size_t propertyCounts[] = { 1, 1024 };
+    static const unsigned threads[][2] = { {1, 0}, {4, 0}, {4, 1}, {1, 4} };
+    for (size_t properties : propertyCounts) {
+        for (auto& t : threads) run<Property>(options, properties, t[0], t[1]);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+    hazard_init();
+
+    printf("# %zu gets per reader thread, %u CPUs\n",
+           options.lookups, std::thread::hardware_concurrency());
+    printHeader();
+
+    runAll<LockedProperty>(options);
+    runAll<HazardProperty>(options);
+    return 0;
+}
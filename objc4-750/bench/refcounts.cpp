@@ -0,0 +1,223 @@
+/*
+ * refcounts.cpp
+ * Side table retain count traffic for raw-isa objects, against
+ * RefcountMap built as DenseMap and as GroupProbedDenseMap.
+ *
+ * The model mirrors NSObject.mm: 64 side tables selected by
+ * StripedMap's pointer hash, and sidetable_retain_nolock(),
+ * sidetable_release_nolock() and sidetable_clearDeallocating()'s
+ * map operations. Locks and RefcountCells are left out so only
+ * the map is measured.
+ *
+ * The dealloc burst compares compacting sparse maps inside
+ * clearDeallocating, where the side table lock is held, with
+ * deferring it to the next autorelease pool pop.
+ */
+
+#include "bench.h"
+
+#include "llvm-DenseMap.h"
+
+using namespace bench;
+
+#define SIDE_TABLE_DEALLOCATING      (1UL<<1)
+#define SIDE_TABLE_RC_ONE            (1UL<<2)
+#define SIDE_TABLE_RC_PINNED         (1UL<<(sizeof(uintptr_t)*8-1))
+
+enum { StripeCount = 64 };
+
+template <typename Map>
+struct SideTablesModel {
+    static constexpr const char *name = Map::benchName;
+    Map refcnts[StripeCount];
+    bool refcntsSparse[StripeCount] = { };
+    bool needCompaction = false;
+
+    static unsigned int indexForPointer(const void *p) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+        return ((addr >> 4) ^ (addr >> 9)) % StripeCount;
+    }
+
+    Map& operator [] (const void *p) {
+        return refcnts[indexForPointer(p)];
+    }
+
+    void retain(objc_object *obj) {
+        size_t& refcntStorage = (*this)[obj][obj];
+        if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+            refcntStorage += SIDE_TABLE_RC_ONE;
+        }
+    }
+
+    // Returns true if the object should now be deallocated.
+    bool release(objc_object *obj) {
+        Map& map = (*this)[obj];
+        auto it = map.find(obj);
+        if (it == map.end()) {
+            map[obj] = SIDE_TABLE_DEALLOCATING;
+            return true;
+        } else if (it->second < SIDE_TABLE_DEALLOCATING) {
+            it->second |= SIDE_TABLE_DEALLOCATING;
+            return true;
+        } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
+            it->second -= SIDE_TABLE_RC_ONE;
+        }
+        return false;
+    }
+
+    void clearDeallocating(objc_object *obj) {
+        Map& map = (*this)[obj];
+        auto it = map.find(obj);
+        if (it != map.end()) map.erase(it);
+    }
+
+    // clearDeallocating followed by either compaction on the spot 
+    // or noting the table for compactSparse().
+    void clearDeallocatingAndCompact(objc_object *obj, bool deferred) {
+        unsigned int i = indexForPointer(obj);
+        clearDeallocating(obj);
+        if (!refcnts[i].isSparse()) return;
+        if (deferred) {
+            refcntsSparse[i] = true;
+            needCompaction = true;
+        } else {
+            refcnts[i].shrink_to_fit();
+        }
+    }
+
+    // What autorelease pool pop does when needCompaction is set.
+    void compactSparse() {
+        needCompaction = false;
+        for (unsigned int i = 0; i < StripeCount; i++) {
+            if (!refcntsSparse[i]) continue;
+            refcntsSparse[i] = false;
+            if (refcnts[i].isSparse()) refcnts[i].shrink_to_fit();
+        }
+    }
+};
+
+struct DenseRefcountMap
+    : objc::DenseMap<DisguisedPtr<objc_object>,size_t,true>
+{
+    static constexpr const char *benchName = "DenseMap";
+};
+
+struct GroupProbedRefcountMap
+    : objc::GroupProbedDenseMap<DisguisedPtr<objc_object>,size_t,true>
+{
+    static constexpr const char *benchName = "GroupProbedDenseMap";
+};
+
+
+template <typename Map>
+static void run(const Options& options, const std::vector<void *>& keys,
+                Random& random)
+{
+    typedef SideTablesModel<Map> Tables;
+    if (!options.wants(Tables::name)) return;
+
+    size_t n = keys.size();
+    auto obj = [&](size_t i) { return (objc_object *)keys[i]; };
+    Tables *tables = nullptr;
+
+    auto fresh = [&]{
+        delete tables;
+        tables = new Tables;
+    };
+    // Every object retained once beyond its inline count.
+    auto retainedOnce = [&]{
+        fresh();
+        for (size_t i = 0; i < n; i++) tables->retain(obj(i));
+    };
+
+    size_t before = heapBytes();
+    retainedOnce();
+    double bytes = (double)(heapBytes() - before) / n;
+
+    Result r = measure(n, fresh, [&](size_t i) { tables->retain(obj(i)); });
+    print(Tables::name, "objects", "first-retain", r, bytes);
+
+    // Retain/release pairs on hot objects, as when objects are passed
+    // around and stored.
+    std::vector<size_t> stream = zipfStream(n, options.lookups, random);
+    retainedOnce();
+    r = measure(options.lookups, [&](size_t i) {
+        objc_object *o = obj(stream[i]);
+        tables->retain(o);
+        keep(tables->release(o));
+    });
+    print(Tables::name, "objects", "retain+rel", r);
+
+    // Whole lifetimes with other objects live in the tables:
+    // retain, release, final release, clearDeallocating.
+    std::vector<void *> transient = objectKeys(options.lookups / 10, random);
+    r = measure(transient.size(), retainedOnce, [&](size_t i) {
+        objc_object *o = (objc_object *)transient[i];
+        tables->retain(o);
+        tables->release(o);
+        keep(tables->release(o));
+        tables->clearDeallocating(o);
+    });
+    print(Tables::name, "objects", "lifetime", r);
+    freeObjectKeys(transient);
+
+    // A burst of retained objects dies, in random order, 
+    // with a pool pop after every 64 deallocations.
+    std::vector<size_t> order = shuffledIndexes(n, random);
+    for (int deferred = 0; deferred < 2; deferred++) {
+        Latencies deallocs, pops;
+        uint64_t overhead = clockOverhead();
+        uint64_t total = 0;
+        retainedOnce();
+        for (size_t i = 0; i < n; i++) {
+            uint64_t a = nanoseconds();
+            tables->clearDeallocatingAndCompact(obj(order[i]), deferred);
+            uint64_t b = nanoseconds();
+            deallocs.add(b - a > overhead ? b - a - overhead : 0);
+            total += b - a;
+            if (i % 64 == 63  &&  tables->needCompaction) {
+                a = nanoseconds();
+                tables->compactSparse();
+                b = nanoseconds();
+                pops.add(b - a > overhead ? b - a - overhead : 0);
+                total += b - a;
+            }
+        }
+        r.mops = total ? (double)n * 1000.0 / (double)total : 0;
+        r.p50 = deallocs.percentile(50);
+        r.p99 = deallocs.percentile(99);
+        r.p999 = deallocs.percentile(99.9);
+        r.max = deallocs.percentile(100);
+        print(Tables::name, "objects", 
+              deferred ? "dealloc-def" : "dealloc-inl", r);
+        if (deferred) {
+            r.mops = 0;
+            r.p50 = pops.percentile(50);
+            r.p99 = pops.percentile(99);
+            r.p999 = pops.percentile(99.9);
+            r.max = pops.percentile(100);
+            print(Tables::name, "objects", "pop-compact", r);
+        }
+    }
+
+    delete tables;
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+    Random random;
+
+    std::vector<void *> objects = objectKeys(options.entries, random);
+
+    printf("# %zu objects, %zu retain/release pairs\n",
+           options.entries, options.lookups);
+    printHeader();
+
+    run<DenseRefcountMap>(options, objects, random);
+    run<GroupProbedRefcountMap>(options, objects, random);
+
+    freeObjectKeys(objects);
+    return 0;
+}
@@ -0,0 +1,712 @@
+/*
+ * retains.cpp
+ * Retain and release of heavily retained objects. Raw-isa objects
+ * keep every count in RefcountMap under the side table lock, or use
+ * NSObject.mm's lock-free RefcountCells. Nonpointer objects update
+ * isa's extra_rc with compare-and-swap, with and without the
+ * per-thread buffers of OBJC_BIASED_REFCOUNTS. Arrays of raw-isa
+ * objects are retained and released one object at a time and with
+ * objc_retainArray() and objc_releaseArray(). The side table lock is
+ * also timed with OBJC_PRINT_SIDETABLE_LOCKS's profiling on.
+ *
+ * The model mirrors NSObject.mm: 64 side tables selected by
+ * StripedMap's pointer hash, each with a lock, a RefcountMap and two
+ * RefcountCells, and sidetable_retain() and sidetable_release().
+ * objc_object's extra_rc from the prelude stands in for isa.
+ * Each thread retains and releases random objects that already hold
+ * many references. The runs check that no count was lost.
+ */
+
+#include "bench.h"
+#include "objects.h"
+
+#include "llvm-DenseMap.h"
+
+using namespace bench;
+
+#define SIDE_TABLE_DEALLOCATING      (1UL<<1)
+#define SIDE_TABLE_RC_ONE            (1UL<<2)
+#define SIDE_TABLE_RC_PINNED         (1UL<<(sizeof(uintptr_t)*8-1))
+#define SIDE_TABLE_RC_SHIFT          2
+#define SIDE_TABLE_RC_CELL_THRESHOLD (SIDE_TABLE_RC_ONE << 5)
+
+typedef objc::GroupProbedDenseMap<DisguisedPtr<objc_object>,size_t,true> RefcountMap;
+
+enum { StripeCount = 64 };
+
+struct RefcountCell {
+    std::atomic<uintptr_t> object;
+    std::atomic<size_t> refcnt;
+
+    static uintptr_t disguise(objc_object *obj) {
+        return -(uintptr_t)obj;
+    }
+
+    void retain() {
+        if (! (refcnt.load(std::memory_order_relaxed) & SIDE_TABLE_RC_PINNED)) {
+            refcnt.fetch_add(SIDE_TABLE_RC_ONE, std::memory_order_relaxed);
+        }
+    }
+
+    bool release() {
+        size_t oldRefcnt = refcnt.load(std::memory_order_relaxed);
+        size_t newRefcnt;
+        do {
+            if (oldRefcnt & SIDE_TABLE_RC_PINNED) return false;
+            if (oldRefcnt < SIDE_TABLE_DEALLOCATING) {
+                newRefcnt = oldRefcnt | SIDE_TABLE_DEALLOCATING;
+            } else {
+                newRefcnt = oldRefcnt - SIDE_TABLE_RC_ONE;
+            }
+        } while (!refcnt.compare_exchange_weak(oldRefcnt, newRefcnt,
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+        return newRefcnt & SIDE_TABLE_DEALLOCATING;
+    }
+};
+
+// Lock profile for one SideTable (OBJC_PRINT_SIDETABLE_LOCKS).
+// Every field is protected by the table's own lock.
+struct SideTableLockStats {
+    enum { ClassSampleCount = 4 };
+
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint64_t holdTime;   // nanoseconds
+    uint64_t lockedAt;
+
+    // Classes of objects whose operations found the lock held.
+    // Approximate top-N: a new class replaces the least frequent one.
+    Class classes[ClassSampleCount];
+    uint64_t classCounts[ClassSampleCount];
+
+    void sampleClass(Class cls) {
+        unsigned int victim = 0;
+        for (unsigned int i = 0; i < ClassSampleCount; i++) {
+            if (classes[i] == cls) {
+                classCounts[i]++;
+                return;
+            }
+            if (classCounts[i] < classCounts[victim]) victim = i;
+        }
+        classes[victim] = cls;
+        classCounts[victim]++;
+    }
+};
+
+struct alignas(CacheLineSize) SideTable {
+    spinlock_t slock;
+    RefcountMap refcnts;
+    RefcountCell cells[2];
+    SideTableLockStats *lockStats;  // nil unless profiling
+
+    // obj, if known, is the object being operated on.
+    // It is sampled when profiling finds the lock contended.
+    void lock(objc_object *obj = nil) {
+        if (slowpath(lockStats)) profiledLock(obj);
+        else slock.lock();
+    }
+    void unlock() {
+        if (slowpath(lockStats)) {
+            lockStats->holdTime += nanoseconds() - lockStats->lockedAt;
+        }
+        slock.unlock();
+    }
+
+    void profiledLock(objc_object *obj) {
+        bool contended = !slock.tryLock();
+        if (contended) slock.lock();
+
+        lockStats->acquisitions++;
+        if (contended) {
+            lockStats->contentions++;
+            if (obj) lockStats->sampleClass(obj->ISA());
+        }
+        lockStats->lockedAt = nanoseconds();
+    }
+
+    RefcountCell *refcntCellFor(objc_object *obj) {
+        uintptr_t key = RefcountCell::disguise(obj);
+        for (auto& cell : cells) {
+            if (cell.object.load(std::memory_order_acquire) == key) {
+                return &cell;
+            }
+        }
+        return nullptr;
+    }
+
+    void promoteRefcnt(objc_object *obj) {
+        for (auto& cell : cells) {
+            if (cell.object.load(std::memory_order_relaxed) != 0) continue;
+            RefcountMap::iterator it = refcnts.find(obj);
+            if (it == refcnts.end()) return;
+            cell.refcnt.store(it->second, std::memory_order_relaxed);
+            cell.object.store(RefcountCell::disguise(obj),
+                              std::memory_order_release);
+            refcnts.erase(it);
+            return;
+        }
+    }
+
+    // The side table count of obj, in references.
+    size_t count(objc_object *obj) {
+        if (RefcountCell *cell = refcntCellFor(obj)) {
+            return cell->refcnt.load() >> SIDE_TABLE_RC_SHIFT;
+        }
+        RefcountMap::iterator it = refcnts.find(obj);
+        return it == refcnts.end() ? 0 : it->second >> SIDE_TABLE_RC_SHIFT;
+    }
+
+    void clear() {
+        refcnts.clear();
+        for (auto& cell : cells) {
+            cell.object.store(0, std::memory_order_relaxed);
+            cell.refcnt.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+static SideTable SideTables[StripeCount];
+
+static SideTable& tableFor(const void *p) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+    return SideTables[((addr >> 4) ^ (addr >> 9)) % StripeCount];
+}
+
+
+/***********************************************************************
+* Side table retain counts
+* Each variant supplies sidetable_retain() and sidetable_release().
+**********************************************************************/
+
+// sidetable_retain() and sidetable_release() before RefcountCells.
+struct LockedRetains {
+    static constexpr const char *name = "SideTable lock";
+
+    static void hold(objc_object *obj, size_t count) {
+        while (count--) retain(obj);
+    }
+
+    static size_t count(objc_object *obj) {
+        return tableFor(obj).count(obj);
+    }
+
+    static void retain(objc_object *obj) {
+        SideTable& table = tableFor(obj);
+        table.lock(obj);
+        size_t& refcntStorage = table.refcnts[obj];
+        if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+            refcntStorage += SIDE_TABLE_RC_ONE;
+        }
+        table.unlock();
+    }
+
+    static bool release(objc_object *obj) {
+        bool do_dealloc = false;
+        SideTable& table = tableFor(obj);
+        table.lock(obj);
+        RefcountMap::iterator it = table.refcnts.find(obj);
+        if (it == table.refcnts.end()) {
+            do_dealloc = true;
+            table.refcnts[obj] = SIDE_TABLE_DEALLOCATING;
+        } else if (it->second < SIDE_TABLE_DEALLOCATING) {
+            do_dealloc = true;
+            it->second |= SIDE_TABLE_DEALLOCATING;
+        } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
+            it->second -= SIDE_TABLE_RC_ONE;
+        }
+        table.unlock();
+        return do_dealloc;
+    }
+};
+
+// LockedRetains with every table's lock profiled.
+struct ProfiledRetains : LockedRetains {
+    static constexpr const char *name = "profiled lock";
+};
+
+struct CellRetains {
+    static constexpr const char *name = "RefcountCells";
+
+    static void hold(objc_object *obj, size_t count) {
+        while (count--) retain(obj);
+    }
+
+    static size_t count(objc_object *obj) {
+        return tableFor(obj).count(obj);
+    }
+
+    static void retain(objc_object *obj) {
+        SideTable& table = tableFor(obj);
+        if (RefcountCell *cell = table.refcntCellFor(obj)) {
+            cell->retain();
+            return;
+        }
+
+        table.lock(obj);
+        retainNolock(table, obj);
+        table.unlock();
+    }
+
+    static bool release(objc_object *obj) {
+        SideTable& table = tableFor(obj);
+        if (RefcountCell *cell = table.refcntCellFor(obj)) {
+            return cell->release();
+        }
+
+        table.lock(obj);
+        bool do_dealloc = releaseNolock(table, obj);
+        table.unlock();
+        return do_dealloc;
+    }
+
+    // sidetable_retain_nolock()
+    static void retainNolock(SideTable& table, objc_object *obj) {
+        if (RefcountCell *cell = table.refcntCellFor(obj)) {
+            cell->retain();
+        } else {
+            size_t& refcntStorage = table.refcnts[obj];
+            if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+                refcntStorage += SIDE_TABLE_RC_ONE;
+            }
+            if (refcntStorage >= SIDE_TABLE_RC_CELL_THRESHOLD) {
+                table.promoteRefcnt(obj);
+            }
+        }
+    }
+
+    // sidetable_release_nolock()
+    static bool releaseNolock(SideTable& table, objc_object *obj) {
+        bool do_dealloc = false;
+        RefcountMap::iterator it = table.refcnts.find(obj);
+        if (RefcountCell *cell = table.refcntCellFor(obj)) {
+            do_dealloc = cell->release();
+        } else if (it == table.refcnts.end()) {
+            do_dealloc = true;
+            table.refcnts[obj] = SIDE_TABLE_DEALLOCATING;
+        } else if (it->second < SIDE_TABLE_DEALLOCATING) {
+            do_dealloc = true;
+            it->second |= SIDE_TABLE_DEALLOCATING;
+        } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
+            it->second -= SIDE_TABLE_RC_ONE;
+        }
+        return do_dealloc;
+    }
+};
+
+
+/***********************************************************************
+* Arrays of raw-isa objects
+* Each variant supplies a retain and a release of count objects.
+* release returns the number of objects that should be deallocated.
+**********************************************************************/
+
+// objc_retain() and objc_release() in a loop.
+struct EachRetains {
+    static constexpr const char *name = "objc_retain each";
+
+    static void retain(objc_object **objs, size_t count) {
+        for (size_t i = 0; i < count; i++) CellRetains::retain(objs[i]);
+    }
+
+    static size_t release(objc_object **objs, size_t count) {
+        size_t deallocCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (CellRetains::release(objs[i])) deallocCount++;
+        }
+        return deallocCount;
+    }
+};
+
+// objc_retainArray() and objc_releaseArray(): chunks of RR_BATCH_SIZE
+// objects sorted by side table, with each stripe locked once per chunk.
+// Objects with RefcountCells are updated without the lock first.
+struct ArrayRetains {
+    static constexpr const char *name = "objc_retainArray";
+
+    enum { RR_BATCH_SIZE = 64 };
+
+    struct RRBatchEntry {
+        SideTable *table;
+        objc_object *obj;
+
+        bool operator < (const RRBatchEntry& other) const {
+            return table < other.table;
+        }
+    };
+
+    static void retain(objc_object **objs, size_t count) {
+        RRBatchEntry raw[RR_BATCH_SIZE];
+
+        while (count > 0) {
+            size_t chunk = std::min(count, (size_t)RR_BATCH_SIZE);
+            size_t rawCount = 0;
+            for (size_t i = 0; i < chunk; i++) {
+                SideTable& table = tableFor(objs[i]);
+                if (RefcountCell *cell = table.refcntCellFor(objs[i])) {
+                    cell->retain();
+                } else {
+                    raw[rawCount++] = { &table, objs[i] };
+                }
+            }
+
+            std::sort(raw, raw + rawCount);
+            for (size_t i = 0; i < rawCount; ) {
+                SideTable *table = raw[i].table;
+                table->lock(raw[i].obj);
+                for ( ; i < rawCount  &&  raw[i].table == table; i++) {
+                    CellRetains::retainNolock(*table, raw[i].obj);
+                }
+                table->unlock();
+            }
+
+            objs += chunk;
+            count -= chunk;
+        }
+    }
+
+    static size_t release(objc_object **objs, size_t count) {
+        RRBatchEntry raw[RR_BATCH_SIZE];
+        size_t deallocCount = 0;
+
+        while (count > 0) {
+            size_t chunk = std::min(count, (size_t)RR_BATCH_SIZE);
+            size_t rawCount = 0;
+            for (size_t i = 0; i < chunk; i++) {
+                SideTable& table = tableFor(objs[i]);
+                if (RefcountCell *cell = table.refcntCellFor(objs[i])) {
+                    if (cell->release()) deallocCount++;
+                } else {
+                    raw[rawCount++] = { &table, objs[i] };
+                }
+            }
+
+            std::sort(raw, raw + rawCount);
+            for (size_t i = 0; i < rawCount; ) {
+                SideTable *table = raw[i].table;
+                table->lock(raw[i].obj);
+                for ( ; i < rawCount  &&  raw[i].table == table; i++) {
+                    if (CellRetains::releaseNolock(*table, raw[i].obj)) {
+                        deallocCount++;
+                    }
+                }
+                table->unlock();
+            }
+
+            objs += chunk;
+            count -= chunk;
+        }
+        return deallocCount;
+    }
+};
+
+
+/***********************************************************************
+* Inline retain counts
+**********************************************************************/
+
+// rootRetain() and rootRelease() for nonpointer isa.
+struct IsaRetains {
+    static constexpr const char *name = "isa extra_rc";
+
+    static void retain(objc_object *obj) {
+        uintptr_t rc = __atomic_load_n(&obj->extra_rc, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&obj->extra_rc, &rc,
+                                            rc + BENCH_RC_ONE, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+
+    static bool release(objc_object *obj) {
+        return obj->rootRelease();
+    }
+
+    static void hold(objc_object *obj, size_t count) {
+        obj->extra_rc = count * BENCH_RC_ONE;
+    }
+
+    static size_t count(objc_object *obj) {
+        return obj->extra_rc / BENCH_RC_ONE;
+    }
+};
+
+// NSObject.mm's BiasedRefcountBuffer. The thread_local destructor
+// stands in for the BIASED_REFCOUNT_KEY destructor that flushes at
+// thread exit.
+struct BiasedRefcountBuffer {
+    enum { EntryCount = 64 };
+
+    struct Entry {
+        objc_object *obj;
+        uintptr_t releases;
+    };
+
+    Entry entries[EntryCount];
+    unsigned int used;
+
+    Entry& entryFor(objc_object *obj) {
+        return entries[ptr_hash((uintptr_t)obj) & (EntryCount-1)];
+    }
+
+    void flush() {
+        for (auto& entry : entries) {
+            objc_object *obj = entry.obj;
+            if (!obj) continue;
+            uintptr_t releases = entry.releases;
+            entry.obj = nullptr;
+            entry.releases = 0;
+            used--;
+            while (releases--) obj->rootRelease();
+        }
+    }
+
+    ~BiasedRefcountBuffer() { flush(); }
+};
+
+static thread_local BiasedRefcountBuffer BiasedBuffer;
+
+// rootRetain() and rootRelease() with OBJC_BIASED_REFCOUNTS set.
+struct BiasedRetains {
+    static constexpr const char *name = "BiasedRefcounts";
+
+    // objc_object::biased_retain()
+    static bool cancelRelease(objc_object *obj) {
+        BiasedRefcountBuffer& buffer = BiasedBuffer;
+        if (buffer.used == 0) return false;
+
+        auto& entry = buffer.entryFor(obj);
+        if (entry.obj != obj) return false;
+
+        if (--entry.releases == 0) {
+            entry.obj = nullptr;
+            buffer.used--;
+        }
+        return true;
+    }
+
+    // objc_object::biased_release()
+    static bool bufferRelease(objc_object *obj) {
+        uintptr_t rc = __atomic_load_n(&obj->extra_rc, __ATOMIC_RELAXED);
+        if (rc & BENCH_RC_DEALLOCATING) return false;
+        uintptr_t extra_rc = rc / BENCH_RC_ONE;
+
+        BiasedRefcountBuffer& buffer = BiasedBuffer;
+        auto& entry = buffer.entryFor(obj);
+        if (entry.obj == obj) {
+            if (extra_rc > entry.releases) {
+                entry.releases++;
+                return true;
+            }
+            uintptr_t releases = entry.releases;
+            entry.obj = nullptr;
+            entry.releases = 0;
+            buffer.used--;
+            while (releases--) obj->rootRelease();
+            return false;
+        }
+
+        if (entry.obj  ||  extra_rc == 0) return false;
+
+        entry.obj = obj;
+        entry.releases = 1;
+        buffer.used++;
+        return true;
+    }
+
+    static void retain(objc_object *obj) {
+        if (!cancelRelease(obj)) IsaRetains::retain(obj);
+    }
+
+    static bool release(objc_object *obj) {
+        if (bufferRelease(obj)) return false;
+        return IsaRetains::release(obj);
+    }
+
+    static void hold(objc_object *obj, size_t count) {
+        IsaRetains::hold(obj, count);
+    }
+
+    static size_t count(objc_object *obj) {
+        return IsaRetains::count(obj);
+    }
+};
+
+
+/***********************************************************************
+* Driver
+**********************************************************************/
+
+// Each object starts with Held references, enough for a RefcountCell.
+enum { Held = 64 };
+
+// Readers retain and release random objects. Buffered releases are
+// flushed when the threads exit, before the counts are checked.
+template <typename Retains>
+static void run(const Options& options, size_t objects, unsigned readers)
+{
+    if (!options.wants(Retains::name)) return;
+
+    std::vector<objc_object *> objs(objects);
+    for (size_t k = 0; k < objects; k++) {
+        objs[k] = newObject();
+        Retains::hold(objs[k], Held);
+    }
+
+    std::vector<std::vector<size_t>> streams(readers);
+    Random random;
+    for (auto& stream : streams) {
+        stream.resize(4096);
+        for (auto& i : stream) i = random.below(objects);
+    }
+
+    ConcurrentResult r = measureConcurrent(readers, options.lookups, 0,
+        []{},
+        [&](unsigned t, size_t i) {
+            objc_object *obj = objs[streams[t][i % 4096]];
+            Retains::retain(obj);
+            if (Retains::release(obj)) {
+                fprintf(stderr, "released a held object %p\n", obj);
+                abort();
+            }
+        },
+        [](unsigned, size_t) { });
+
+    for (objc_object *obj : objs) {
+        size_t count = Retains::count(obj);
+        if (count != Held) {
+            fprintf(stderr, "%p has %zu references instead of %u\n",
+                    obj, count, (unsigned)Held);
+            abort();
+        }
+    }
+
+    char keyName[32], op[32];
+    snprintf(keyName, sizeof(keyName), "%zu", objects);
+    snprintf(op, sizeof(op), "retain+rel r%u", readers);
+    print(Retains::name, keyName, op, r.reads);
+
+    for (auto& table : SideTables) table.clear();
+    for (objc_object *obj : objs) deallocObject(obj);
+}
+
+// Readers retain and then release every object of one array of
+// objects that each hold held references. Mops/s counts objects;
+// latencies are per array.
+template <typename Array>
+static void runArray(const Options& options, size_t size, size_t held,
+                     unsigned readers)
+{
+    if (!options.wants(Array::name)) return;
+
+    std::vector<objc_object *> objs(size);
+    for (auto& obj : objs) {
+        obj = newObject();
+        CellRetains::hold(obj, held);
+    }
+
+    size_t arrays = std::max(options.lookups / size, (size_t)1);
+    ConcurrentResult r = measureConcurrent(readers, arrays, 0,
+        []{},
+        [&](unsigned, size_t) {
+            Array::retain(objs.data(), size);
+            if (Array::release(objs.data(), size) != 0) {
+                fprintf(stderr, "released a held object\n");
+                abort();
+            }
+        },
+        [](unsigned, size_t) { });
+
+    for (objc_object *obj : objs) {
+        size_t count = CellRetains::count(obj);
+        if (count != held) {
+            fprintf(stderr, "%p has %zu references instead of %zu\n",
+                    obj, count, held);
+            abort();
+        }
+    }
+
+    char keyName[32], op[32];
+    snprintf(keyName, sizeof(keyName), "%zux%zu", size, held);
+    snprintf(op, sizeof(op), "array r%u", readers);
+    r.reads.mops *= size;
+    print(Array::name, keyName, op, r.reads);
+
+    for (auto& table : SideTables) table.clear();
+    for (objc_object *obj : objs) deallocObject(obj);
+}
+
+template <typename Array>
+static void runArrays(const Options& options)
+{
+    // Objects with one reference each, and hot objects whose counts
+    // are in RefcountCells.
+    static const size_t arrays[][2] = { {16, 1}, {64, 1}, {1024, 1}, {16, Held} };
+    static const unsigned threads[] = { 1, 4 };
+    for (auto& a : arrays) {
+        for (unsigned readers : threads) {
+            runArray<Array>(options, a[0], a[1], readers);
+        }
+    }
+}
+
+static SideTableLockStats LockStats[StripeCount];
+
+// Turns OBJC_PRINT_SIDETABLE_LOCKS's profiling on or off for every table.
+static void setLockProfiling(bool on)
+{
+    for (unsigned int i = 0; i < StripeCount; i++) {
+        SideTables[i].lockStats = on ? &LockStats[i] : nullptr;
+    }
+}
+
+// Totals of objc_printSideTableLockStats().
+static void printLockStats()
+{
+    uint64_t acquisitions = 0, contentions = 0, holdTime = 0;
+    for (auto& stats : LockStats) {
+        acquisitions += stats.acquisitions;
+        contentions += stats.contentions;
+        holdTime += stats.holdTime;
+    }
+    printf("# %s: %llu locks, %llu contended, %.1f ns mean hold\n",
+           ProfiledRetains::name, (unsigned long long)acquisitions,
+           (unsigned long long)contentions,
+           acquisitions ? (double)holdTime / acquisitions : 0.0);
+}
+
+template <typename Retains>
+static void runAll(const Options& options)
+{
+    static const size_t objectCounts[] = { 1, 16, 1024 };
+    static const unsigned threads[] = { 1, 4 };
+    for (size_t objects : objectCounts) {
+        for (unsigned readers : threads) {
+            run<Retains>(options, objects, readers);
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+
+    printf("# %zu retain/release pairs per thread, %u CPUs\n",
+           options.lookups, std::thread::hardware_concurrency());
+    printHeader();
+
+    runAll<LockedRetains>(options);
+    if (options.wants(ProfiledRetains::name)) {
+        setLockProfiling(true);
+        runAll<ProfiledRetains>(options);
+        setLockProfiling(false);
+        printLockStats();
+    }
+    runAll<CellRetains>(options);
+    runAll<IsaRetains>(options);
+    runAll<BiasedRetains>(options);
+    runArrays<EachRetains>(options);
+    runArrays<ArrayRetains>(options);
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * structs.cpp
+ * Atomic struct properties under concurrent getters and setters,
+ * with objc_copyStruct() locking both StructLocks stripes and with
+ * objc-accessors.mm's seqlock for structs up to 128 bytes.
+ *
+ * The copies mirror objc_copyStruct(). A getter copies an ivar to
+ * a local and a setter copies a local to the ivar. StructLocks is
+ * 64 striped mutexes. Each struct holds one value repeated in every
+ * word, so a getter that sees a torn copy aborts.
+ */
+
+#include "bench.h"
+
+#include <mutex>
+
+using namespace bench;
+
+enum { StripeCount = 64 };
+
+static unsigned int indexForPointer(const void *p) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+    return ((addr >> 4) ^ (addr >> 9)) % StripeCount;
+}
+
+struct alignas(CacheLineSize) StructLock {
+    std::mutex lock;
+};
+
+struct alignas(CacheLineSize) StructSequence {
+    std::atomic<uintptr_t> count;
+};
+
+static StructLock StructLocks[StripeCount];
+static StructSequence StructSequences[StripeCount];
+
+static std::mutex& structLock(const void *p) {
+    return StructLocks[indexForPointer(p)].lock;
+}
+
+static void lockTwo(std::mutex *a, std::mutex *b) {
+    if (a == b) { a->lock(); return; }
+    if (a > b) std::swap(a, b);
+    a->lock();
+    b->lock();
+}
+
+static void unlockTwo(std::mutex *a, std::mutex *b) {
+    a->unlock();
+    if (a != b) b->unlock();
+}
+
+
+/***********************************************************************
+* Copies
+**********************************************************************/
+
+// objc_copyStruct() before the seqlock.
+struct LockedCopy {
+    static constexpr const char *name = "StructLocks";
+
+    static void copy(void *dest, const void *src, size_t size) {
+        std::mutex *srcLock = &structLock(src);
+        std::mutex *dstLock = &structLock(dest);
+        lockTwo(srcLock, dstLock);
+        memmove(dest, src, size);
+        unlockTwo(srcLock, dstLock);
+    }
+};
+
+// objc_copyStruct() with copyStructLocked() and copyStructSequenced().
+struct SequencedCopy {
+    static constexpr const char *name = "StructSequences";
+
+    enum { MaxSize = 128, MaxRetries = 16 };
+
+    static void copyLocked(void *dest, const void *src, size_t size) {
+        std::atomic<uintptr_t>& seq = StructSequences[indexForPointer(dest)].count;
+        uintptr_t count = seq.load(std::memory_order_relaxed);
+        seq.store(count + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memmove(dest, src, size);
+        seq.store(count + 2, std::memory_order_release);
+    }
+
+    static void copy(void *dest, const void *src, size_t size) {
+        if (size > MaxSize) {
+            std::mutex *srcLock = &structLock(src);
+            std::mutex *dstLock = &structLock(dest);
+            lockTwo(srcLock, dstLock);
+            copyLocked(dest, src, size);
+            unlockTwo(srcLock, dstLock);
+            return;
+        }
+
+        uint8_t buffer[MaxSize] __attribute__((aligned(16)));
+        std::atomic<uintptr_t>& srcSeq = StructSequences[indexForPointer(src)].count;
+        for (unsigned int attempt = 0; ; attempt++) {
+            if (attempt == MaxRetries) {
+                std::mutex& srcLock = structLock(src);
+                srcLock.lock();
+                memcpy(buffer, src, size);
+                srcLock.unlock();
+                break;
+            }
+            uintptr_t before = srcSeq.load(std::memory_order_acquire);
+            if (before & 1) {
+                sched_yield();
+                continue;
+            }
+            memcpy(buffer, src, size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (srcSeq.load(std::memory_order_relaxed) == before) break;
+        }
+
+        std::mutex& dstLock = structLock(dest);
+        dstLock.lock();
+        copyLocked(dest, buffer, size);
+        dstLock.unlock();
+    }
+};
+
+
+/***********************************************************************
+* Driver
+**********************************************************************/
+
+enum { MaxWords = 32 };
+
+struct Value {
+    uintptr_t words[MaxWords];
+
+    void fill(uintptr_t v, size_t count) {
+        for (size_t i = 0; i < count; i++) words[i] = v;
+    }
+    void check(size_t count) const {
+        for (size_t i = 1; i < count; i++) {
+            if (words[i] != words[0]) {
+                fprintf(stderr, "torn struct copy: word %zu is %#lx, "
+                        "word 0 is %#lx\n", i,
+                        (unsigned long)words[i], (unsigned long)words[0]);
+                abort();
+            }
+        }
+    }
+};
+
+// Getters copy random ivars out and check them; setters copy new
+// values into random ivars. Ivars sit at the start of 64-byte
+// objects like a struct property's ivar after isa and one other ivar.
+template <typename Copy>
+static void run(const Options& options, size_t size, size_t ivars,
+                unsigned readers, unsigned writers)
+{
+    if (!options.wants(Copy::name)) return;
+
+    size_t words = size / sizeof(uintptr_t);
+    size_t stride = (size + 16 + 63) & ~(size_t)63;
+    uint8_t *objects = (uint8_t *)aligned_alloc(64, stride * ivars);
+    auto ivar = [&](size_t k) { return objects + k * stride + 16; };
+    for (size_t k = 0; k < ivars; k++) ((Value *)ivar(k))->fill(k, words);
+
+    std::vector<std::vector<size_t>> streams(readers + writers);
+    Random random;
+    for (auto& stream : streams) {
+        stream.resize(4096);
+        for (auto& i : stream) i = random.below(ivars);
+    }
+
+    ConcurrentResult r = measureConcurrent(readers, options.lookups, writers,
+        []{},
+        [&](unsigned t, size_t i) {
+            Value value;
+            Copy::copy(&value, ivar(streams[t][i % 4096]), size);
+            value.check(words);
+        },
+        [&](unsigned t, size_t i) {
+            Value value;
+            value.fill(i, words);
+            Copy::copy(ivar(streams[readers + t][i % 4096]), &value, size);
+        });
+
+    char keys[32], op[32];
+    snprintf(keys, sizeof(keys), "%zux%zuB", ivars, size);
+    snprintf(op, sizeof(op), "get r%uw%u", readers, writers);
+    print(Copy::name, keys, op, r.reads);
+    if (writers) {
+        snprintf(op, sizeof(op), "set r%uw%u", readers, writers);
+        print(Copy::name, keys, op, r.writes);
+    }
+
+    free(objects);
+}
+
+template <typename Copy>
+static void runAll(const Options& options)
+{
+    // CGPoint, CGRect, CGAffineTransform, and a 128-byte struct.
+    static const size_t sizes[] = { 16, 32, 48, 128 };
+    static const size_t ivarCounts[] = { 1, 1024 };
+    static const unsigned threads[][2] = { {1, 0}, {4, 0}, {4, 1} };
+    for (size_t size : sizes) {
+        for (size_t ivars : ivarCounts) {
+            for (auto& t : threads) run<Copy>(options, size, ivars, t[0], t[1]);
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+
+    printf("# %zu gets per reader thread, %u CPUs\n",
+           options.lookups, std::thread::hardware_concurrency());
+    printHeader();
+
+    runAll<LockedCopy>(options);
+    runAll<SequencedCopy>(options);
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * sync.cpp
+ * @synchronized enter/exit through objc-sync.mm, built with the
+ * stripes' thin records and, as sync-tableonly, with table records
+ * alone.
+ *
+ * Each operation is objc_sync_enter() and objc_sync_exit() around
+ * an increment of a counter kept for the object. The counters are
+ * plain memory, so a pass that lets two threads into one object at
+ * once loses increments and the benchmark aborts.
+ */
+
+#include "bench.h"
+#include "objects.h"
+
+#include "objc-sync.h"
+
+using namespace bench;
+
+#if SUPPORT_THIN_SYNC
+static const char * const Name = "thin record";
+#else
+static const char * const Name = "SyncData table";
+#endif
+
+struct Counted {
+    id object;
+    size_t count;
+};
+
+// threads threads lock random objects from a set of objects, 
+// nesting depth (1 or 2) locks on distinct objects per operation, 
+// while the main thread holds held other objects locked.
+static void run(const Options& options, size_t objects, 
+                unsigned threads, unsigned depth, size_t held = 0)
+{
+    std::vector<Counted> counted(objects);
+    for (auto& c : counted) c = Counted{newObject(), 0};
+
+    std::vector<id> heldObjects(held);
+    for (auto& obj : heldObjects) {
+        obj = newObject();
+        objc_sync_enter(obj);
+    }
+
+    std::vector<std::vector<size_t>> streams(threads);
+    Random random;
+    for (auto& stream : streams) {
+        stream.resize(4096 + depth);
+        for (auto& i : stream) i = random.below(objects);
+    }
+
+    size_t count = options.lookups / threads;
+    ConcurrentResult r = measureConcurrent(threads, count, 0,
+        []{},
+        [&](unsigned t, size_t i) {
+            // Nested objects are distinct so each level takes a new lock, 
+            // and locked in address order so threads cannot deadlock.
+            Counted *held[2];
+            unsigned n = 0;
+            for (unsigned d = 0; n < depth; d++) {
+                Counted *c = &counted[streams[t][(i + d) % streams[t].size()]];
+                if (std::find(held, held + n, c) == held + n) held[n++] = c;
+            }
+            if (n == 2  &&  held[1] < held[0]) std::swap(held[0], held[1]);
+            for (unsigned k = 0; k < n; k++) objc_sync_enter(held[k]->object);
+            held[n - 1]->count++;
+            while (n-- > 0) {
+                if (objc_sync_exit(held[n]->object) != OBJC_SYNC_SUCCESS) {
+                    fprintf(stderr, "objc_sync_exit failed\n");
+                    abort();
+                }
+            }
+        },
+        [](unsigned, size_t) { });
+
+    size_t total = 0;
+    for (auto& c : counted) total += c.count;
+    if (total != 2 * count * threads) {
+        fprintf(stderr, "lost %zu increments under @synchronized\n",
+                2 * count * threads - total);
+        abort();
+    }
+
+    for (auto& obj : heldObjects) objc_sync_exit(obj);
+
+    char keys[48], op[32];
+    if (held) snprintf(keys, sizeof(keys), "%zu+%zuh", objects, held);
+    else snprintf(keys, sizeof(keys), "%zu", objects);
+    snprintf(op, sizeof(op), "enter%u t%u", depth, threads);
+    print(Name, keys, op, r.reads);
+}
+
+// -n objects are locked at once and unlocked, as in a burst of work
+// on many objects, and then -l enter/exit pairs cycle through -n 
+// other objects. Reports the memory in use per burst object with 
+// the burst held, and after the later pairs.
+static void runBurst(const Options& options)
+{
+    size_t n = options.entries;
+    std::vector<id> burst(n), later(n);
+    for (auto& obj : burst) obj = newObject();
+    for (auto& obj : later) obj = newObject();
+
+    char keys[32];
+    snprintf(keys, sizeof(keys), "%zu", n);
+
+    size_t before = heapBytes();
+    for (size_t i = 0; i < n; i++) objc_sync_enter(burst[i]);
+    print(Name, keys, "burst held", Result(),
+          (double)(heapBytes() - before) / n);
+    for (size_t i = n; i-- > 0; ) objc_sync_exit(burst[i]);
+
+    Result r = measure(options.lookups, [&](size_t i) {
+        objc_sync_enter(later[i % n]);
+        objc_sync_exit(later[i % n]);
+    });
+    print(Name, keys, "after burst", r,
+          (double)(ssize_t)(heapBytes() - before) / n);
+}
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+    pthread_key_init_np(SYNC_DATA_DIRECT_KEY, nullptr);
+    pthread_key_init_np(SYNC_COUNT_DIRECT_KEY, nullptr);
+    if (!options.wants(Name)) return 0;
+
+    printf("# %zu enter/exit pairs per run, %u CPUs\n",
+           options.lookups, std::thread::hardware_concurrency());
+    printHeader();
+
+    // First, while the SyncData table is empty.
+    runBurst(options);
+
+    static const size_t objectCounts[] = { 1, 16, 1024 };
+    static const unsigned threadCounts[] = { 1, 4 };
+    static const unsigned depths[] = { 1, 2 };
+    for (size_t objects : objectCounts) {
+        for (unsigned threads : threadCounts) {
+            for (unsigned depth : depths) {
+                if (depth > objects) continue;
+                run(options, objects, threads, depth);
+            }
+        }
+    }
+
+    // Many records in use at once, as in servers that hold 
+    // a lock per client. -n sets how many.
+    for (unsigned threads : threadCounts) {
+        run(options, 1024, threads, 1, options.entries);
+    }
+    return 0;
+}
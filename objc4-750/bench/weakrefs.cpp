@@ -0,0 +1,560 @@
+/*
+ * weakrefs.cpp
+ * __weak loads under concurrent stores and deallocation, with
+ * objc_loadWeakRetained() under the side table lock, with a
+ * per-side-table count of lock-free readers, and with the
+ * per-thread hazard records of objc-hazard.mm.
+ *
+ * The model mirrors NSObject.mm: 64 side tables selected by
+ * StripedMap's pointer hash, each with a lock and a weak table
+ * (objc-weak.mm). objc_storeWeak() and clearDeallocating() update
+ * the weak tables under the locks. Readers load, retain and release
+ * random __weak variables; writers point random variables at new
+ * objects and release the old ones, which deallocates them.
+ * Loads abort if they return a deallocated object.
+ *
+ * Arrays of weakly referenced objects are also deallocated one
+ * object at a time and by objc_releaseArray(), which clears their
+ * weak references with one lock per stripe per chunk.
+ *
+ * objc_getSideTableStats() is polled over tables of weakly referenced
+ * objects, and compared with a walk of every weak entry.
+ */
+
+#include "bench.h"
+#include "objects.h"
+
+#include <mutex>
+
+#include "objc-hazard.h"
+#include "objc-weak.h"
+
+using namespace bench;
+
+extern void hazard_init(void);
+
+enum { StripeCount = 64 };
+
+struct alignas(CacheLineSize) SideTable {
+    std::mutex slock;
+    weak_table_t weak_table;
+    std::atomic<uintptr_t> weakReaders;
+
+    // The counting reader's wait before an object is freed.
+    void waitForWeakReaders() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (weakReaders.load(std::memory_order_acquire) != 0) {
+            sched_yield();
+        }
+    }
+};
+
+static SideTable SideTables[StripeCount];
+
+static SideTable& tableFor(const void *p) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+    return SideTables[((addr >> 4) ^ (addr >> 9)) % StripeCount];
+}
+
+static void lockTwo(SideTable *a, SideTable *b) {
+    if (a == b) { a->slock.lock(); return; }
+    if (a > b) std::swap(a, b);
+    a->slock.lock();
+    b->slock.lock();
+}
+
+static void unlockTwo(SideTable *a, SideTable *b) {
+    a->slock.unlock();
+    if (a != b) b->slock.unlock();
+}
+
+
+/***********************************************************************
+* Weak references
+* Each variant supplies objc_loadWeakRetained() and the wait that
+* clearDeallocating() does after clearing the weak references.
+**********************************************************************/
+
+template <typename Weak>
+static void clearDeallocating(objc_object *obj)
+{
+    SideTable& table = tableFor(obj);
+    table.slock.lock();
+    weak_clear_no_lock(&table.weak_table, obj);
+    table.slock.unlock();
+    Weak::waitForReaders(obj);
+    deallocObject(obj);
+}
+
+template <typename Weak>
+static void release(id obj)
+{
+    if (obj  &&  obj->rootRelease()) clearDeallocating<Weak>(obj);
+}
+
+// objc_storeWeak() for a variable that always holds an object.
+static void storeWeak(id *location, id newObj)
+{
+    id oldObj;
+    SideTable *oldTable, *newTable;
+ retry:
+    oldObj = __atomic_load_n(location, __ATOMIC_RELAXED);
+    oldTable = &tableFor(oldObj);
+    newTable = &tableFor(newObj);
+    lockTwo(oldTable, newTable);
+    if (*location != oldObj) {
+        unlockTwo(oldTable, newTable);
+        goto retry;
+    }
+    weak_unregister_no_lock(&oldTable->weak_table, oldObj, location);
+    weak_register_no_lock(&newTable->weak_table, newObj, location, false);
+    __atomic_store_n(location, newObj, __ATOMIC_RELAXED);
+    unlockTwo(oldTable, newTable);
+}
+
+// Retains obj with the table locked and *location checked.
+static id loadWeakRetainedLocked(id *location)
+{
+    id obj;
+ retry:
+    obj = __atomic_load_n(location, __ATOMIC_RELAXED);
+    if (!obj) return nil;
+    SideTable& table = tableFor(obj);
+    table.slock.lock();
+    if (*location != obj) {
+        table.slock.unlock();
+        goto retry;
+    }
+    id result = obj->rootTryRetainFast() ? obj : nil;
+    table.slock.unlock();
+    return result;
+}
+
+struct LockedWeak {
+    static constexpr const char *name = "SideTable lock";
+
+    static id loadWeakRetained(id *location) {
+        return loadWeakRetainedLocked(location);
+    }
+
+    static void waitForReaders(objc_object *) { }
+};
+
+// What the first version of the lock-free load did: a count of
+// readers in each side table, which deallocation waits to see at zero.
+struct CountedWeak {
+    static constexpr const char *name = "weakReaders count";
+
+    static id loadWeakRetained(id *location) {
+        id obj;
+     retry:
+        obj = __atomic_load_n(location, __ATOMIC_RELAXED);
+        if (!obj) return nil;
+        SideTable& table = tableFor(obj);
+        table.weakReaders.fetch_add(1, std::memory_order_seq_cst);
+        if (__atomic_load_n(location, __ATOMIC_SEQ_CST) != obj) {
+            table.weakReaders.fetch_sub(1, std::memory_order_release);
+            goto retry;
+        }
+        id result = obj->rootTryRetainFast() ? obj : nil;
+        table.weakReaders.fetch_sub(1, std::memory_order_release);
+        return result;
+    }
+
+    static void waitForReaders(objc_object *obj) {
+        tableFor(obj).waitForWeakReaders();
+    }
+};
+
+struct HazardWeak {
+    static constexpr const char *name = "ObjectHazard";
+
+    static id loadWeakRetained(id *location) {
+        ObjectHazard *hazard = objectHazardForThread();
+        id obj = (id)objectHazardAcquire(hazard, location);
+        if (!obj) return nil;
+        id result = (!obj->ISA()->hasCustomRR()  &&  obj->rootTryRetainFast())
+            ? obj : nil;
+        objectHazardRelease(hazard);
+        if (result) return result;
+        return loadWeakRetainedLocked(location);
+    }
+
+    static void waitForReaders(objc_object *obj) {
+        objectHazardsWait(obj);
+    }
+};
+
+
+/***********************************************************************
+* Deallocating arrays
+* Each variant releases the last reference to count objects that
+* each have __weak variables, and deallocates them.
+**********************************************************************/
+
+// objc_release() of each object.
+struct EachRelease {
+    static constexpr const char *name = "objc_release each";
+
+    static void release(id *objs, size_t count) {
+        for (size_t i = 0; i < count; i++) ::release<HazardWeak>(objs[i]);
+    }
+};
+
+// objc_releaseArray() with clearDeallocatingWeak(): the weak references
+// of a chunk's dying objects are cleared by stripe before -dealloc,
+// which then skips the side table.
+struct ArrayRelease {
+    static constexpr const char *name = "objc_releaseArray";
+
+    enum { RR_BATCH_SIZE = 64 };
+
+    struct RRBatchEntry {
+        SideTable *table;
+        objc_object *obj;
+
+        bool operator < (const RRBatchEntry& other) const {
+            return table < other.table;
+        }
+    };
+
+    static void clearDeallocatingWeak(objc_object **objs, size_t count) {
+        RRBatchEntry weak[RR_BATCH_SIZE];
+        for (size_t i = 0; i < count; i++) weak[i] = { &tableFor(objs[i]), objs[i] };
+
+        std::sort(weak, weak + count);
+        for (size_t i = 0; i < count; ) {
+            SideTable *table = weak[i].table;
+            table->slock.lock();
+            for ( ; i < count  &&  weak[i].table == table; i++) {
+                weak_clear_no_lock(&table->weak_table, (id)weak[i].obj);
+            }
+            table->slock.unlock();
+        }
+
+        for (size_t i = 0; i < count; i++) objectHazardsWait(weak[i].obj);
+    }
+
+    static void release(id *objs, size_t count) {
+        objc_object *dealloc[RR_BATCH_SIZE];
+
+        while (count > 0) {
+            size_t chunk = std::min(count, (size_t)RR_BATCH_SIZE);
+            size_t deallocCount = 0;
+            for (size_t i = 0; i < chunk; i++) {
+                if (objs[i]->rootRelease()) dealloc[deallocCount++] = objs[i];
+            }
+
+            // A single object gains nothing over clearDeallocating().
+            if (deallocCount < 2) {
+                for (size_t i = 0; i < deallocCount; i++) {
+                    clearDeallocating<HazardWeak>(dealloc[i]);
+                }
+            } else {
+                clearDeallocatingWeak(dealloc, deallocCount);
+                for (size_t i = 0; i < deallocCount; i++) {
+                    deallocObject(dealloc[i]);
+                }
+            }
+
+            objs += chunk;
+            count -= chunk;
+        }
+    }
+};
+
+
+/***********************************************************************
+* Statistics
+* objc_getSideTableStats()'s weak table fields, from the running
+* totals and by walking every entry.
+**********************************************************************/
+
+struct SideTableStats {
+    size_t weak_entries;
+    size_t weak_capacity;
+    size_t weak_max_displacement;
+    size_t weak_out_of_line;
+    size_t weak_bytes;
+
+    bool operator == (const SideTableStats& other) const {
+        return 0 == memcmp(this, &other, sizeof(*this));
+    }
+};
+
+template <typename Entry>
+static size_t weak_hash_capacity(const weak_hash_t<Entry>& hash)
+{
+    size_t capacity = hash.weak_entries ? hash.mask + 1 : 0;
+    if (hash.old_entries) capacity += hash.old_mask + 1;
+    return capacity;
+}
+
+// The weak table part of one stripe's objc_getSideTableStats().
+static SideTableStats tableStats(SideTable& table)
+{
+    weak_table_t& weak = table.weak_table;
+    SideTableStats s;
+
+    table.slock.lock();
+    size_t entryCapacity = weak_hash_capacity(weak.entries);
+    size_t singleCapacity = weak_hash_capacity(weak.singles);
+    s.weak_entries = weak.entries.num_entries + weak.singles.num_entries;
+    s.weak_capacity = entryCapacity + singleCapacity;
+    s.weak_max_displacement =
+        std::max(std::max(weak.entries.max_hash_displacement,
+                          weak.entries.old_max_hash_displacement),
+                 std::max(weak.singles.max_hash_displacement,
+                          weak.singles.old_max_hash_displacement));
+    s.weak_out_of_line = weak.num_out_of_line;
+    s.weak_bytes = entryCapacity * sizeof(weak_entry_t) +
+        singleCapacity * sizeof(weak_single_t) + weak.referrer_bytes;
+    table.slock.unlock();
+    return s;
+}
+
+// tableStats() without num_out_of_line and referrer_bytes, which must
+// visit every entry to find the out-of-line referrer arrays.
+static SideTableStats walkTableStats(SideTable& table)
+{
+    weak_table_t& weak = table.weak_table;
+    SideTableStats s;
+
+    table.slock.lock();
+    size_t entryCapacity = weak_hash_capacity(weak.entries);
+    size_t singleCapacity = weak_hash_capacity(weak.singles);
+    s.weak_entries = weak.entries.num_entries + weak.singles.num_entries;
+    s.weak_capacity = entryCapacity + singleCapacity;
+    s.weak_max_displacement =
+        std::max(std::max(weak.entries.max_hash_displacement,
+                          weak.entries.old_max_hash_displacement),
+                 std::max(weak.singles.max_hash_displacement,
+                          weak.singles.old_max_hash_displacement));
+    s.weak_out_of_line = 0;
+    size_t referrerBytes = 0;
+    auto walk = [&](weak_entry_t *entries, uintptr_t mask) {
+        if (!entries) return;
+        for (size_t i = 0; i <= mask; i++) {
+            weak_entry_t *entry = &entries[i];
+            if (!entry->referent  ||  !entry->out_of_line()) continue;
+            s.weak_out_of_line++;
+            referrerBytes += (entry->mask + 1) * sizeof(weak_referrer_t);
+        }
+    };
+    walk(weak.entries.weak_entries, weak.entries.mask);
+    walk(weak.entries.old_entries, weak.entries.old_mask);
+    s.weak_bytes = entryCapacity * sizeof(weak_entry_t) +
+        singleCapacity * sizeof(weak_single_t) + referrerBytes;
+    table.slock.unlock();
+    return s;
+}
+
+struct RunningStats {
+    static constexpr const char *name = "poll";
+    static SideTableStats stats(SideTable& table) { return tableStats(table); }
+};
+
+struct WalkedStats {
+    static constexpr const char *name = "walk";
+    static SideTableStats stats(SideTable& table) { return walkTableStats(table); }
+};
+
+template <typename Stats>
+static SideTableStats totalStats()
+{
+    SideTableStats total = {};
+    for (auto& table : SideTables) {
+        SideTableStats s = Stats::stats(table);
+        total.weak_entries += s.weak_entries;
+        total.weak_capacity += s.weak_capacity;
+        total.weak_max_displacement =
+            std::max(total.weak_max_displacement, s.weak_max_displacement);
+        total.weak_out_of_line += s.weak_out_of_line;
+        total.weak_bytes += s.weak_bytes;
+    }
+    return total;
+}
+
+
+/***********************************************************************
+* Driver
+**********************************************************************/
+
+template <typename Weak>
+static void run(const Options& options, size_t variables,
+                unsigned readers, unsigned writers)
+{
+    if (!options.wants(Weak::name)) return;
+
+    std::vector<id> weak(variables);
+    std::vector<std::atomic<id>> strong(variables);
+    for (size_t k = 0; k < variables; k++) {
+        id obj = newObject();
+        strong[k].store(obj, std::memory_order_relaxed);
+        SideTable& table = tableFor(obj);
+        table.slock.lock();
+        weak_register_no_lock(&table.weak_table, obj, &weak[k], false);
+        weak[k] = obj;
+        table.slock.unlock();
+    }
+
+    std::vector<std::vector<size_t>> streams(readers + writers);
+    Random random;
+    for (auto& stream : streams) {
+        stream.resize(4096);
+        for (auto& i : stream) i = random.below(variables);
+    }
+
+    ConcurrentResult r = measureConcurrent(readers, options.lookups, writers,
+        []{},
+        [&](unsigned t, size_t i) {
+            id obj = Weak::loadWeakRetained(&weak[streams[t][i % 4096]]);
+            checkLive(obj, "weak load");
+            release<Weak>(obj);
+        },
+        [&](unsigned t, size_t i) {
+            size_t k = streams[readers + t][i % 4096];
+            id obj = newObject();
+            storeWeak(&weak[k], obj);
+            release<Weak>(strong[k].exchange(obj));
+        });
+
+    char keys[32], op[32];
+    snprintf(keys, sizeof(keys), "%zu", variables);
+    snprintf(op, sizeof(op), "load r%uw%u", readers, writers);
+    print(Weak::name, keys, op, r.reads);
+    if (writers) {
+        snprintf(op, sizeof(op), "dealloc r%uw%u", readers, writers);
+        print(Weak::name, keys, op, r.writes);
+    }
+
+    for (size_t k = 0; k < variables; k++) release<Weak>(strong[k].load());
+}
+
+// Each of -n objects has one __weak variable. Arrays of size objects
+// are released and deallocated; the run checks that every variable
+// was cleared. Mops/s counts objects; latencies are per array.
+template <typename Release>
+static void runArray(const Options& options, size_t size)
+{
+    if (!options.wants(Release::name)) return;
+
+    size_t arrays = std::max(options.entries / size, (size_t)1);
+    size_t n = arrays * size;
+    std::vector<id> objs(n), weak(n);
+
+    auto setup = [&]{
+        for (size_t k = 0; k < n; k++) {
+            objs[k] = newObject();
+            SideTable& table = tableFor(objs[k]);
+            table.slock.lock();
+            weak_register_no_lock(&table.weak_table, objs[k], &weak[k], false);
+            weak[k] = objs[k];
+            table.slock.unlock();
+        }
+    };
+
+    Result r = measure(arrays, setup, [&](size_t i) {
+        Release::release(&objs[i * size], size);
+    });
+
+    for (size_t k = 0; k < n; k++) {
+        if (weak[k]) {
+            fprintf(stderr, "__weak variable still holds %p\n", weak[k]);
+            abort();
+        }
+    }
+
+    char keys[32];
+    snprintf(keys, sizeof(keys), "%zu", size);
+    r.mops *= size;
+    print(Release::name, keys, "dealloc", r);
+}
+
+template <typename Release>
+static void runArrays(const Options& options)
+{
+    static const size_t sizes[] = { 16, 64, 1024 };
+    for (size_t size : sizes) runArray<Release>(options, size);
+}
+
+// objects objects have one __weak variable each, except that every
+// eighth has eight and so out-of-line referrers. Each op gathers the
+// statistics of all 64 side tables, from the running totals and by
+// walking the tables, which must agree. The bytes column is weak
+// table memory per weakly referenced object.
+static void runStats(const Options& options, size_t objects)
+{
+    static const char * const Name = "objc_getSideTableStats";
+    if (!options.wants(Name)) return;
+    enum { Many = 8 };
+
+    std::vector<id> objs(objects);
+    std::vector<id> weak(objects + (objects / Many + 1) * (Many - 1));
+    size_t next = 0;
+    for (size_t k = 0; k < objects; k++) {
+        objs[k] = newObject();
+        SideTable& table = tableFor(objs[k]);
+        table.slock.lock();
+        size_t refs = k % Many ? 1 : Many;
+        while (refs--) {
+            weak_register_no_lock(&table.weak_table, objs[k], &weak[next], false);
+            weak[next++] = objs[k];
+        }
+        table.slock.unlock();
+    }
+
+    SideTableStats total = totalStats<RunningStats>();
+    SideTableStats walked = totalStats<WalkedStats>();
+    if (!(total == walked)) {
+        fprintf(stderr, "running totals found %zu out-of-line entries "
+                "and %zu bytes; the walk found %zu and %zu\n",
+                total.weak_out_of_line, total.weak_bytes,
+                walked.weak_out_of_line, walked.weak_bytes);
+        abort();
+    }
+
+    char keys[32];
+    snprintf(keys, sizeof(keys), "%zu", objects);
+    size_t count = std::max(options.lookups / objects, (size_t)10);
+    Result r = measure(count, [&](size_t) {
+        keep(totalStats<RunningStats>());
+    });
+    print(Name, keys, RunningStats::name, r, (double)total.weak_bytes / objects);
+    r = measure(count, [&](size_t) {
+        keep(totalStats<WalkedStats>());
+    });
+    print(Name, keys, WalkedStats::name, r);
+
+    for (id obj : objs) clearDeallocating<LockedWeak>(obj);
+}
+
+template <typename Weak>
+static void runAll(const Options& options)
+{
+    static const size_t variableCounts[] = { 1, 1024 };
+    static const unsigned threads[][2] = { {1, 0}, {4, 0}, {4, 1}, {1, 4} };
+    for (size_t variables : variableCounts) {
+        for (auto& t : threads) run<Weak>(options, variables, t[0], t[1]);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options(argc, argv);
+    hazard_init();
+
+    printf("# %zu loads per reader thread, %u CPUs\n",
+           options.lookups, std::thread::hardware_concurrency());
+    printHeader();
+
+    runAll<LockedWeak>(options);
+    runAll<CountedWeak>(options);
+    runAll<HazardWeak>(options);
+    runArrays<EachRelease>(options);
+    runArrays<ArrayRelease>(options);
+    runStats(options, 1024);
+    runStats(options, options.entries);
+    return 0;
+}
@@ -25,6 +25,7 @@
 #include "NSObject.h"
 
 #include "objc-weak.h"
+#include "objc-hazard.h"
 #include "llvm-DenseMap.h"
 #include "NSObject.h"
 
@@ -39,6 +40,8 @@
 #include <libkern/OSAtomic.h>
 #include <Block.h>
 #include <map>
+#include <algorithm>
+#include <atomic>
 #include <execinfo.h>
 
 @interface NSInvocation
@@ -83,29 +86,217 @@ namespace {
 
 // RefcountMap disguises its pointers because we 
 // don't want the table to act as a root for `leaks`.
+#if SUPPORT_GROUP_PROBED_REFCOUNTS
+typedef objc::GroupProbedDenseMap<DisguisedPtr<objc_object>,size_t,true> RefcountMap;
+#else
 typedef objc::DenseMap<DisguisedPtr<objc_object>,size_t,true> RefcountMap;
+#endif
+
+// A RefcountCell holds the side table retain count of one heavily 
+// retained raw-isa object outside RefcountMap, where retain and 
+// release can update it with atomics instead of taking the table lock.
+// A cell is claimed with the lock held, once the object's count reaches 
+// SIDE_TABLE_RC_CELL_THRESHOLD, and is only given back by 
+// sidetable_clearDeallocating(). Nonpointer objects never use cells: 
+// their side table count is protected by the lock and has_sidetable_rc.
+#define SIDE_TABLE_RC_CELL_THRESHOLD (SIDE_TABLE_RC_ONE << 5)
+
+struct RefcountCell {
+    std::atomic<uintptr_t> object;  // disguised like DisguisedPtr; 0 if free
+    std::atomic<size_t> refcnt;     // same layout as a RefcountMap value
+
+    static uintptr_t disguise(objc_object *obj) {
+        return -(uintptr_t)obj;
+    }
+
+    void retain() {
+        if (! (refcnt.load(std::memory_order_relaxed) & SIDE_TABLE_RC_PINNED)) {
+            refcnt.fetch_add(SIDE_TABLE_RC_ONE, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false if the object is deallocating.
+    bool tryRetain() {
+        size_t oldRefcnt = refcnt.load(std::memory_order_relaxed);
+        do {
+            if (oldRefcnt & SIDE_TABLE_DEALLOCATING) return false;
+            if (oldRefcnt & SIDE_TABLE_RC_PINNED) return true;
+        } while (!refcnt.compare_exchange_weak(oldRefcnt, 
+                                               oldRefcnt + SIDE_TABLE_RC_ONE,
+                                               std::memory_order_relaxed));
+        return true;
+    }
+
+    // Returns true if this release started deallocation.
+    bool release() {
+        size_t oldRefcnt = refcnt.load(std::memory_order_relaxed);
+        size_t newRefcnt;
+        do {
+            if (oldRefcnt & SIDE_TABLE_RC_PINNED) return false;
+            if (oldRefcnt < SIDE_TABLE_DEALLOCATING) {
+                // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
+                newRefcnt = oldRefcnt | SIDE_TABLE_DEALLOCATING;
+            } else {
+                newRefcnt = oldRefcnt - SIDE_TABLE_RC_ONE;
+            }
+        } while (!refcnt.compare_exchange_weak(oldRefcnt, newRefcnt, 
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+        return newRefcnt & SIDE_TABLE_DEALLOCATING;
+    }
+};
 
 // Template parameters.
 enum HaveOld { DontHaveOld = false, DoHaveOld = true };
 enum HaveNew { DontHaveNew = false, DoHaveNew = true };
 
+// Set when some SideTable's refcnts became sparse; 
+// the next autorelease pool pop compacts it.
+static std::atomic<bool> SideTablesNeedCompaction;
+
+// Lock profile for one SideTable (OBJC_PRINT_SIDETABLE_LOCKS).
+// Every field is protected by the table's own lock.
+struct SideTableLockStats {
+    enum { ClassSampleCount = 4 };
+
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint64_t holdTime;   // nanoseconds
+    uint64_t lockedAt;
+
+    // Classes of objects whose operations found the lock held.
+    // Approximate top-N: a new class replaces the least frequent one.
+    Class classes[ClassSampleCount];
+    uint64_t classCounts[ClassSampleCount];
+
+    void sampleClass(Class cls) {
+        unsigned int victim = 0;
+        for (unsigned int i = 0; i < ClassSampleCount; i++) {
+            if (classes[i] == cls) {
+                classCounts[i]++;
+                return;
+            }
+            if (classCounts[i] < classCounts[victim]) victim = i;
+        }
+        classes[victim] = cls;
+        classCounts[victim]++;
+    }
+};
+
 struct SideTable {
     spinlock_t slock;
     RefcountMap refcnts;
     weak_table_t weak_table;
+    RefcountCell cells[2];  // a few hot raw-isa objects per stripe
+    SideTableLockStats *lockStats;  // nil unless profiling
+    bool refcntsSparse;  // compaction pending; protected by slock
 
     SideTable() {
         memset(&weak_table, 0, sizeof(weak_table));
+        for (auto& cell : cells) {
+            cell.object.store(0, std::memory_order_relaxed);
+            cell.refcnt.store(0, std::memory_order_relaxed);
+        }
+        lockStats = nil;
+        refcntsSparse = false;
     }
 
     ~SideTable() {
         _objc_fatal("Do not delete SideTable.");
     }
 
-    void lock() { slock.lock(); }
-    void unlock() { slock.unlock(); }
+    // obj, if known, is the object being operated on. 
+    // It is sampled when profiling finds the lock contended.
+    void lock(objc_object *obj = nil) {
+        if (slowpath(lockStats)) profiledLock(obj);
+        else slock.lock();
+    }
+    void unlock() {
+        if (slowpath(lockStats)) {
+            lockStats->holdTime += nanoseconds() - lockStats->lockedAt;
+        }
+        slock.unlock();
+    }
+    bool tryLock() {
+        if (!slock.tryLock()) return false;
+        if (slowpath(lockStats)) {
+            lockStats->acquisitions++;
+            lockStats->lockedAt = nanoseconds();
+        }
+        return true;
+    }
     void forceReset() { slock.forceReset(); }
 
+    void profiledLock(objc_object *obj) {
+        bool contended = !slock.tryLock();
+        if (contended) slock.lock();
+
+        lockStats->acquisitions++;
+        if (contended) {
+            lockStats->contentions++;
+            if (obj  &&  !obj->isTaggedPointer()) {
+                lockStats->sampleClass(obj->ISA());
+            }
+        }
+        lockStats->lockedAt = nanoseconds();
+    }
+
+    // Called after erasing from refcnts. Lock must be held.
+    // Rehashing here would stall every dealloc that happens to cross 
+    // the threshold with the lock held, so compaction is left to 
+    // compactSparseSideTables() at the next autorelease pool pop.
+    void noteRefcntsErased() {
+        if (slowpath(refcnts.isSparse())  &&  !refcntsSparse) {
+            refcntsSparse = true;
+            SideTablesNeedCompaction.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // Give back refcnts memory after a burst of 
+    // side table retain counts has died. Lock must be held.
+    void compactRefcntsIfSparse() {
+        refcntsSparse = false;
+        if (!refcnts.isSparse()) return;
+        size_t reclaimed = refcnts.shrink_to_fit();
+        if (PrintSideTableCompaction) {
+            _objc_inform("SIDETABLES: side table %p released %zu bytes "
+                         "(%u refcounts remain)", this, reclaimed, 
+                         refcnts.size());
+        }
+    }
+
+    // Lock-free lookup of obj's RefcountCell, or nil if it has none.
+    RefcountCell *refcntCellFor(objc_object *obj) {
+        uintptr_t key = RefcountCell::disguise(obj);
+        for (auto& cell : cells) {
+            if (cell.object.load(std::memory_order_acquire) == key) {
+                return &cell;
+            }
+        }
+        return nil;
+    }
+
+    // Move obj's count from refcnts into a free cell, if there is one.
+    // Lock must be held and obj must not already have a cell.
+    void promoteRefcnt(objc_object *obj) {
+        for (auto& cell : cells) {
+            if (cell.object.load(std::memory_order_relaxed) != 0) continue;
+            RefcountMap::iterator it = refcnts.find(obj);
+            if (it == refcnts.end()) return;
+            cell.refcnt.store(it->second, std::memory_order_relaxed);
+            cell.object.store(RefcountCell::disguise(obj), 
+                              std::memory_order_release);
+            refcnts.erase(it);
+            return;
+        }
+    }
+
+    // Lock must be held and the cell's object must be deallocating.
+    void releaseRefcntCell(RefcountCell *cell) {
+        cell->object.store(0, std::memory_order_relaxed);
+        cell->refcnt.store(0, std::memory_order_relaxed);
+    }
+
     // Address-ordered lock discipline for a pair of side tables.
 
     template<HaveOld, HaveNew>
@@ -119,7 +310,15 @@ template<>
 void SideTable::lockTwo<DoHaveOld, DoHaveNew>
     (SideTable *lock1, SideTable *lock2)
 {
-    spinlock_t::lockTwo(&lock1->slock, &lock2->slock);
+    // Same address order as spinlock_t::lockTwo, 
+    // but through lock() so profiling sees both.
+    if (lock1 < lock2) {
+        lock1->lock();
+        lock2->lock();
+    } else {
+        lock2->lock();
+        if (lock2 != lock1) lock1->lock();
+    }
 }
 
 template<>
@@ -140,7 +339,8 @@ template<>
 void SideTable::unlockTwo<DoHaveOld, DoHaveNew>
     (SideTable *lock1, SideTable *lock2)
 {
-    spinlock_t::unlockTwo(&lock1->slock, &lock2->slock);
+    lock1->unlock();
+    if (lock2 != lock1) lock2->unlock();
 }
 
 template<>
@@ -173,6 +373,27 @@ static StripedMap<SideTable>& SideTables() {
     return *reinterpret_cast<StripedMap<SideTable>*>(SideTableBuf);
 }
 
+// Compacts the refcount maps that noteRefcntsErased() found sparse.
+// Called by autorelease pool pop with no side table lock held.
+// A table whose lock is busy is left for a later pop.
+static void compactSparseSideTables()
+{
+    SideTablesNeedCompaction.store(false, std::memory_order_relaxed);
+
+    StripedMap<SideTable>& tables = SideTables();
+    for (unsigned int i = 0; i < tables.getStripeCount(); i++) {
+        SideTable& table = tables.getStripe(i);
+        // Unlocked hint; checked again with the lock held.
+        if (!table.refcntsSparse) continue;
+        if (!table.tryLock()) {
+            SideTablesNeedCompaction.store(true, std::memory_order_relaxed);
+            continue;
+        }
+        if (table.refcntsSparse) table.compactRefcntsIfSparse();
+        table.unlock();
+    }
+}
+
 // anonymous namespace
 };
 
@@ -465,12 +686,30 @@ objc_loadWeakRetained(id *location)
     Class cls;
 
     SideTable *table;
+#if SUPPORT_OBJECT_HAZARDS
+    ObjectHazard *hazard = objectHazardForThread();
+#endif
     
  retry:
-    // fixme std::atomic this load
+#if SUPPORT_OBJECT_HAZARDS
+    // Fast case: default-RR objects are retained without the lock. 
+    // The hazard keeps obj's memory alive once *location is seen to 
+    // still hold it, because clearing the weak references waits for it.
+    // rootTryRetainFast() fails if obj has started deallocating. 
+    // Deallocation is permanent, so a successful retain means obj 
+    // was alive when *location was re-read.
+    obj = (id)objectHazardAcquire(hazard, location);
+    if (!obj) return nil;
+    if (obj->isTaggedPointer()) return obj;
+    result = (!obj->ISA()->hasCustomRR()  &&  obj->rootTryRetainFast()) 
+        ? obj : nil;
+    objectHazardRelease(hazard);
+    if (result) return result;
+#else
     obj = *location;
     if (!obj) return nil;
     if (obj->isTaggedPointer()) return obj;
+#endif
     
     table = &SideTables()[obj];
     
@@ -573,6 +812,162 @@ objc_moveWeak(id *dst, id *src)
 }
 
 
+/***********************************************************************
+* Biased reference counting (OBJC_BIASED_REFCOUNTS)
+* Each thread keeps a small buffer of releases it has performed but not 
+*   yet applied to the isa. A release is buffered only while the inline 
+*   retain count shows that other references remain, and a later retain 
+*   by the same thread cancels a buffered release instead of updating 
+*   the isa, so retain/release pairs on one thread need no atomics.
+* The isa retain count always covers every buffered release, so an 
+*   object is never deallocated while a thread buffers releases for it.
+*   A thread that drops the last reference deallocates immediately. 
+*   If the last reference is dropped on another thread, deallocation 
+*   waits until the buffering thread flushes: at autorelease pool pop 
+*   or thread exit.
+**********************************************************************/
+#if SUPPORT_BIASED_REFCOUNTS
+
+namespace {
+
+struct BiasedRefcountBuffer {
+    enum { EntryCount = 64 };  // must be a power of two
+
+    struct Entry {
+        objc_object *obj;  // nil iff releases == 0
+        uintptr_t releases;
+    };
+
+    Entry entries[EntryCount];
+    unsigned int used;
+
+    Entry& entryFor(objc_object *obj) {
+        return entries[ptr_hash((uintptr_t)obj) & (EntryCount-1)];
+    }
+
+    static BiasedRefcountBuffer *get(bool create) {
+        auto buffer = (BiasedRefcountBuffer *)
+            tls_get_direct(BIASED_REFCOUNT_KEY);
+        if (!buffer  &&  create) {
+            buffer = (BiasedRefcountBuffer *)calloc(1, sizeof(*buffer));
+            tls_set_direct(BIASED_REFCOUNT_KEY, buffer);
+        }
+        return buffer;
+    }
+
+    static void init() {
+        int r __unused = pthread_key_init_np(BIASED_REFCOUNT_KEY, 
+                                             &BiasedRefcountBuffer::tls_dealloc);
+        assert(r == 0);
+    }
+
+    static void tls_dealloc(void *p) {
+        // pthread has already cleared our key. Put the buffer back so
+        // releases run by the flush (e.g. from -dealloc) still find it.
+        tls_set_direct(BIASED_REFCOUNT_KEY, p);
+        objc_object::biasedRefcountsFlush();
+        tls_set_direct(BIASED_REFCOUNT_KEY, nil);
+        free(p);
+    }
+};
+
+// anonymous namespace
+};
+
+
+// Cancel one of this thread's buffered releases of this object, if any.
+bool
+objc_object::biased_retain()
+{
+    BiasedRefcountBuffer *buffer = BiasedRefcountBuffer::get(false);
+    if (!buffer  ||  buffer->used == 0) return false;
+
+    auto& entry = buffer->entryFor(this);
+    if (entry.obj != this) return false;
+
+    if (--entry.releases == 0) {
+        entry.obj = nil;
+        buffer->used--;
+    }
+    return true;
+}
+
+
+// Buffer this release if other references are known to remain.
+// Returns false if the caller must perform the release itself.
+bool
+objc_object::biased_release()
+{
+    if (isTaggedPointer()) return false;
+
+    isa_t bits = LoadExclusive(&isa.bits);
+    ClearExclusive(&isa.bits);
+    if (!bits.nonpointer  ||  bits.deallocating  ||  bits.has_sidetable_rc) {
+        return false;
+    }
+
+    BiasedRefcountBuffer *buffer = BiasedRefcountBuffer::get(true);
+    if (!buffer) return false;
+
+    auto& entry = buffer->entryFor(this);
+    if (entry.obj == this) {
+        if (bits.extra_rc > entry.releases) {
+            entry.releases++;
+            return true;
+        }
+        // This may be the last reference. Apply the buffered releases 
+        // now so the caller's release can deallocate without delay.
+        uintptr_t releases = entry.releases;
+        entry.obj = nil;
+        entry.releases = 0;
+        buffer->used--;
+        while (releases--) rootRelease(true, false);
+        return false;
+    }
+
+    if (entry.obj  ||  bits.extra_rc == 0) return false;
+
+    entry.obj = this;
+    entry.releases = 1;
+    buffer->used++;
+    return true;
+}
+
+
+uintptr_t
+objc_object::biased_pendingReleases()
+{
+    BiasedRefcountBuffer *buffer = BiasedRefcountBuffer::get(false);
+    if (!buffer) return 0;
+    auto& entry = buffer->entryFor(this);
+    return entry.obj == this ? entry.releases : 0;
+}
+
+
+void
+objc_object::biasedRefcountsFlush()
+{
+    BiasedRefcountBuffer *buffer = BiasedRefcountBuffer::get(false);
+    if (!buffer) return;
+
+    // Releases may run -dealloc, which may buffer more releases.
+    while (buffer->used > 0) {
+        for (auto& entry : buffer->entries) {
+            objc_object *obj = entry.obj;
+            if (!obj) continue;
+            uintptr_t releases = entry.releases;
+            entry.obj = nil;
+            entry.releases = 0;
+            buffer->used--;
+            while (releases--) obj->rootRelease(true, false);
+        }
+    }
+}
+
+// SUPPORT_BIASED_REFCOUNTS
+#endif
+
+
 /***********************************************************************
    Autorelease pool implementation
 
@@ -585,6 +980,9 @@ objc_moveWeak(id *dst, id *src)
      and deleted as necessary. 
    Thread-local storage points to the hot page, where newly autoreleased 
      objects are stored. 
+   With SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS, an object autoreleased again 
+     while it is already the hottest entry shares that entry: the high 
+     bits of the entry count the extra autoreleases.
 **********************************************************************/
 
 // Set this to 1 to mprotect() autorelease pool contents
@@ -597,6 +995,10 @@ objc_moveWeak(id *dst, id *src)
 BREAKPOINT_FUNCTION(void objc_autoreleaseNoPool(id obj));
 BREAKPOINT_FUNCTION(void objc_autoreleasePoolInvalid(const void *token));
 
+unsigned int PoolPageThreadCacheLimit = 4;
+unsigned int PoolPageGlobalCacheLimit = 64;
+unsigned int PoolSiteSampleInterval = 64;
+
 namespace {
 
 struct magic_t {
@@ -633,6 +1035,354 @@ struct magic_t {
 };
     
 
+/***********************************************************************
+* Autorelease pool page cache
+* Pages freed when pools are popped are kept for the next burst instead 
+*   of going back to malloc, which would have to find fresh SIZE-aligned 
+*   memory again. Each thread keeps up to PoolPageThreadCacheLimit pages.
+*   Beyond that, and when the thread exits, pages go to a global 
+*   lock-free stack of up to PoolPageGlobalCacheLimit pages. 
+* The cache is bypassed under OBJC_DEBUG_POOL_ALLOCATION so that heap 
+*   debuggers see every page allocation and free.
+* OBJC_PRINT_POOL_PAGE_CACHE logs the reuse rate at exit.
+**********************************************************************/
+struct PoolPageCache {
+    // Overlaid on the start of each cached page.
+    struct FreePage {
+        FreePage *next;
+        unsigned int count;  // length of this thread's list from here
+    };
+
+    static void *get() 
+    {
+        if (slowpath(DebugPoolAllocation)) return nil;
+
+        void *result = nil;
+        bool global = false;
+        FreePage *head = (FreePage *)tls_get_direct(AUTORELEASE_POOL_CACHE_KEY);
+        if (head) {
+            tls_set_direct(AUTORELEASE_POOL_CACHE_KEY, head->next);
+            result = head;
+        } 
+        else if ((result = OSAtomicDequeue(&globalPages, 
+                                           offsetof(FreePage, next)))) 
+        {
+            globalCount.fetch_sub(1, std::memory_order_relaxed);
+            global = true;
+        }
+
+        if (slowpath(PrintPoolPageCache)) {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            if (result  &&  global) {
+                globalHits.fetch_add(1, std::memory_order_relaxed);
+            } else if (result) {
+                threadHits.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        return result;
+    }
+
+    // Returns false if p was not cached and must be freed.
+    static bool put(void *p) 
+    {
+        if (slowpath(DebugPoolAllocation)) return false;
+
+        FreePage *page = (FreePage *)p;
+        FreePage *head = (FreePage *)tls_get_direct(AUTORELEASE_POOL_CACHE_KEY);
+        unsigned int count = head ? head->count : 0;
+        if (count < PoolPageThreadCacheLimit) {
+            page->next = head;
+            page->count = count + 1;
+            tls_set_direct(AUTORELEASE_POOL_CACHE_KEY, page);
+            return true;
+        }
+        return putGlobal(page);
+    }
+
+    static bool putGlobal(FreePage *page) 
+    {
+        if (globalCount.fetch_add(1, std::memory_order_relaxed) >= 
+            PoolPageGlobalCacheLimit) 
+        {
+            globalCount.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        OSAtomicEnqueue(&globalPages, page, offsetof(FreePage, next));
+        return true;
+    }
+
+    static void init()
+    {
+        int r __unused = pthread_key_init_np(AUTORELEASE_POOL_CACHE_KEY, 
+                                             &PoolPageCache::tls_dealloc);
+        assert(r == 0);
+        if (PrintPoolPageCache) atexit(&PoolPageCache::printStats);
+    }
+
+    static void tls_dealloc(void *p) 
+    {
+        // Give this thread's pages to the global cache. If the 
+        // autorelease pool's own tls_dealloc runs after this one, 
+        // the pages it frees land in a new thread list and pthread 
+        // calls us again for it.
+        FreePage *page = (FreePage *)p;
+        while (page) {
+            FreePage *next = page->next;
+            if (!putGlobal(page)) free(page);
+            page = next;
+        }
+    }
+
+    static void printStats()
+    {
+        uint64_t total = allocations.load(std::memory_order_relaxed);
+        uint64_t thread = threadHits.load(std::memory_order_relaxed);
+        uint64_t global = globalHits.load(std::memory_order_relaxed);
+        double scale = total ? 100.0 / total : 0;
+        _objc_inform("AUTORELEASE POOLS: %llu page allocations: "
+                     "%llu (%.1f%%) from thread caches, "
+                     "%llu (%.1f%%) from the global cache, "
+                     "%llu (%.1f%%) from malloc", 
+                     (unsigned long long)total, 
+                     (unsigned long long)thread, thread * scale, 
+                     (unsigned long long)global, global * scale, 
+                     (unsigned long long)(total - thread - global), 
+                     (total - thread - global) * scale);
+    }
+
+    static OSQueueHead globalPages;
+    static std::atomic<unsigned int> globalCount;
+    static std::atomic<uint64_t> allocations;
+    static std::atomic<uint64_t> threadHits;
+    static std::atomic<uint64_t> globalHits;
+};
+
+OSQueueHead PoolPageCache::globalPages = OS_ATOMIC_QUEUE_INIT;
+std::atomic<unsigned int> PoolPageCache::globalCount;
+std::atomic<uint64_t> PoolPageCache::allocations;
+std::atomic<uint64_t> PoolPageCache::threadHits;
+std::atomic<uint64_t> PoolPageCache::globalHits;
+
+
+/***********************************************************************
+* Autorelease pool site profile (OBJC_PRINT_POOL_SITES)
+* Attributes autorelease pool growth to the code responsible for it.
+* Every pool pushed through objc_autoreleasePoolPush() is tagged with 
+*   its caller, the push site. Popping a pool records how many objects 
+*   were autoreleased into it, not counting those drained by pools 
+*   nested inside it. One autorelease in PoolSiteSampleInterval records 
+*   the first caller outside libobjc and the object's class under the 
+*   innermost push site.
+* A push site with many objects per pop and one dominant caller is a 
+*   loop that wants an inner @autoreleasepool.
+* Results are aggregated in fixed-size lock-free tables and logged by 
+*   objc_printAutoreleasePoolSites(), which also runs at exit. 
+*   Samples that do not fit are counted as dropped.
+**********************************************************************/
+struct PoolSiteProfile {
+    enum { MaxDepth = 64, SiteCount = 512, SampleCount = 4096, 
+           MaxProbes = 32, CallerFrames = 16 };
+
+    // One pushed pool on this thread.
+    struct Frame {
+        void *token;
+        void *site;
+        uint64_t start;   // thread's autoreleases when pushed
+        uint64_t nested;  // autoreleases drained by nested pools
+    };
+
+    struct ThreadState {
+        unsigned int countdown;
+        unsigned int depth;    // may exceed MaxDepth; deeper pools untracked
+        uint64_t autoreleases;
+        Frame frames[MaxDepth];
+    };
+
+    struct Site {
+        std::atomic<void *> site;
+        std::atomic<uint64_t> pops;
+        std::atomic<uint64_t> objects;
+        std::atomic<uint64_t> maxObjects;
+    };
+
+    // Keyed by a hash of all three fields. Colliding triples 
+    // share an entry, which is acceptable for a profile.
+    struct Sample {
+        std::atomic<uintptr_t> key;
+        std::atomic<void *> site;
+        std::atomic<void *> caller;
+        std::atomic<Class> cls;
+        std::atomic<uint64_t> samples;
+    };
+
+    static void init()
+    {
+        if (PoolSiteSampleInterval == 0) PoolSiteSampleInterval = 1;
+        threadKey = tls_create(&free);
+        Dl_info info;
+        if (dladdr((void *)&objc_autoreleasePoolPush, &info)) {
+            runtimeImage = info.dli_fbase;
+        }
+        sites = (Site *)calloc(SiteCount, sizeof(Site));
+        samples = (Sample *)calloc(SampleCount, sizeof(Sample));
+        atexit(&objc_printAutoreleasePoolSites);
+    }
+
+    static ThreadState *threadState()
+    {
+        ThreadState *state = (ThreadState *)tls_get(threadKey);
+        if (!state) {
+            state = (ThreadState *)calloc(1, sizeof(ThreadState));
+            if (!state) return nil;
+            state->countdown = PoolSiteSampleInterval;
+            tls_set(threadKey, state);
+        }
+        return state;
+    }
+
+    static void pushed(void *token, void *site)
+    {
+        ThreadState *state = threadState();
+        if (!state) return;
+        if (state->depth < MaxDepth) {
+            Frame& frame = state->frames[state->depth];
+            frame.token = token;
+            frame.site = site;
+            frame.start = state->autoreleases;
+            frame.nested = 0;
+        }
+        state->depth++;
+    }
+
+    static void popping(void *token)
+    {
+        ThreadState *state = threadState();
+        if (!state) return;
+
+        // Popping a pool also pops any pools still pushed inside it.
+        unsigned int tracked = std::min(state->depth, (unsigned int)MaxDepth);
+        unsigned int i = tracked;
+        while (i > 0  &&  state->frames[i-1].token != token) i--;
+        if (i == 0) {
+            // Not tracked: deeper than MaxDepth, or pushed before 
+            // this thread's first tracked pool.
+            if (state->depth > MaxDepth) state->depth--;
+            return;
+        }
+
+        for (unsigned int j = tracked; j-- > i-1; ) {
+            Frame& frame = state->frames[j];
+            uint64_t inclusive = state->autoreleases - frame.start;
+            if (j > 0) state->frames[j-1].nested += inclusive;
+            recordPop(frame.site, inclusive - frame.nested);
+        }
+        state->depth = i-1;
+    }
+
+    static void autoreleased(id obj)
+    {
+        ThreadState *state = threadState();
+        if (!state) return;
+        state->autoreleases++;
+        if (--state->countdown > 0) return;
+        state->countdown = PoolSiteSampleInterval;
+
+        unsigned int tracked = std::min(state->depth, (unsigned int)MaxDepth);
+        void *site = tracked ? state->frames[tracked-1].site : nil;
+        recordSample(site, callerOutsideRuntime(), obj->ISA());
+    }
+
+    static void *callerOutsideRuntime()
+    {
+        void *stack[CallerFrames];
+        int count = backtrace(stack, CallerFrames);
+        for (int i = 0; i < count; i++) {
+            Dl_info info;
+            if (!dladdr(stack[i], &info)  ||  info.dli_fbase != runtimeImage) {
+                return stack[i];
+            }
+        }
+        return count ? stack[count-1] : nil;
+    }
+
+    static void recordPop(void *site, uint64_t objects)
+    {
+        uintptr_t h = hash(site, nil, nil);
+        for (unsigned int probe = 0; probe < MaxProbes; probe++) {
+            Site& entry = sites[(h + probe) & (SiteCount-1)];
+            void *current = entry.site.load(std::memory_order_relaxed);
+            if (current == nil  &&  site != nil) {
+                if (!entry.site.compare_exchange_strong
+                    (current, site, std::memory_order_relaxed))
+                {
+                    // Claimed by another thread; current is its site.
+                    if (current != site) continue;
+                }
+            } else if (current != site) {
+                continue;
+            }
+
+            entry.pops.fetch_add(1, std::memory_order_relaxed);
+            entry.objects.fetch_add(objects, std::memory_order_relaxed);
+            uint64_t max = entry.maxObjects.load(std::memory_order_relaxed);
+            while (objects > max  &&  
+                   !entry.maxObjects.compare_exchange_weak
+                   (max, objects, std::memory_order_relaxed)) 
+                { }
+            return;
+        }
+        droppedPops.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void recordSample(void *site, void *caller, Class cls)
+    {
+        uintptr_t key = hash(site, caller, cls) | 1;  // 0 means empty
+        for (unsigned int probe = 0; probe < MaxProbes; probe++) {
+            Sample& entry = samples[(key + probe) & (SampleCount-1)];
+            uintptr_t current = entry.key.load(std::memory_order_acquire);
+            if (current == 0) {
+                if (entry.key.compare_exchange_strong
+                    (current, key, std::memory_order_relaxed))
+                {
+                    entry.site.store(site, std::memory_order_relaxed);
+                    entry.caller.store(caller, std::memory_order_relaxed);
+                    entry.cls.store(cls, std::memory_order_relaxed);
+                    entry.samples.fetch_add(1, std::memory_order_release);
+                    return;
+                }
+            }
+            if (current == key) {
+                entry.samples.fetch_add(1, std::memory_order_release);
+                return;
+            }
+        }
+        droppedSamples.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static uintptr_t hash(void *site, void *caller, Class cls)
+    {
+        uintptr_t h = (uintptr_t)site;
+        h = (h ^ (h >> 17)) * 0x9E3779B97F4A7C15ULL + (uintptr_t)caller;
+        h = (h ^ (h >> 17)) * 0x9E3779B97F4A7C15ULL + (uintptr_t)cls;
+        return h ^ (h >> 29);
+    }
+
+    static tls_key_t threadKey;
+    static void *runtimeImage;
+    static Site *sites;
+    static Sample *samples;
+    static std::atomic<uint64_t> droppedPops;
+    static std::atomic<uint64_t> droppedSamples;
+};
+
+tls_key_t PoolSiteProfile::threadKey;
+void *PoolSiteProfile::runtimeImage;
+PoolSiteProfile::Site *PoolSiteProfile::sites;
+PoolSiteProfile::Sample *PoolSiteProfile::samples;
+std::atomic<uint64_t> PoolSiteProfile::droppedPops;
+std::atomic<uint64_t> PoolSiteProfile::droppedSamples;
+
+
 class AutoreleasePoolPage 
 {
     // EMPTY_POOL_PLACEHOLDER is stored in TLS when exactly one pool is 
@@ -651,6 +1401,20 @@ class AutoreleasePoolPage
         PAGE_MAX_SIZE;  // size and alignment, power of 2
 #endif
     static size_t const COUNT = SIZE / sizeof(id);
+    static size_t const RELEASE_BATCH = 64;  // entries released at once
+
+#if SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS
+    // A pool entry for an object autoreleased count+1 times in a row.
+    // With count == 0 the entry is the same as a plain id.
+    struct AutoreleasePoolEntry {
+        uintptr_t ptr: 48;
+        uintptr_t count: 16;
+
+        static const uintptr_t maxCount = 65535;  // 2^16 - 1
+    };
+    static_assert(MACH_VM_MAX_ADDRESS < (1ULL << 48), 
+                  "MACH_VM_MAX_ADDRESS doesn't fit into AutoreleasePoolEntry::ptr");
+#endif
 
     magic_t const magic;
     id *next;
@@ -663,9 +1427,11 @@ class AutoreleasePoolPage
     // SIZE-sizeof(*this) bytes of contents follow
 
     static void * operator new(size_t size) {
+        if (void *page = PoolPageCache::get()) return page;
         return malloc_zone_memalign(malloc_default_zone(), SIZE, SIZE);
     }
     static void operator delete(void * p) {
+        if (PoolPageCache::put(p)) return;
         return free(p);
     }
 
@@ -769,12 +1535,56 @@ class AutoreleasePoolPage
     {
         assert(!full());
         unprotect();
-        id *ret = next;  // faster than `return next-1` because of aliasing
+        id *ret;
+
+#if SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS
+        if (!DisableAutoreleaseCoalescing  &&  
+            obj != POOL_BOUNDARY  &&  next > begin()) 
+        {
+            // Count another autorelease of the hottest entry's object.
+            AutoreleasePoolEntry *topEntry = (AutoreleasePoolEntry *)next - 1;
+            if (topEntry->ptr == (uintptr_t)obj  &&  
+                topEntry->count < AutoreleasePoolEntry::maxCount) 
+            {
+                topEntry->count++;
+                ret = (id *)topEntry;
+                protect();
+                return ret;
+            }
+        }
+#endif
+
+        ret = next;  // faster than `return next-1` because of aliasing
         *next++ = obj;
         protect();
         return ret;
     }
 
+    // The object in a pool entry and, optionally, 
+    // how many times it must be released.
+    static id entryObject(id *entry, uintptr_t *releases = nil)
+    {
+#if SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS
+        AutoreleasePoolEntry poolEntry = *(AutoreleasePoolEntry *)entry;
+        if (releases) *releases = poolEntry.count + 1;
+        return (id)(uintptr_t)poolEntry.ptr;
+#else
+        if (releases) *releases = 1;
+        return *entry;
+#endif
+    }
+
+    // Release obj count times, with one retain count update if possible.
+    static void releaseRepeated(id obj, uintptr_t count)
+    {
+        if (count > 1  &&  !obj->ISA()->hasCustomRR()  &&  
+            obj->rootTryReleaseMany(count)) 
+        {
+            return;
+        }
+        while (count--) objc_release(obj);
+    }
+
     void releaseAll() 
     {
         releaseUntil(begin());
@@ -784,6 +1594,14 @@ class AutoreleasePoolPage
     {
         // Not recursive: we don't want to blow out the stack 
         // if a thread accumulates a stupendous amount of garbage
+
+        // Entries are taken off the hot page RELEASE_BATCH at a time 
+        // and released together with objc_releaseArray(), which takes 
+        // each side table lock once per batch. The page is updated 
+        // before anything is released, so objects autoreleased by 
+        // -release or -dealloc are simply added to the hot page again.
+        id batch[RELEASE_BATCH];
+        uint16_t extra[RELEASE_BATCH];
         
         while (this->next != stop) {
             // Restart from hotPage() every time, in case -release 
@@ -796,14 +1614,36 @@ class AutoreleasePoolPage
                 setHotPage(page);
             }
 
+            id *end = page->next;
+            id *start = end - MIN(end - page->begin(), (ptrdiff_t)RELEASE_BATCH);
+            if (page == this  &&  start < stop) start = stop;
+
+            // Hottest entries first, as if popped one at a time.
+            size_t count = 0;
+            bool repeated = false;
+            for (id *p = end; p > start; ) {
+                uintptr_t releases;
+                id obj = entryObject(--p, &releases);
+                if (obj == POOL_BOUNDARY) continue;
+                batch[count] = obj;
+                extra[count] = (uint16_t)(releases - 1);
+                if (releases > 1) repeated = true;
+                count++;
+            }
+
             page->unprotect();
-            id obj = *--page->next;
-            memset((void*)page->next, SCRIBBLE, sizeof(*page->next));
+            page->next = start;
+            memset((void*)start, SCRIBBLE, (end - start) * sizeof(*start));
             page->protect();
 
-            if (obj != POOL_BOUNDARY) {
-                objc_release(obj);
+            // Coalesced entries leave one reference for the batch.
+            if (slowpath(repeated)) {
+                for (size_t i = 0; i < count; i++) {
+                    if (extra[i]) releaseRepeated(batch[i], extra[i]);
+                }
             }
+            if (count == 1) objc_release(batch[0]);
+            else if (count > 1) objc_releaseArray(batch, count);
         }
 
         setHotPage(this);
@@ -1011,8 +1851,10 @@ public:
     {
         assert(obj);
         assert(!obj->isTaggedPointer());
+        if (slowpath(PrintPoolSites)) PoolSiteProfile::autoreleased(obj);
         id *dest __unused = autoreleaseFast(obj);
-        assert(!dest  ||  dest == EMPTY_POOL_PLACEHOLDER  ||  *dest == obj);
+        assert(!dest  ||  dest == EMPTY_POOL_PLACEHOLDER  ||  
+               entryObject(dest) == obj);
         return obj;
     }
 
@@ -1091,6 +1933,16 @@ public:
 
         page->releaseUntil(stop);
 
+#if SUPPORT_BIASED_REFCOUNTS
+        if (slowpath(EnableBiasedRefcounts)) {
+            objc_object::biasedRefcountsFlush();
+        }
+#endif
+
+        if (slowpath(SideTablesNeedCompaction.load(std::memory_order_relaxed))) {
+            compactSparseSideTables();
+        }
+
         // memory: delete empty children
         if (DebugPoolAllocation  &&  page->empty()) {
             // special case: delete everything during page-per-pool debugging
@@ -1129,11 +1981,17 @@ public:
                      this == coldPage() ? "(cold)" : "");
         check(false);
         for (id *p = begin(); p < next; p++) {
-            if (*p == POOL_BOUNDARY) {
+            uintptr_t releases;
+            id obj = entryObject(p, &releases);
+            if (obj == POOL_BOUNDARY) {
                 _objc_inform("[%p]  ################  POOL %p", p, p);
+            } else if (releases > 1) {
+                _objc_inform("[%p]  %#16lx  %s  autorelease count %lu", 
+                             p, (unsigned long)obj, object_getClassName(obj), 
+                             (unsigned long)releases);
             } else {
                 _objc_inform("[%p]  %#16lx  %s", 
-                             p, (unsigned long)*p, object_getClassName(*p));
+                             p, (unsigned long)obj, object_getClassName(obj));
             }
         }
     }
@@ -1229,14 +2087,20 @@ objc_object::clearDeallocating_slow()
     assert(isa.nonpointer  &&  (isa.weakly_referenced || isa.has_sidetable_rc));
 
     SideTable& table = SideTables()[this];
-    table.lock();
-    if (isa.weakly_referenced) {
+    table.lock(this);
+    bool weaklyReferenced = isa.weakly_referenced;
+    if (weaklyReferenced) {
         weak_clear_no_lock(&table.weak_table, (id)this);
     }
     if (isa.has_sidetable_rc) {
         table.refcnts.erase(this);
+        table.noteRefcntsErased();
     }
     table.unlock();
+
+#if SUPPORT_OBJECT_HAZARDS
+    if (weaklyReferenced) objectHazardsWait(this);
+#endif
 }
 
 #endif
@@ -1278,11 +2142,13 @@ objc_object::sidetable_present()
     bool result = false;
     SideTable& table = SideTables()[this];
 
-    table.lock();
+    table.lock(this);
 
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it != table.refcnts.end()) result = true;
 
+    if (table.refcntCellFor(this)) result = true;
+
     if (weak_is_registered_no_lock(&table.weak_table, (id)this)) result = true;
 
     table.unlock();
@@ -1297,7 +2163,7 @@ void
 objc_object::sidetable_lock()
 {
     SideTable& table = SideTables()[this];
-    table.lock();
+    table.lock(this);
 }
 
 void 
@@ -1413,18 +2279,40 @@ objc_object::sidetable_retain()
     assert(!isa.nonpointer);
 #endif
     SideTable& table = SideTables()[this];
-    
-    table.lock();
-    size_t& refcntStorage = table.refcnts[this];
-    if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
-        refcntStorage += SIDE_TABLE_RC_ONE;
+
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        cell->retain();
+        return (id)this;
     }
+    
+    table.lock(this);
+    sidetable_retain_nolock(table);
     table.unlock();
 
     return (id)this;
 }
 
 
+id
+objc_object::sidetable_retain_nolock(SideTable& table)
+{
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        // Promoted since the caller's unlocked check.
+        cell->retain();
+    } else {
+        size_t& refcntStorage = table.refcnts[this];
+        if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+            refcntStorage += SIDE_TABLE_RC_ONE;
+        }
+        if (refcntStorage >= SIDE_TABLE_RC_CELL_THRESHOLD) {
+            table.promoteRefcnt(this);
+        }
+    }
+
+    return (id)this;
+}
+
+
 bool
 objc_object::sidetable_tryRetain()
 {
@@ -1442,6 +2330,10 @@ objc_object::sidetable_tryRetain()
     //     _objc_fatal("Do not call -_tryRetain.");
     // }
 
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        return cell->tryRetain();
+    }
+
     bool result = true;
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it == table.refcnts.end()) {
@@ -1462,8 +2354,14 @@ objc_object::sidetable_retainCount()
     SideTable& table = SideTables()[this];
 
     size_t refcnt_result = 1;
+
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        // this is valid for SIDE_TABLE_RC_PINNED too
+        size_t refcnt = cell->refcnt.load(std::memory_order_relaxed);
+        return refcnt_result + (refcnt >> SIDE_TABLE_RC_SHIFT);
+    }
     
-    table.lock();
+    table.lock(this);
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it != table.refcnts.end()) {
         // this is valid for SIDE_TABLE_RC_PINNED too
@@ -1489,6 +2387,11 @@ objc_object::sidetable_isDeallocating()
     //     _objc_fatal("Do not call -_isDeallocating.");
     // }
 
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        return cell->refcnt.load(std::memory_order_relaxed) & 
+            SIDE_TABLE_DEALLOCATING;
+    }
+
     RefcountMap::iterator it = table.refcnts.find(this);
     return (it != table.refcnts.end()) && (it->second & SIDE_TABLE_DEALLOCATING);
 }
@@ -1500,11 +2403,17 @@ objc_object::sidetable_isWeaklyReferenced()
     bool result = false;
 
     SideTable& table = SideTables()[this];
-    table.lock();
+    table.lock(this);
 
-    RefcountMap::iterator it = table.refcnts.find(this);
-    if (it != table.refcnts.end()) {
-        result = it->second & SIDE_TABLE_WEAKLY_REFERENCED;
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        result = cell->refcnt.load(std::memory_order_relaxed) & 
+            SIDE_TABLE_WEAKLY_REFERENCED;
+    }
+    else {
+        RefcountMap::iterator it = table.refcnts.find(this);
+        if (it != table.refcnts.end()) {
+            result = it->second & SIDE_TABLE_WEAKLY_REFERENCED;
+        }
     }
 
     table.unlock();
@@ -1522,6 +2431,12 @@ objc_object::sidetable_setWeaklyReferenced_nolock()
 
     SideTable& table = SideTables()[this];
 
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        cell->refcnt.fetch_or(SIDE_TABLE_WEAKLY_REFERENCED, 
+                              std::memory_order_relaxed);
+        return;
+    }
+
     table.refcnts[this] |= SIDE_TABLE_WEAKLY_REFERENCED;
 }
 
@@ -1539,9 +2454,31 @@ objc_object::sidetable_release(bool performDealloc)
 
     bool do_dealloc = false;
 
-    table.lock();
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        do_dealloc = cell->release();
+    } else {
+        table.lock(this);
+        do_dealloc = sidetable_release_nolock(table);
+        table.unlock();
+    }
+    if (do_dealloc  &&  performDealloc) {
+        ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
+    }
+    return do_dealloc;
+}
+
+
+// Returns true if the object should now be deallocated.
+bool
+objc_object::sidetable_release_nolock(SideTable& table)
+{
+    bool do_dealloc = false;
+
     RefcountMap::iterator it = table.refcnts.find(this);
-    if (it == table.refcnts.end()) {
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        // Promoted since the caller's unlocked check.
+        do_dealloc = cell->release();
+    } else if (it == table.refcnts.end()) {
         do_dealloc = true;
         table.refcnts[this] = SIDE_TABLE_DEALLOCATING;
     } else if (it->second < SIDE_TABLE_DEALLOCATING) {
@@ -1551,10 +2488,7 @@ objc_object::sidetable_release(bool performDealloc)
     } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
         it->second -= SIDE_TABLE_RC_ONE;
     }
-    table.unlock();
-    if (do_dealloc  &&  performDealloc) {
-        ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
-    }
+
     return do_dealloc;
 }
 
@@ -1567,18 +2501,377 @@ objc_object::sidetable_clearDeallocating()
     // clear any weak table items
     // clear extra retain count and deallocating bit
     // (fixme warn or abort if extra retain count == 0 ?)
-    table.lock();
+    table.lock(this);
+    bool weaklyReferenced = false;
     RefcountMap::iterator it = table.refcnts.find(this);
-    if (it != table.refcnts.end()) {
+    if (RefcountCell *cell = table.refcntCellFor(this)) {
+        if (cell->refcnt.load(std::memory_order_relaxed) & 
+            SIDE_TABLE_WEAKLY_REFERENCED) 
+        {
+            weak_clear_no_lock(&table.weak_table, (id)this);
+            weaklyReferenced = true;
+        }
+        table.releaseRefcntCell(cell);
+    }
+    else if (it != table.refcnts.end()) {
         if (it->second & SIDE_TABLE_WEAKLY_REFERENCED) {
             weak_clear_no_lock(&table.weak_table, (id)this);
+            weaklyReferenced = true;
         }
         table.refcnts.erase(it);
+        table.noteRefcntsErased();
     }
     table.unlock();
+
+#if SUPPORT_OBJECT_HAZARDS
+    if (weaklyReferenced) objectHazardsWait(this);
+#endif
+}
+
+
+/***********************************************************************
+* objc_compactSideTables
+* Rehashes every side table's refcount map to drop tombstones 
+* and shrink it to fit its live entries.
+* Returns the number of bytes released.
+**********************************************************************/
+size_t 
+objc_compactSideTables(void)
+{
+    size_t reclaimed = 0;
+    StripedMap<SideTable>& tables = SideTables();
+
+    for (unsigned int i = 0; i < tables.getStripeCount(); i++) {
+        SideTable& table = tables.getStripe(i);
+        table.lock();
+        reclaimed += table.refcnts.shrink_to_fit();
+        table.refcntsSparse = false;
+        table.unlock();
+    }
+
+    if (PrintSideTableCompaction) {
+        _objc_inform("SIDETABLES: compaction released %zu bytes", reclaimed);
+    }
+    return reclaimed;
+}
+
+
+// Buckets in a weak hash table, including any still being migrated.
+template <typename Entry>
+static size_t weak_hash_capacity(const weak_hash_t<Entry>& hash)
+{
+    size_t capacity = hash.weak_entries ? hash.mask + 1 : 0;
+    if (hash.old_entries) capacity += hash.old_mask + 1;
+    return capacity;
+}
+
+
+/***********************************************************************
+* objc_getSideTableStats
+* Reports the memory used by each side table's weak table and 
+* refcount map. The weak table keeps running totals of its 
+* out-of-line referrer arrays, so no table is walked.
+**********************************************************************/
+unsigned int
+objc_getSideTableStats(struct objc_side_table_stats *stats, 
+                       unsigned int count, 
+                       struct objc_side_table_stats *total)
+{
+    StripedMap<SideTable>& tables = SideTables();
+    unsigned int stripes = tables.getStripeCount();
+
+    if (total) bzero(total, sizeof(*total));
+
+    for (unsigned int i = 0; i < stripes; i++) {
+        if (i >= count  &&  !total) break;
+
+        SideTable& table = tables.getStripe(i);
+        weak_table_t& weak = table.weak_table;
+        objc_side_table_stats s;
+
+        table.lock();
+        size_t entryCapacity = weak_hash_capacity(weak.entries);
+        size_t singleCapacity = weak_hash_capacity(weak.singles);
+        s.weak_entries = weak.entries.num_entries + weak.singles.num_entries;
+        s.weak_capacity = entryCapacity + singleCapacity;
+        s.weak_max_displacement = 
+            MAX(MAX(weak.entries.max_hash_displacement, 
+                    weak.entries.old_max_hash_displacement), 
+                MAX(weak.singles.max_hash_displacement, 
+                    weak.singles.old_max_hash_displacement));
+        s.weak_out_of_line = weak.num_out_of_line;
+        s.weak_bytes = entryCapacity * sizeof(weak_entry_t) + 
+            singleCapacity * sizeof(weak_single_t) + weak.referrer_bytes;
+        s.refcount_entries = table.refcnts.size();
+        for (auto& cell : table.cells) {
+            if (cell.object.load(std::memory_order_relaxed)) {
+                s.refcount_entries++;
+            }
+        }
+        s.refcount_capacity = table.refcnts.capacity();
+        s.refcount_bytes = table.refcnts.getMemorySize();
+        table.unlock();
+
+        if (stats  &&  i < count) stats[i] = s;
+        if (total) {
+            total->weak_entries += s.weak_entries;
+            total->weak_capacity += s.weak_capacity;
+            total->weak_max_displacement = 
+                MAX(total->weak_max_displacement, s.weak_max_displacement);
+            total->weak_out_of_line += s.weak_out_of_line;
+            total->weak_bytes += s.weak_bytes;
+            total->refcount_entries += s.refcount_entries;
+            total->refcount_capacity += s.refcount_capacity;
+            total->refcount_bytes += s.refcount_bytes;
+        }
+    }
+
+    return stripes;
 }
 
 
+/***********************************************************************
+* objc_printSideTableLockStats
+* Logs each side table's lock acquisitions, contended acquisitions, 
+* hold time, and the classes most often involved in contention.
+* Does nothing unless OBJC_PRINT_SIDETABLE_LOCKS is set, in which 
+* case it also runs at exit.
+**********************************************************************/
+void 
+objc_printSideTableLockStats(void)
+{
+    StripedMap<SideTable>& tables = SideTables();
+    uint64_t totalAcquisitions = 0;
+    uint64_t totalContentions = 0;
+
+    for (unsigned int i = 0; i < tables.getStripeCount(); i++) {
+        SideTable& table = tables.getStripe(i);
+        if (!table.lockStats) return;
+
+        // Copy under the lock, then log without it.
+        table.slock.lock();
+        SideTableLockStats stats = *table.lockStats;
+        table.slock.unlock();
+
+        totalAcquisitions += stats.acquisitions;
+        totalContentions += stats.contentions;
+        if (stats.contentions == 0) continue;
+
+        _objc_inform("SIDETABLES: stripe %u: %llu locks, %llu contended "
+                     "(%.1f%%), %.3f ms held", i, 
+                     (unsigned long long)stats.acquisitions, 
+                     (unsigned long long)stats.contentions, 
+                     100.0 * stats.contentions / stats.acquisitions, 
+                     stats.holdTime / 1000000.0);
+        for (unsigned int c = 0; c < SideTableLockStats::ClassSampleCount; c++) {
+            if (!stats.classes[c]) continue;
+            _objc_inform("SIDETABLES:     %llu contended on %s", 
+                         (unsigned long long)stats.classCounts[c], 
+                         stats.classes[c]->nameForLogging());
+        }
+    }
+
+    _objc_inform("SIDETABLES: %llu locks, %llu contended, %u stripes", 
+                 (unsigned long long)totalAcquisitions, 
+                 (unsigned long long)totalContentions, 
+                 tables.getStripeCount());
+}
+
+
+static void SideTableLockProfileInit() {
+    StripedMap<SideTable>& tables = SideTables();
+    for (unsigned int i = 0; i < tables.getStripeCount(); i++) {
+        tables.getStripe(i).lockStats = (SideTableLockStats *)
+            calloc(1, sizeof(SideTableLockStats));
+    }
+    atexit(objc_printSideTableLockStats);
+}
+
+
+/***********************************************************************
+* Batched retain/release
+* objc_retainArray() and objc_releaseArray() work in chunks of 
+*   RR_BATCH_SIZE objects. nil and tagged pointers are skipped, and 
+*   objects with custom RR are sent messages as usual. Nonpointer isa 
+*   objects are updated in their isa. Raw isa objects with RefcountCells 
+*   are updated without the lock, as objc_retain() does; the rest are 
+*   sorted by side table so each stripe lock is taken once per chunk.
+* Releases that reach zero do not dealloc immediately: -dealloc is sent 
+*   only after every other object in the chunk has been released.
+*   The weak references to those objects are cleared first, 
+*   one lock per stripe, so clearDeallocating() need not lock for them.
+**********************************************************************/
+#if __OBJC2__
+
+#define RR_BATCH_SIZE 64
+
+namespace {
+
+struct RRBatchEntry {
+    SideTable *table;
+    objc_object *obj;
+
+    bool operator < (const RRBatchEntry& other) const {
+        return table < other.table;
+    }
+};
+
+// anonymous namespace
+};
+
+
+#if SUPPORT_NONPOINTER_ISA
+
+// Clear the weak references to objects that are about to be sent 
+// -dealloc, grouped by side table. They are already deallocating, 
+// so weak loads of them return nil whether or not they are cleared yet.
+// Their weakly_referenced bit is reset so clearDeallocating() skips 
+// the side table entirely unless they also have side table retain counts.
+void
+objc_object::clearDeallocatingWeak(objc_object **objs, size_t count)
+{
+    RRBatchEntry weak[RR_BATCH_SIZE];
+    size_t weakCount = 0;
+
+    assert(count <= RR_BATCH_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        objc_object *obj = objs[i];
+        if (obj->isa.nonpointer  &&  obj->isa.weakly_referenced) {
+            weak[weakCount++] = { &SideTables()[obj], obj };
+        }
+    }
+
+    // A single object gains nothing over clearDeallocating().
+    if (weakCount < 2) return;
+
+    std::sort(weak, weak + weakCount);
+    for (size_t i = 0; i < weakCount; ) {
+        SideTable *table = weak[i].table;
+        table->lock(weak[i].obj);
+        for ( ; i < weakCount  &&  weak[i].table == table; i++) {
+            objc_object *obj = weak[i].obj;
+            assert(obj->isa.deallocating);
+            weak_clear_no_lock(&table->weak_table, (id)obj);
+
+            isa_t oldisa;
+            isa_t newisa;
+            do {
+                oldisa = LoadExclusive(&obj->isa.bits);
+                newisa = oldisa;
+                newisa.weakly_referenced = false;
+            } while (!StoreExclusive(&obj->isa.bits, oldisa.bits, newisa.bits));
+        }
+        table->unlock();
+    }
+
+#if SUPPORT_OBJECT_HAZARDS
+    for (size_t i = 0; i < weakCount; i++) objectHazardsWait(weak[i].obj);
+#endif
+}
+
+#endif
+
+
+void
+objc_object::retainArray(id *objs, size_t count)
+{
+    RRBatchEntry raw[RR_BATCH_SIZE];
+
+    while (count > 0) {
+        size_t chunk = MIN(count, (size_t)RR_BATCH_SIZE);
+        size_t rawCount = 0;
+
+        for (size_t i = 0; i < chunk; i++) {
+            id obj = objs[i];
+            if (!obj  ||  obj->isTaggedPointer()) continue;
+            if (slowpath(obj->ISA()->hasCustomRR())) {
+                obj->retain();
+            } else if (obj->hasNonpointerIsa()) {
+                obj->rootRetain();
+            } else {
+                SideTable& table = SideTables()[obj];
+                if (RefcountCell *cell = table.refcntCellFor(obj)) {
+                    cell->retain();
+                } else {
+                    raw[rawCount++] = { &table, obj };
+                }
+            }
+        }
+
+        std::sort(raw, raw + rawCount);
+        for (size_t i = 0; i < rawCount; ) {
+            SideTable *table = raw[i].table;
+            table->lock(raw[i].obj);
+            for ( ; i < rawCount  &&  raw[i].table == table; i++) {
+                raw[i].obj->sidetable_retain_nolock(*table);
+            }
+            table->unlock();
+        }
+
+        objs += chunk;
+        count -= chunk;
+    }
+}
+
+
+void
+objc_object::releaseArray(id *objs, size_t count)
+{
+    RRBatchEntry raw[RR_BATCH_SIZE];
+    objc_object *dealloc[RR_BATCH_SIZE];
+
+    while (count > 0) {
+        size_t chunk = MIN(count, (size_t)RR_BATCH_SIZE);
+        size_t rawCount = 0;
+        size_t deallocCount = 0;
+
+        for (size_t i = 0; i < chunk; i++) {
+            id obj = objs[i];
+            if (!obj  ||  obj->isTaggedPointer()) continue;
+            if (slowpath(obj->ISA()->hasCustomRR())) {
+                obj->release();
+            } else if (obj->hasNonpointerIsa()) {
+                if (obj->rootReleaseShouldDealloc()) {
+                    dealloc[deallocCount++] = obj;
+                }
+            } else {
+                SideTable& table = SideTables()[obj];
+                if (RefcountCell *cell = table.refcntCellFor(obj)) {
+                    if (cell->release()) dealloc[deallocCount++] = obj;
+                } else {
+                    raw[rawCount++] = { &table, obj };
+                }
+            }
+        }
+
+        std::sort(raw, raw + rawCount);
+        for (size_t i = 0; i < rawCount; ) {
+            SideTable *table = raw[i].table;
+            table->lock(raw[i].obj);
+            for ( ; i < rawCount  &&  raw[i].table == table; i++) {
+                if (raw[i].obj->sidetable_release_nolock(*table)) {
+                    dealloc[deallocCount++] = raw[i].obj;
+                }
+            }
+            table->unlock();
+        }
+
+#if SUPPORT_NONPOINTER_ISA
+        clearDeallocatingWeak(dealloc, deallocCount);
+#endif
+        for (size_t i = 0; i < deallocCount; i++) {
+            ((void(*)(objc_object *, SEL))objc_msgSend)(dealloc[i], SEL_dealloc);
+        }
+
+        objs += chunk;
+        count -= chunk;
+    }
+}
+
+// OBJC2
+#endif
+
+
 /***********************************************************************
 * Optimized retain/release/autorelease entrypoints
 **********************************************************************/
@@ -1616,6 +2909,20 @@ objc_autorelease(id obj)
 }
 
 
+void
+objc_retainArray(id *objs, size_t count)
+{
+    objc_object::retainArray(objs, count);
+}
+
+
+void
+objc_releaseArray(id *objs, size_t count)
+{
+    objc_object::releaseArray(objs, count);
+}
+
+
 // OBJC2
 #else
 // not OBJC2
@@ -1625,6 +2932,13 @@ id objc_retain(id obj) { return [obj retain]; }
 void objc_release(id obj) { [obj release]; }
 id objc_autorelease(id obj) { return [obj autorelease]; }
 
+void objc_retainArray(id *objs, size_t count) {
+    for (size_t i = 0; i < count; i++) [objs[i] retain];
+}
+void objc_releaseArray(id *objs, size_t count) {
+    for (size_t i = 0; i < count; i++) [objs[i] release];
+}
+
 
 #endif
 
@@ -1827,15 +3141,24 @@ _objc_rootHash(id obj)
     return (uintptr_t)obj;
 }
 
+static inline void *
+autoreleasePoolPush(void *site)
+{
+    void *token = AutoreleasePoolPage::push();
+    if (slowpath(PrintPoolSites)) PoolSiteProfile::pushed(token, site);
+    return token;
+}
+
 void *
 objc_autoreleasePoolPush(void)
 {
-    return AutoreleasePoolPage::push();
+    return autoreleasePoolPush(__builtin_return_address(0));
 }
 
 void
 objc_autoreleasePoolPop(void *ctxt)
 {
+    if (slowpath(PrintPoolSites)) PoolSiteProfile::popping(ctxt);
     AutoreleasePoolPage::pop(ctxt);
 }
 
@@ -1843,7 +3166,8 @@ objc_autoreleasePoolPop(void *ctxt)
 void *
 _objc_autoreleasePoolPush(void)
 {
-    return objc_autoreleasePoolPush();
+    // Attribute the pool to our caller, not to this function.
+    return autoreleasePoolPush(__builtin_return_address(0));
 }
 
 void
@@ -1859,6 +3183,134 @@ _objc_autoreleasePoolPrint(void)
 }
 
 
+/***********************************************************************
+* objc_printAutoreleasePoolSites
+* Logs the autorelease pool push sites that collected the most objects, 
+* and for each one the sampled callers and classes of those autoreleases.
+* Does nothing unless OBJC_PRINT_POOL_SITES is set, in which case it 
+* also runs at exit.
+**********************************************************************/
+static void describeAddress(void *addr, char *buf, size_t len)
+{
+    Dl_info info;
+    if (!addr) {
+        snprintf(buf, len, "(no pool)");
+    } else if (dladdr(addr, &info)  &&  info.dli_sname) {
+        const char *image = info.dli_fname ? strrchr(info.dli_fname, '/') : nil;
+        image = image ? image+1 : info.dli_fname;
+        snprintf(buf, len, "%s + %lu (%s)", info.dli_sname, 
+                 (unsigned long)((uintptr_t)addr - (uintptr_t)info.dli_saddr),
+                 image ? image : "?");
+    } else {
+        snprintf(buf, len, "%p", addr);
+    }
+}
+
+void 
+objc_printAutoreleasePoolSites(void)
+{
+    enum { SitesShown = 20, SamplesShown = 8 };
+    typedef PoolSiteProfile::Site Site;
+    typedef PoolSiteProfile::Sample Sample;
+
+    if (!PoolSiteProfile::sites) return;
+
+    // Snapshot the busiest sites, then their samples.
+    struct SiteRow { void *site; uint64_t pops, objects, maxObjects; };
+    struct SampleRow { void *caller; Class cls; uint64_t samples; };
+    SiteRow *siteRows = (SiteRow *)calloc(PoolSiteProfile::SiteCount + 1, 
+                                          sizeof(SiteRow));
+    SampleRow *sampleRows = (SampleRow *)
+        calloc(PoolSiteProfile::SampleCount, sizeof(SampleRow));
+    if (!siteRows  ||  !sampleRows) {
+        free(siteRows);
+        free(sampleRows);
+        return;
+    }
+
+    unsigned int siteCount = 0;
+    uint64_t totalObjects = 0;
+    for (unsigned int i = 0; i < PoolSiteProfile::SiteCount; i++) {
+        Site& entry = PoolSiteProfile::sites[i];
+        SiteRow row;
+        row.site = entry.site.load(std::memory_order_relaxed);
+        row.pops = entry.pops.load(std::memory_order_relaxed);
+        row.objects = entry.objects.load(std::memory_order_relaxed);
+        row.maxObjects = entry.maxObjects.load(std::memory_order_relaxed);
+        if (!row.site  ||  row.pops == 0) continue;
+        siteRows[siteCount++] = row;
+        totalObjects += row.objects;
+    }
+    // Samples taken with no tracked pool in place.
+    siteRows[siteCount++] = SiteRow{nil, 0, 0, 0};
+    std::sort(siteRows, siteRows + siteCount - 1, 
+              [](const SiteRow& a, const SiteRow& b) {
+                  return a.objects > b.objects;
+              });
+
+    _objc_inform("POOL SITES: %llu objects autoreleased into %u pool push "
+                 "sites, one in %u sampled", 
+                 (unsigned long long)totalObjects, siteCount - 1, 
+                 PoolSiteSampleInterval);
+
+    for (unsigned int i = 0; i < siteCount; i++) {
+        const SiteRow& row = siteRows[i];
+        if (i >= SitesShown  &&  row.site) continue;
+
+        unsigned int sampleCount = 0;
+        for (unsigned int s = 0; s < PoolSiteProfile::SampleCount; s++) {
+            Sample& entry = PoolSiteProfile::samples[s];
+            uint64_t n = entry.samples.load(std::memory_order_acquire);
+            Class cls = entry.cls.load(std::memory_order_relaxed);
+            if (n == 0  ||  !cls) continue;
+            if (entry.site.load(std::memory_order_relaxed) != row.site) continue;
+            sampleRows[sampleCount++] = SampleRow{
+                entry.caller.load(std::memory_order_relaxed), cls, n
+            };
+        }
+        if (!row.site  &&  sampleCount == 0) continue;
+        std::sort(sampleRows, sampleRows + sampleCount, 
+                  [](const SampleRow& a, const SampleRow& b) {
+                      return a.samples > b.samples;
+                  });
+
+        char where[512];
+        describeAddress(row.site, where, sizeof(where));
+        if (row.site) {
+            _objc_inform("POOL SITES: %s: %llu pops, %llu objects "
+                         "(%.1f per pop, max %llu)", where, 
+                         (unsigned long long)row.pops, 
+                         (unsigned long long)row.objects, 
+                         (double)row.objects / row.pops, 
+                         (unsigned long long)row.maxObjects);
+        } else {
+            _objc_inform("POOL SITES: %s:", where);
+        }
+        for (unsigned int s = 0; s < sampleCount  &&  s < SamplesShown; s++) {
+            describeAddress(sampleRows[s].caller, where, sizeof(where));
+            _objc_inform("POOL SITES:     ~%llu %s from %s", 
+                         (unsigned long long)sampleRows[s].samples * 
+                         PoolSiteSampleInterval, 
+                         sampleRows[s].cls->nameForLogging(), where);
+        }
+    }
+
+    uint64_t droppedPops = 
+        PoolSiteProfile::droppedPops.load(std::memory_order_relaxed);
+    uint64_t droppedSamples = 
+        PoolSiteProfile::droppedSamples.load(std::memory_order_relaxed);
+    if (droppedPops  ||  droppedSamples) {
+        _objc_inform("POOL SITES: %llu pops and %llu samples dropped "
+                     "because the profile tables were full", 
+                     (unsigned long long)droppedPops, 
+                     (unsigned long long)droppedSamples);
+    }
+
+    free(siteRows);
+    free(sampleRows);
+}
+
+
 // Same as objc_release but suitable for tail-calling 
 // if you need the value back and don't want to push a frame before this point.
 __attribute__((noinline))
@@ -1879,6 +3331,11 @@ objc_retainAutoreleaseAndReturn(id obj)
 }
 
 
+#if SUPPORT_RETURN_AUTORELEASE  &&  !SUPPORT_DIRECT_THREAD_KEYS
+// Return disposition for platforms without reserved pthread keys.
+__thread uintptr_t ReturnDispositionSlot;
+#endif
+
 // Prepare a value at +1 for return through a +0 autoreleasing convention.
 id 
 objc_autoreleaseReturnValue(id obj)
@@ -1942,7 +3399,13 @@ objc_objectptr_t objc_unretainedPointer(id object) { return object; }
 
 void arr_init(void) {
     AutoreleasePoolPage::init();
+    PoolPageCache::init();
+    if (PrintPoolSites) PoolSiteProfile::init();
     SideTableInit();
+    if (PrintSideTableLocks) SideTableLockProfileInit();
+#if SUPPORT_BIASED_REFCOUNTS
+    BiasedRefcountBuffer::init();
+#endif
 }
 
 
@@ -29,6 +29,7 @@
 #include "objc-private.h"
 #include "hashtable2.h"
 
+#if !SUPPORT_FLAT_HASHTABLE
 //为了提高效率，bucket 包含一个指向数组的指针，或者在数组大小为1时直接指向数据
 typedef union {
     const void	*one;
@@ -41,6 +42,7 @@ typedef struct	{
     unsigned 	count; 
     oneOrMany	elements;
     } HashBucket;
+#endif
 
 /*************************************************************************
  *
@@ -50,6 +52,8 @@ typedef struct	{
 
 #define	PTRSIZE		sizeof(void *)
 
+#if !SUPPORT_FLAT_HASHTABLE
+
 #if !SUPPORT_ZONES
 #   define	DEFAULT_ZONE	 NULL
 #   define	ZONE_FROM_PTR(p) NULL
@@ -80,9 +84,160 @@ typedef struct	{
 #   define MORE_CAPACITY(b) (b*2+1)
 #endif
 
+#else
+
+/* Flat open-addressed layout.  table->buckets points at a FlatBuckets
+   header followed by nbBuckets element slots and nbBuckets control bytes.
+   A control byte is EMPTY, DELETED, or the low 7 bits of the element's
+   mixed hash.  Probing visits aligned groups of FLAT_GROUP control bytes
+   and only compares elements whose tag matches, so most misses never
+   touch the element slots.  nbBuckets is a power of 2 and a multiple of
+   FLAT_GROUP. */
+#if __SSE2__
+#   include <emmintrin.h>
+#endif
+
+typedef struct {
+    unsigned	tombstones;
+    unsigned	reserved;
+    /* const void *slots[nbBuckets]; */
+    /* uint8_t ctrl[nbBuckets]; */
+    } FlatBuckets;
+
+#define FLAT_GROUP	16
+#define FLAT_EMPTY	((uint8_t)0x80)
+#define FLAT_DELETED	((uint8_t)0xFE)
+#define FLAT_ISFULL(c)	(((c) & 0x80) == 0)
+
+/* Slots start after the header so a table of classes doesn't look like objects */
+#define FLAT_SLOTS(b)	((const void **)((FlatBuckets *)(b) + 1))
+#define FLAT_CTRL(b, nb)	((uint8_t *)(FLAT_SLOTS(b) + (nb)))
+#define FLAT_SIZE(nb)	(sizeof (FlatBuckets) + (nb) * (PTRSIZE + 1))
+
+/* maximum number of full or deleted slots: 7/8 of the table */
+#define FLAT_MAX_LOAD(nb)	((nb) - (nb) / 8)
+
+#if !SUPPORT_ZONES
+#   define	DEFAULT_ZONE	 NULL
+#   define	ZONE_FROM_PTR(p) NULL
+#   define	ALLOCTABLE(z)	((NXHashTable *) malloc (sizeof (NXHashTable)))
+#   define	ALLOCFLAT(z,nb)	((FlatBuckets *) calloc (1, FLAT_SIZE(nb)))
+#else
+#   define	DEFAULT_ZONE	 malloc_default_zone()
+#   define	ZONE_FROM_PTR(p) malloc_zone_from_ptr(p)
+#   define	ALLOCTABLE(z)	((NXHashTable *) malloc_zone_malloc ((malloc_zone_t *)z,sizeof (NXHashTable)))
+#   define	ALLOCFLAT(z,nb)	((FlatBuckets *) malloc_zone_calloc ((malloc_zone_t *)z, 1, FLAT_SIZE(nb)))
+#endif
+
+static FlatBuckets *flatAllocBuckets (void *z, unsigned nb) {
+    FlatBuckets	*buckets = ALLOCFLAT(z, nb);
+    memset (FLAT_CTRL(buckets, nb), FLAT_EMPTY, nb);
+    return buckets;
+    }
+
+static unsigned flatGoodCapacity (unsigned c) {
+    unsigned	nb = FLAT_GROUP;
+    while (FLAT_MAX_LOAD(nb) < c) nb *= 2;
+    return nb;
+    }
+
+#define ALLOCBUCKETS(z,nb)	flatAllocBuckets(z, nb)
+#define GOOD_CAPACITY(c)	flatGoodCapacity(c)
+#define MORE_CAPACITY(b)	(b*2)
+
+/* Prototype hashes such as NXPtrHash leave the low bits of aligned 
+   pointers constant.  Spread every bit of the hash into the low bits 
+   used for the tag and the group index. */
+static inline uintptr_t flatMix (uintptr_t h) {
+#if __LP64__
+    h *= 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+#else
+    h *= 0x9E3779B9U;
+    return h ^ (h >> 16);
+#endif
+    }
+
+#define FLAT_HASH(table, data)	flatMix((*table->prototype->hash)(table->info, data))
+#define FLAT_TAG(h)		((uint8_t)((h) & 0x7F))
+#define FLAT_GROUPOF(h)		((h) >> 7)
+
+/* bit i set iff group[i] == c */
+static inline unsigned flatMatch (const uint8_t *group, uint8_t c) {
+#if __SSE2__
+    __m128i	ctrl = _mm_loadu_si128 ((const __m128i *)group);
+    return (unsigned)_mm_movemask_epi8 (_mm_cmpeq_epi8 (ctrl, _mm_set1_epi8 ((char)c)));
+#else
+    unsigned	mask = 0;
+    for (unsigned i = 0; i < FLAT_GROUP; i++) 
+	if (group[i] == c) mask |= 1U << i;
+    return mask;
+#endif
+    }
+
+/* bit i set iff group[i] is EMPTY or DELETED */
+static inline unsigned flatMatchAvailable (const uint8_t *group) {
+#if __SSE2__
+    return (unsigned)_mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *)group));
+#else
+    unsigned	mask = 0;
+    for (unsigned i = 0; i < FLAT_GROUP; i++) 
+	if (! FLAT_ISFULL(group[i])) mask |= 1U << i;
+    return mask;
+#endif
+    }
+
+#endif
+
 #define ISEQUAL(table, data1, data2) ((data1 == data2) || (*table->prototype->isEqual)(table->info, data1, data2))
 	/* beware of double evaluation */
-	
+
+#if SUPPORT_FLAT_HASHTABLE
+
+/* Returns the slot holding data, or NULL.
+   Groups are probed triangularly, which visits every group once
+   because the number of groups is a power of 2. */
+static const void **flatFind (NXHashTable *table, const void *data, uintptr_t h) {
+    const void	**slots = FLAT_SLOTS(table->buckets);
+    uint8_t	*ctrl = FLAT_CTRL(table->buckets, table->nbBuckets);
+    unsigned	groupMask = table->nbBuckets / FLAT_GROUP - 1;
+    unsigned	g = FLAT_GROUPOF(h) & groupMask;
+    uint8_t	tag = FLAT_TAG(h);
+    unsigned	probe;
+    
+    for (probe = 1; probe <= groupMask + 1; probe++) {
+	const uint8_t	*group = ctrl + g * FLAT_GROUP;
+	unsigned	mask;
+	for (mask = flatMatch (group, tag); mask; mask &= mask - 1) {
+	    const void	**slot = slots + g * FLAT_GROUP + __builtin_ctz (mask);
+	    if (ISEQUAL(table, data, *slot)) return slot;
+	    };
+	if (flatMatch (group, FLAT_EMPTY)) return NULL;
+	g = (g + probe) & groupMask;
+	};
+    return NULL;
+    }
+
+/* Stores data, known to be absent, in the first EMPTY or DELETED slot 
+   of its probe sequence.  Caller guarantees there is room. */
+static void flatInsertNew (NXHashTable *table, const void *data, uintptr_t h) {
+    FlatBuckets	*buckets = (FlatBuckets *) table->buckets;
+    uint8_t	*ctrl = FLAT_CTRL(buckets, table->nbBuckets);
+    unsigned	groupMask = table->nbBuckets / FLAT_GROUP - 1;
+    unsigned	g = FLAT_GROUPOF(h) & groupMask;
+    unsigned	probe, mask, i;
+    
+    for (probe = 1; ! (mask = flatMatchAvailable (ctrl + g * FLAT_GROUP)); probe++)
+	g = (g + probe) & groupMask;
+    i = g * FLAT_GROUP + __builtin_ctz (mask);
+    if (ctrl[i] == FLAT_DELETED) buckets->tombstones--;
+    ctrl[i] = FLAT_TAG(h);
+    FLAT_SLOTS(buckets)[i] = data;
+    table->count++;
+    }
+
+#endif
+
 /*************************************************************************
  *
  *	Global data and bootstrap
@@ -115,12 +270,20 @@ static void bootstrap (void) {
     free(malloc(8));
     prototypes = ALLOCTABLE (DEFAULT_ZONE);
     prototypes->prototype = &protoPrototype; 
+#if !SUPPORT_FLAT_HASHTABLE
     prototypes->count = 1;
     prototypes->nbBuckets = 1; /* has to be 1 so that the right bucket is 0 */
     prototypes->buckets = ALLOCBUCKETS(DEFAULT_ZONE, 1);
     prototypes->info = NULL;
     ((HashBucket *) prototypes->buckets)[0].count = 1;
     ((HashBucket *) prototypes->buckets)[0].elements.one = &protoPrototype;
+#else
+    prototypes->count = 0;
+    prototypes->nbBuckets = FLAT_GROUP;
+    prototypes->buckets = ALLOCBUCKETS(DEFAULT_ZONE, FLAT_GROUP);
+    prototypes->info = NULL;
+    flatInsertNew (prototypes, &protoPrototype, FLAT_HASH(prototypes, &protoPrototype));
+#endif
     };
 
 int NXPtrIsEqual (const void *info, const void *data1, const void *data2) {
@@ -168,6 +331,8 @@ NXHashTable *NXCreateHashTableFromZone (NXHashTablePrototype prototype, unsigned
     return table;
     }
 
+#if !SUPPORT_FLAT_HASHTABLE
+
 static void freeBucketPairs (void (*freeProc)(const void *info, void *data), HashBucket bucket, const void *info) {
     unsigned	j = bucket.count;
     const void	**pairs;
@@ -197,6 +362,25 @@ static void freeBuckets (NXHashTable *table, int freeObjects) {
 	buckets++;
 	};
     };
+
+#else
+
+static void freeBuckets (NXHashTable *table, int freeObjects) {
+    FlatBuckets		*buckets = (FlatBuckets *) table->buckets;
+    const void		**slots = FLAT_SLOTS(buckets);
+    uint8_t		*ctrl = FLAT_CTRL(buckets, table->nbBuckets);
+    unsigned		i;
+    
+    if (freeObjects) {
+	for (i = 0; i < table->nbBuckets; i++) {
+	    if (FLAT_ISFULL(ctrl[i])) (*table->prototype->free) (table->info, (void *) slots[i]);
+	    };
+	};
+    memset (ctrl, FLAT_EMPTY, table->nbBuckets);
+    buckets->tombstones = 0;
+    };
+
+#endif
     
 void NXFreeHashTable (NXHashTable *table) {
     freeBuckets (table, YES);
@@ -248,6 +432,8 @@ unsigned NXCountHashTable (NXHashTable *table) {
     return table->count;//直接返回 NXHashTable 结构体中的 count
     }
 
+#if !SUPPORT_FLAT_HASHTABLE
+
 //返回一个布尔值：判断当前的 NXHashTable 中是否包含传入的数据
 int NXHashMember (NXHashTable *table, const void *data) {
     //使用 BUCKETOF 对 data 进行 hash，将结果与哈希表的 buckets 数取模，返回 buckets 数组中对应的 NXHashBucket。
@@ -295,6 +481,19 @@ void *NXHashGet (NXHashTable *table, const void *data) {
     return NULL;
     }
 
+#else
+
+int NXHashMember (NXHashTable *table, const void *data) {
+    return flatFind (table, data, FLAT_HASH(table, data)) != NULL;
+    }
+
+void *NXHashGet (NXHashTable *table, const void *data) {
+    const void	**slot = flatFind (table, data, FLAT_HASH(table, data));
+    return slot ? (void *) *slot : NULL;
+    }
+
+#endif
+
 unsigned _NXHashCapacity (NXHashTable *table) {
     return table->nbBuckets;
     }
@@ -313,6 +512,14 @@ void _NXHashRehashToCapacity (NXHashTable *table, unsigned newCapacity) {
     void	*aux;
     __unused void *z = ZONE_FROM_PTR(table);
     
+#if SUPPORT_FLAT_HASHTABLE
+    /* the flat layout needs a power of 2 with room for one more element */
+    {
+	unsigned	nb = FLAT_GROUP;
+	while (nb < newCapacity  ||  FLAT_MAX_LOAD(nb) <= table->count) nb *= 2;
+	newCapacity = nb;
+    }
+#endif
     old = ALLOCTABLE(z);
     old->prototype = table->prototype; old->count = table->count; 
     old->nbBuckets = table->nbBuckets; old->buckets = table->buckets;
@@ -330,11 +537,20 @@ void _NXHashRehashToCapacity (NXHashTable *table, unsigned newCapacity) {
 
 //如果哈希表在添加元素后，其中的数据多于 buckets 数量，就会对 NXHashTable 进行 _NXHashRehash 操作。
 static void _NXHashRehash (NXHashTable *table) {
+#if SUPPORT_FLAT_HASHTABLE
+    /* Mostly tombstones: rehash in place instead of growing. */
+    if (table->count < FLAT_MAX_LOAD(table->nbBuckets) / 2) {
+	_NXHashRehashToCapacity (table, table->count);
+	return;
+	};
+#endif
     //它调用 _NXHashRehashToCapacity 方法来扩大 NXHashTable 的容量（HashBucket 的个数）。
     //MORE_CAPACITY 会将当前哈希表的容量翻倍，并将新的容量传入 _NXHashRehashToCapacity 中
     _NXHashRehashToCapacity (table, MORE_CAPACITY(table->nbBuckets));
     }
 
+#if !SUPPORT_FLAT_HASHTABLE
+
 //向table表中插入数据
 void *NXHashInsert (NXHashTable *table, const void *data) {
     //使用 BUCKETOF 对 data 进行 hash，将结果与哈希表的 buckets 数取模，返回 buckets 数组中对应的 NXHashBucket。
@@ -509,6 +725,87 @@ int NXNextHashState (NXHashTable *table, NXHashState *state, void **data) {
     return YES;
     };
 
+#else
+
+/* Grows or cleans the table so one more element can be stored. */
+static void flatReserveOne (NXHashTable *table) {
+    FlatBuckets	*buckets = (FlatBuckets *) table->buckets;
+    if (table->count + buckets->tombstones >= FLAT_MAX_LOAD(table->nbBuckets))
+	_NXHashRehash (table);
+    }
+
+void *NXHashInsert (NXHashTable *table, const void *data) {
+    uintptr_t	h = FLAT_HASH(table, data);
+    const void	**slot = flatFind (table, data, h);
+    
+    if (slot) {
+	const void	*old = *slot;
+	*slot = data;
+	return (void *) old;
+	};
+    flatReserveOne (table);
+    flatInsertNew (table, data, h);
+    return NULL;
+    }
+
+void *NXHashInsertIfAbsent (NXHashTable *table, const void *data) {
+    uintptr_t	h = FLAT_HASH(table, data);
+    const void	**slot = flatFind (table, data, h);
+    
+    if (slot) return (void *) *slot;
+    flatReserveOne (table);
+    flatInsertNew (table, data, h);
+    return (void *) data;
+    }
+
+void *NXHashRemove (NXHashTable *table, const void *data) {
+    FlatBuckets	*buckets = (FlatBuckets *) table->buckets;
+    const void	**slots = FLAT_SLOTS(buckets);
+    uint8_t	*ctrl = FLAT_CTRL(buckets, table->nbBuckets);
+    const void	**slot = flatFind (table, data, FLAT_HASH(table, data));
+    unsigned	i;
+    
+    if (! slot) return NULL;
+    data = *slot;
+    i = (unsigned)(slot - slots);
+    /* A group that already has an EMPTY slot ends every probe sequence 
+       reaching it, so the slot can become EMPTY instead of DELETED. */
+    if (flatMatch (ctrl + (i & ~(FLAT_GROUP - 1)), FLAT_EMPTY)) {
+	ctrl[i] = FLAT_EMPTY;
+    } else {
+	ctrl[i] = FLAT_DELETED;
+	buckets->tombstones++;
+	};
+    *slot = NULL;
+    table->count--;
+    return (void *) data;
+    }
+
+/* state.i counts down the slots; state.j is unused */
+NXHashState NXInitHashState (NXHashTable *table) {
+    NXHashState	state;
+    
+    state.i = table->nbBuckets;
+    state.j = 0;
+    return state;
+    };
+
+int NXNextHashState (NXHashTable *table, NXHashState *state, void **data) {
+    const void	**slots = FLAT_SLOTS(table->buckets);
+    uint8_t	*ctrl = FLAT_CTRL(table->buckets, table->nbBuckets);
+    
+    while (state->i > 0) {
+	state->i--;
+	if (FLAT_ISFULL(ctrl[state->i])) {
+	    *data = (void *) slots[state->i];
+	    return YES;
+	    };
+	};
+    return NO;
+    };
+
+#endif
+
 /*************************************************************************
  *
  *	Conveniences
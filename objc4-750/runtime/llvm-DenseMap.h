@@ -29,6 +29,9 @@
 #include <cstddef>
 #include <cstring>
 #include <TargetConditionals.h>
+#if __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "objc-private.h"
 
@@ -86,6 +89,7 @@ public:
 
   bool empty() const { return getNumEntries() == 0; }
   unsigned size() const { return getNumEntries(); }
+  unsigned capacity() const { return getNumBuckets(); }
 
   /// Grow the densemap so that it has at least Size buckets. Does not shrink
   void resize(size_t Size) {
@@ -200,6 +204,30 @@ public:
     }
   }
 
+  // Rehash away tombstones (and purgeable zeros) and shrink to 
+  // at most half full, whatever the table's size.
+  // Returns the number of bytes released.
+  size_t shrink_to_fit() {
+    size_t OldSize = getMemorySize();
+    if (getNumEntries() == 0) {
+      shrink_and_clear();
+    }
+    else if (getNumTombstones() > 0  ||  
+             std::max<unsigned>(MIN_BUCKETS, NextPowerOf2(getNumEntries() * 2)) < getNumBuckets())
+    {
+      grow(getNumEntries() * 2);
+    }
+    return OldSize - getMemorySize();
+  }
+
+  // True if fewer than 1/8 of the buckets are live 
+  // or more than 1/4 are tombstones.
+  bool isSparse() const {
+    return getNumBuckets() > MIN_BUCKETS  &&  
+      (getNumEntries() * 8 < getNumBuckets()  ||  
+       getNumTombstones() * 4 > getNumBuckets());
+  }
+
   bool erase(const KeyT &Val) {
     BucketT *TheBucket;
     if (!LookupBucketFor(Val, TheBucket))
@@ -1027,6 +1055,389 @@ private:
   }
 };
 
+// GroupProbedDenseMap is an alternative to DenseMap for tables whose 
+// lookups are dominated by probing, such as the refcount table.
+// Each bucket has a control byte holding Empty, Deleted, or the top 
+// 7 bits of the key's hash. Lookups match a whole group of control 
+// bytes at once (with SSE2 when available) and only compare keys 
+// whose tag matches. Groups are probed triangularly.
+// Unused buckets still hold the empty or tombstone key so 
+// DenseMapIterator works unchanged.
+// ZeroValuesArePurgeable has the same meaning as in DenseMapBase,
+// except that zero values are only purged when rehashing.
+
+template<typename KeyT, typename ValueT,
+         bool ZeroValuesArePurgeable = false, 
+         typename KeyInfoT = DenseMapInfo<KeyT> >
+class GroupProbedDenseMap {
+  typedef std::pair<KeyT, ValueT> BucketT;
+
+  enum : uint8_t { CtrlEmpty = 0x80, CtrlDeleted = 0xFE };
+  enum : unsigned { GroupSize = 16 };
+
+  // One allocation: NumBuckets buckets followed by NumBuckets control bytes.
+  BucketT *Buckets;
+  uint8_t *Ctrl;
+  unsigned NumEntries;
+  unsigned NumTombstones;
+  unsigned NumBuckets;
+
+  GroupProbedDenseMap(const GroupProbedDenseMap &) = delete;
+  GroupProbedDenseMap& operator=(const GroupProbedDenseMap &) = delete;
+
+public:
+  typedef KeyT key_type;
+  typedef ValueT mapped_type;
+  typedef BucketT value_type;
+
+  typedef DenseMapIterator<KeyT, ValueT, KeyInfoT> iterator;
+  typedef DenseMapIterator<KeyT, ValueT,
+                           KeyInfoT, true> const_iterator;
+
+  explicit GroupProbedDenseMap(unsigned NumInitBuckets = 0) {
+    init(NumInitBuckets);
+  }
+
+  ~GroupProbedDenseMap() {
+    destroyAll();
+    operator delete(Buckets);
+  }
+
+  inline iterator begin() {
+    return empty() ? end() : iterator(Buckets, getBucketsEnd());
+  }
+  inline iterator end() {
+    return iterator(getBucketsEnd(), getBucketsEnd(), true);
+  }
+  inline const_iterator begin() const {
+    return empty() ? end() : const_iterator(Buckets, getBucketsEnd());
+  }
+  inline const_iterator end() const {
+    return const_iterator(getBucketsEnd(), getBucketsEnd(), true);
+  }
+
+  bool empty() const { return NumEntries == 0; }
+  unsigned size() const { return NumEntries; }
+  unsigned capacity() const { return NumBuckets; }
+
+  /// Grow the map so that it has at least Size buckets. Does not shrink
+  void resize(size_t Size) {
+    if (Size > NumBuckets)
+      grow(Size);
+  }
+
+  void clear() {
+    if (NumEntries == 0 && NumTombstones == 0) return;
+
+    // If the capacity of the array is huge, and the # elements used is small,
+    // shrink the array.
+    if (NumEntries * 4 < NumBuckets && NumBuckets > GroupSize) {
+      shrink_and_clear();
+      return;
+    }
+
+    destroyAll();
+    initEmpty();
+  }
+
+  bool count(const KeyT &Val) const {
+    return LookupBucket(Val) != 0;
+  }
+
+  iterator find(const KeyT &Val) {
+    BucketT *TheBucket = LookupBucket(Val);
+    if (TheBucket)
+      return iterator(TheBucket, getBucketsEnd(), true);
+    return end();
+  }
+  const_iterator find(const KeyT &Val) const {
+    const BucketT *TheBucket = LookupBucket(Val);
+    if (TheBucket)
+      return const_iterator(TheBucket, getBucketsEnd(), true);
+    return end();
+  }
+
+  ValueT lookup(const KeyT &Val) const {
+    const BucketT *TheBucket = LookupBucket(Val);
+    if (TheBucket)
+      return TheBucket->second;
+    return ValueT();
+  }
+
+  // Inserts key,value pair into the map if the key isn't already in the map.
+  // If the key is already in the map, it returns false and doesn't update the
+  // value.
+  std::pair<iterator, bool> insert(const std::pair<KeyT, ValueT> &KV) {
+    BucketT *TheBucket = LookupBucket(KV.first);
+    if (TheBucket)
+      return std::make_pair(iterator(TheBucket, getBucketsEnd(), true),
+                            false); // Already in map.
+
+    TheBucket = InsertIntoBucket(KV.first, KV.second);
+    return std::make_pair(iterator(TheBucket, getBucketsEnd(), true), true);
+  }
+
+  // Clear if empty.
+  // Shrink if at least 15/16 empty and larger than MIN_COMPACT.
+  void compact() {
+    if (NumEntries == 0) {
+      shrink_and_clear();
+    } 
+    else if (NumBuckets / 16 > NumEntries  &&  NumBuckets > MIN_COMPACT) {
+      grow(NumEntries * 2);
+    }
+  }
+
+  // Rehash away tombstones (and purgeable zeros) and shrink to 
+  // at most half full, whatever the table's size.
+  // Returns the number of bytes released.
+  size_t shrink_to_fit() {
+    size_t OldSize = getMemorySize();
+    if (NumEntries == 0) {
+      shrink_and_clear();
+    }
+    else if (NumTombstones > 0  ||  
+             BucketsFor(NumEntries * 2, NumEntries) < NumBuckets) 
+    {
+      grow(NumEntries * 2);
+    }
+    return OldSize - getMemorySize();
+  }
+
+  // True if fewer than 1/8 of the buckets are live 
+  // or more than 1/4 are tombstones.
+  bool isSparse() const {
+    return NumBuckets > GroupSize  &&  
+      (NumEntries * 8 < NumBuckets  ||  NumTombstones * 4 > NumBuckets);
+  }
+
+  bool erase(const KeyT &Val) {
+    BucketT *TheBucket = LookupBucket(Val);
+    if (!TheBucket)
+      return false; // not in map.
+
+    EraseBucket(TheBucket);
+    compact();
+    return true;
+  }
+  void erase(iterator I) {
+    EraseBucket(&*I);
+    compact();
+  }
+
+  value_type& FindAndConstruct(const KeyT &Key) {
+    BucketT *TheBucket = LookupBucket(Key);
+    if (TheBucket)
+      return *TheBucket;
+
+    return *InsertIntoBucket(Key, ValueT());
+  }
+
+  ValueT &operator[](const KeyT &Key) {
+    return FindAndConstruct(Key).second;
+  }
+
+  // Rehash into the smallest power of two buckets that holds AtLeast 
+  // buckets and every current entry. This also discards tombstones.
+  void grow(unsigned AtLeast) {
+    unsigned OldNumBuckets = NumBuckets;
+    BucketT *OldBuckets = Buckets;
+    uint8_t *OldCtrl = Ctrl;
+
+    allocateBuckets(BucketsFor(AtLeast, NumEntries));
+    initEmpty();
+    if (!OldBuckets) return;
+
+    for (unsigned i = 0; i < OldNumBuckets; i++) {
+      BucketT *B = OldBuckets + i;
+      if (IsFull(OldCtrl[i]) && 
+          !(ZeroValuesArePurgeable && B->second == 0)) 
+      {
+        BucketT *DestBucket = InsertNew(B->first);
+        new (&DestBucket->first) KeyT(llvm_move(B->first));
+        new (&DestBucket->second) ValueT(llvm_move(B->second));
+        B->second.~ValueT();
+      } else if (IsFull(OldCtrl[i])) {
+        B->second.~ValueT();
+      }
+      B->first.~KeyT();
+    }
+
+    operator delete(OldBuckets);
+  }
+
+  void shrink_and_clear() {
+    destroyAll();
+    operator delete(Buckets);
+    init(0);
+  }
+
+  /// Return the approximate size (in bytes) of the actual map.
+  /// This is just the raw memory used by the map.
+  /// If entries are pointers to objects, the size of the referenced objects
+  /// are not included.
+  size_t getMemorySize() const {
+    return NumBuckets * (sizeof(BucketT) + 1);
+  }
+
+private:
+  static bool IsFull(uint8_t C) { return (C & 0x80) == 0; }
+  static uint8_t TagOf(unsigned Hash) { return (uint8_t)(Hash >> 25); }
+  static unsigned MaxLoad(unsigned Num) { return Num - Num / 8; }
+
+  // Smallest power of two that is at least AtLeast and 
+  // has room for one more than Entries.
+  static unsigned BucketsFor(unsigned AtLeast, unsigned Entries) {
+    unsigned Num = GroupSize;
+    while (Num < AtLeast  ||  MaxLoad(Num) <= Entries) Num *= 2;
+    return Num;
+  }
+
+  BucketT *getBucketsEnd() const { return Buckets + NumBuckets; }
+
+  // Bit i is set iff Group[i] == C.
+  static unsigned MatchByte(const uint8_t *Group, uint8_t C) {
+#if __SSE2__
+    __m128i G = _mm_loadu_si128((const __m128i *)Group);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(G, _mm_set1_epi8((char)C)));
+#else
+    unsigned Mask = 0;
+    for (unsigned i = 0; i < GroupSize; i++)
+      if (Group[i] == C) Mask |= 1U << i;
+    return Mask;
+#endif
+  }
+
+  // Bit i is set iff Group[i] is Empty or Deleted.
+  static unsigned MatchAvailable(const uint8_t *Group) {
+#if __SSE2__
+    return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)Group));
+#else
+    unsigned Mask = 0;
+    for (unsigned i = 0; i < GroupSize; i++)
+      if (!IsFull(Group[i])) Mask |= 1U << i;
+    return Mask;
+#endif
+  }
+
+  BucketT *LookupBucket(const KeyT &Val) const {
+    if (NumBuckets == 0) return 0;
+
+    assert(!KeyInfoT::isEqual(Val, KeyInfoT::getEmptyKey()) &&
+           !KeyInfoT::isEqual(Val, KeyInfoT::getTombstoneKey()) &&
+           "Empty/Tombstone value shouldn't be inserted into map!");
+
+    unsigned Hash = KeyInfoT::getHashValue(Val);
+    uint8_t Tag = TagOf(Hash);
+    unsigned GroupMask = NumBuckets / GroupSize - 1;
+    unsigned GroupNo = Hash & GroupMask;
+    for (unsigned ProbeAmt = 1; ProbeAmt <= GroupMask + 1; ProbeAmt++) {
+      const uint8_t *Group = Ctrl + GroupNo * GroupSize;
+      for (unsigned Mask = MatchByte(Group, Tag); Mask; Mask &= Mask - 1) {
+        BucketT *B = Buckets + GroupNo * GroupSize + __builtin_ctz(Mask);
+        if (KeyInfoT::isEqual(Val, B->first)) return B;
+      }
+      if (MatchByte(Group, CtrlEmpty)) return 0;
+      GroupNo = (GroupNo + ProbeAmt) & GroupMask;
+    }
+    return 0;
+  }
+
+  // Claim the first Empty or Deleted bucket on Key's probe sequence.
+  // The caller constructs the key and value.
+  BucketT *InsertNew(const KeyT &Key) {
+    unsigned Hash = KeyInfoT::getHashValue(Key);
+    unsigned GroupMask = NumBuckets / GroupSize - 1;
+    unsigned GroupNo = Hash & GroupMask;
+    unsigned Mask;
+    for (unsigned ProbeAmt = 1; 
+         !(Mask = MatchAvailable(Ctrl + GroupNo * GroupSize)); 
+         ProbeAmt++)
+    {
+      if (ProbeAmt > GroupMask) {
+        // No available buckets in table. Die.
+        _objc_fatal("Hash table corrupted. This is probably a memory error "
+                    "somewhere. (table at %p, buckets at %p (%zu bytes), "
+                    "%u buckets, %u entries, %u tombstones)", 
+                    this, Buckets, malloc_size(Buckets), 
+                    NumBuckets, NumEntries, NumTombstones);
+      }
+      GroupNo = (GroupNo + ProbeAmt) & GroupMask;
+    }
+
+    unsigned i = GroupNo * GroupSize + __builtin_ctz(Mask);
+    if (Ctrl[i] == CtrlDeleted) NumTombstones--;
+    Ctrl[i] = TagOf(Hash);
+    NumEntries++;
+    BucketT *B = Buckets + i;
+    B->first.~KeyT();
+    return B;
+  }
+
+  BucketT *InsertIntoBucket(const KeyT &Key, const ValueT &Value) {
+    // If more than 7/8 of the buckets are full or deleted, grow the table.
+    // If most of those are tombstones, rehash without growing.
+    if (NumEntries + NumTombstones + 1 > MaxLoad(NumBuckets)) {
+      if (NumEntries + 1 <= MaxLoad(NumBuckets) / 2) grow(NumBuckets);
+      else grow(NumBuckets * 2);
+    }
+
+    BucketT *TheBucket = InsertNew(Key);
+    new (&TheBucket->first) KeyT(Key);
+    new (&TheBucket->second) ValueT(Value);
+    return TheBucket;
+  }
+
+  void EraseBucket(BucketT *TheBucket) {
+    unsigned i = (unsigned)(TheBucket - Buckets);
+    TheBucket->second.~ValueT();
+    // A group that already has an empty bucket ends every probe 
+    // sequence reaching it, so the bucket can become empty instead 
+    // of a tombstone.
+    if (MatchByte(Ctrl + (i & ~(GroupSize - 1)), CtrlEmpty)) {
+      Ctrl[i] = CtrlEmpty;
+      TheBucket->first = KeyInfoT::getEmptyKey();
+    } else {
+      Ctrl[i] = CtrlDeleted;
+      TheBucket->first = KeyInfoT::getTombstoneKey();
+      NumTombstones++;
+    }
+    NumEntries--;
+  }
+
+  void init(unsigned InitBuckets) {
+    Buckets = 0;
+    Ctrl = 0;
+    NumBuckets = 0;
+    NumEntries = 0;
+    NumTombstones = 0;
+    if (InitBuckets) grow(InitBuckets);
+  }
+
+  void initEmpty() {
+    NumEntries = 0;
+    NumTombstones = 0;
+    memset(Ctrl, CtrlEmpty, NumBuckets);
+    const KeyT EmptyKey = KeyInfoT::getEmptyKey();
+    for (BucketT *B = Buckets, *E = getBucketsEnd(); B != E; ++B)
+      new (&B->first) KeyT(EmptyKey);
+  }
+
+  void destroyAll() {
+    for (unsigned i = 0; i < NumBuckets; i++) {
+      if (IsFull(Ctrl[i])) Buckets[i].second.~ValueT();
+      Buckets[i].first.~KeyT();
+    }
+  }
+
+  void allocateBuckets(unsigned Num) {
+    NumBuckets = Num;
+    Buckets = static_cast<BucketT*>
+      (operator new(sizeof(BucketT)*NumBuckets + NumBuckets));
+    Ctrl = (uint8_t *)(Buckets + NumBuckets);
+  }
+};
+
 template<typename KeyT, typename ValueT,
          typename KeyInfoT, bool IsConst>
 class DenseMapIterator {
@@ -23,10 +23,12 @@
 
 #include <string.h>
 #include <stddef.h>
+#include <atomic>
 
 #include <libkern/OSAtomic.h>
 
 #include "objc-private.h"
+#include "objc-hazard.h"
 #include "runtime.h"
 
 // stub interface declarations to make compiler happy.
@@ -55,10 +57,29 @@ id objc_getProperty(id self, SEL _cmd, ptrdiff_t offset, BOOL atomic) {
     if (!atomic) return *slot;
         
     // Atomic retain release world
+#if SUPPORT_OBJECT_HAZARDS
+    // Lock-free for default-RR values. Any other value is retained 
+    // under the lock, since a -retain override could reenter a getter 
+    // while this thread's hazard is in use.
+    ObjectHazard *hazard = objectHazardForThread();
+    id value = (id)objectHazardAcquire(hazard, slot);
+    if (value  &&  !value->isTaggedPointer()) {
+        bool retained = 
+            !value->ISA()->hasCustomRR()  &&  value->rootTryRetainFast();
+        objectHazardRelease(hazard);
+        if (!retained) {
+            spinlock_t& slotlock = PropertyLocks[slot];
+            slotlock.lock();
+            value = objc_retain(*slot);
+            slotlock.unlock();
+        }
+    }
+#else
     spinlock_t& slotlock = PropertyLocks[slot];
     slotlock.lock();
     id value = objc_retain(*slot);
     slotlock.unlock();
+#endif
     
     // for performance, we (safely) issue the autorelease OUTSIDE of the spinlock.
     return objc_autoreleaseReturnValue(value);
@@ -92,9 +113,12 @@ static inline void reallySetProperty(id self, SEL _cmd, id newValue, ptrdiff_t o
     } else {
         spinlock_t& slotlock = PropertyLocks[slot];
         slotlock.lock();
-        oldValue = *slot;
-        *slot = newValue;        
+        oldValue = __atomic_exchange_n(slot, newValue, __ATOMIC_SEQ_CST);
         slotlock.unlock();
+#if SUPPORT_OBJECT_HAZARDS
+        // Lock-free getters may still be retaining oldValue.
+        objectHazardsWait(oldValue);
+#endif
     }
 
     objc_release(oldValue);
@@ -129,23 +153,82 @@ void objc_setProperty_nonatomic_copy(id self, SEL _cmd, id newValue, ptrdiff_t o
 }
 
 
+// Sequence counts for atomic struct copies, striped like StructLocks. 
+// A count is odd while a copy into an address of its stripe is 
+// in progress, and only the holder of that stripe's lock changes it.
+static StripedMap<std::atomic<uintptr_t>> StructSequences;
+
+// Writes dest while holding dest's StructLocks stripe. 
+// The stripe's sequence count is odd for the duration.
+static void copyStructLocked(void *dest, const void *src, ptrdiff_t size)
+{
+    std::atomic<uintptr_t>& seq = StructSequences[dest];
+    uintptr_t count = seq.load(std::memory_order_relaxed);
+    seq.store(count + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memmove(dest, src, size);
+    seq.store(count + 2, std::memory_order_release);
+}
+
+// Structs up to StructSequencedMaxSize use a seqlock, whatever their 
+// alignment, since every write to src goes through copyStructLocked().
+// src is first copied to a buffer without taking any lock, and the 
+// copy is retried if src's stripe count moved, so readers never wait 
+// for each other. A reader that keeps losing to writers takes src's 
+// lock instead. Only then is dest's lock taken to store the buffer. 
+// No lock is held while waiting for another, so two copies cannot 
+// wait on each other.
+enum { StructSequencedMaxSize = 128, StructSequencedMaxRetries = 16 };
+
+static void copyStructSequenced(void *dest, const void *src, ptrdiff_t size)
+{
+    uint8_t buffer[StructSequencedMaxSize] __attribute__((aligned(16)));
+    std::atomic<uintptr_t>& srcSeq = StructSequences[src];
+    for (unsigned int attempt = 0; ; attempt++) {
+        if (attempt == StructSequencedMaxRetries) {
+            spinlock_t& srcLock = StructLocks[src];
+            srcLock.lock();
+            memcpy(buffer, src, size);
+            srcLock.unlock();
+            break;
+        }
+        uintptr_t before = srcSeq.load(std::memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(buffer, src, size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (srcSeq.load(std::memory_order_relaxed) == before) break;
+    }
+
+    spinlock_t& dstLock = StructLocks[dest];
+    dstLock.lock();
+    copyStructLocked(dest, buffer, size);
+    dstLock.unlock();
+}
+
 // This entry point was designed wrong.  When used as a getter, src needs to be locked so that
 // if simultaneously used for a setter then there would be contention on src.
 // So we need two locks - one of which will be contended.
+// Small structs avoid that: they are read under src's sequence count, 
+// and only lock dest.
 void objc_copyStruct(void *dest, const void *src, ptrdiff_t size, BOOL atomic, BOOL hasStrong __unused) {
-    spinlock_t *srcLock = nil;
-    spinlock_t *dstLock = nil;
-    if (atomic) {
-        srcLock = &StructLocks[src];
-        dstLock = &StructLocks[dest];
-        spinlock_t::lockTwo(srcLock, dstLock);
+    if (!atomic) {
+        memmove(dest, src, size);
+        return;
     }
 
-    memmove(dest, src, size);
-
-    if (atomic) {
-        spinlock_t::unlockTwo(srcLock, dstLock);
+    if (size <= StructSequencedMaxSize) {
+        copyStructSequenced(dest, src, size);
+        return;
     }
+
+    spinlock_t *srcLock = &StructLocks[src];
+    spinlock_t *dstLock = &StructLocks[dest];
+    spinlock_t::lockTwo(srcLock, dstLock);
+    copyStructLocked(dest, src, size);
+    spinlock_t::unlockTwo(srcLock, dstLock);
 }
 
 void objc_copyCppObjectAtomic(void *dest, const void *src, void (*copyHelper) (void *dest, const void *source)) {
@@ -62,6 +62,24 @@
 #   define SUPPORT_MOD 1
 #endif
 
+// Define SUPPORT_FLAT_HASHTABLE=1 to store NXHashTable elements in one
+// open-addressed array instead of chained HashBuckets.
+// The old ABI's debuggers walk class_hash's HashBuckets directly.
+#if !__OBJC2__
+#   define SUPPORT_FLAT_HASHTABLE 0
+#else
+#   define SUPPORT_FLAT_HASHTABLE 1
+#endif
+
+// Define SUPPORT_GROUP_PROBED_REFCOUNTS=1 to store side table retain counts
+// in a GroupProbedDenseMap instead of a DenseMap.
+// Its group probing only pays off with SIMD control byte matching.
+#if !__SSE2__
+#   define SUPPORT_GROUP_PROBED_REFCOUNTS 0
+#else
+#   define SUPPORT_GROUP_PROBED_REFCOUNTS 1
+#endif
+
 // 定义 SUPPORT_PREOPT=1 以启用 dyld 共享缓存优化
 #if TARGET_OS_WIN32  ||  TARGET_OS_SIMULATOR
 #   define SUPPORT_PREOPT 0
@@ -113,6 +131,34 @@
 #   define SUPPORT_NONPOINTER_ISA 1
 #endif
 
+// Define SUPPORT_BIASED_REFCOUNTS=1 to allow OBJC_BIASED_REFCOUNTS, 
+// which lets each thread buffer its own releases of nonpointer-isa objects.
+// It reads the inline retain count, so it requires nonpointer isa.
+#if !SUPPORT_NONPOINTER_ISA
+#   define SUPPORT_BIASED_REFCOUNTS 0
+#else
+#   define SUPPORT_BIASED_REFCOUNTS 1
+#endif
+
+// Define SUPPORT_THIN_SYNC=1 to let @synchronized find an object's 
+// SyncData without the stripe lock, through one record per stripe 
+// whose owning object and user count share a word.
+// The word packs a pointer with a count, so this requires LP64.
+#if !__LP64__
+#   define SUPPORT_THIN_SYNC 0
+#else
+#   define SUPPORT_THIN_SYNC 1
+#endif
+
+// Define SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS=1 to record repeated 
+// autoreleases of the same object in one autorelease pool entry.
+// The repeat count is packed above the pointer, so this requires LP64.
+#if !(__OBJC2__  &&  __LP64__)
+#   define SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS 0
+#else
+#   define SUPPORT_AUTORELEASEPOOL_DEDUP_PTRS 1
+#endif
+
 // Define SUPPORT_FIXUP=1 to repair calls sites for fixup dispatch.
 // Fixup messaging itself is no longer supported.
 // Be sure to edit objc-abi.h as well (objc_msgSend*_fixup)
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2018 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ *	objc-elf-return.h
+ *	Optimized return caller check for x86_64 ELF.
+ *	Included by objc-object.h, and by test/elf-return, which 
+ *	runs it against callers linked every way the linker allows.
+ *	Needs ALWAYS_INLINE, the unaligned_*_t types, and the 
+ *	declarations of the two optimized return callees.
+ */
+
+#ifndef _OBJC_ELF_RETURN_H_
+#define _OBJC_ELF_RETURN_H_
+
+static ALWAYS_INLINE bool 
+isOptimizedReturnCallee(const void *fn)
+{
+    return fn == (const void *)objc_retainAutoreleasedReturnValue  ||  
+        fn == (const void *)objc_unsafeClaimAutoreleasedReturnValue;
+}
+
+static ALWAYS_INLINE bool 
+callerAcceptsOptimizedReturn(const void * const ra0)
+{
+    const uint8_t *ra1 = (const uint8_t *)ra0;
+    const unaligned_uint32_t *ra4 = (const unaligned_uint32_t *)ra1;
+
+    if (*ra4 == 0xe8c78948) {
+        // 48 89 c7    movq  %rax,%rdi
+        // e8          callq symbol[@PLT]
+        ra1 += (long)*(const unaligned_int32_t *)(ra1 + 4) + 8l;
+        if (isOptimizedReturnCallee(ra1)) {
+            // Direct call: libobjc is linked into the caller's image.
+            return true;
+        }
+        // PLT entry:
+        // f3 0f 1e fa endbr64     (only in PLTs built for CET)
+        // f2          bnd prefix  (only in PLTs built for MPX)
+        // ff 25       jmpq *symbol@GOTPCREL(%rip)
+        if (*(const unaligned_uint32_t *)ra1 == 0xfa1e0ff3) ra1 += 4;
+        if (*ra1 == 0xf2) ra1 += 1;
+        if (*(const unaligned_uint16_t *)ra1 != 0x25ff) {
+            return false;
+        }
+    } else if (*ra4 == 0x67c78948  &&  ra1[4] == 0xe8) {
+        // 48 89 c7    movq  %rax,%rdi
+        // 67 e8       addr32 callq symbol
+        // The linker's rewrite of a -fno-plt call when libobjc 
+        // is linked into the caller's image.
+        ra1 += (long)*(const unaligned_int32_t *)(ra1 + 5) + 9l;
+        return isOptimizedReturnCallee(ra1);
+    } else if (*ra4 == 0xffc78948  &&  ra1[4] == 0x15) {
+        // 48 89 c7    movq  %rax,%rdi
+        // ff 15       callq *symbol@GOTPCREL(%rip)    (-fno-plt)
+        ra1 += 3;
+    } else {
+        return false;
+    }
+
+    // The GOT slot still points back into the PLT until the 
+    // symbol is bound, so lazily bound calls are optimized 
+    // from their second call on.
+    ra1 += 6l + (long)*(const unaligned_int32_t *)(ra1 + 2);
+    return isOptimizedReturnCallee(*(const void **)ra1);
+}
+
+#endif
@@ -22,9 +22,13 @@ OPTION( PrintAltHandlers,         OBJC_PRINT_ALT_HANDLERS,         "log processi
 OPTION( PrintReplacedMethods,     OBJC_PRINT_REPLACED_METHODS,     "log methods replaced by category implementations")
 OPTION( PrintDeprecation,         OBJC_PRINT_DEPRECATION_WARNINGS, "warn about calls to deprecated runtime functions")
 OPTION( PrintPoolHiwat,           OBJC_PRINT_POOL_HIGHWATER,       "log high-water marks for autorelease pools")
+OPTION( PrintPoolPageCache,       OBJC_PRINT_POOL_PAGE_CACHE,      "log how often autorelease pool pages are reused from the page cache, at exit")
+OPTION( PrintPoolSites,           OBJC_PRINT_POOL_SITES,           "sample autoreleases and log the pool push sites, callers, and classes responsible for autorelease pool growth, at exit")
 OPTION( PrintCustomRR,            OBJC_PRINT_CUSTOM_RR,            "log classes with un-optimized custom retain/release methods")
 OPTION( PrintCustomAWZ,           OBJC_PRINT_CUSTOM_AWZ,           "log classes with un-optimized custom allocWithZone methods")
 OPTION( PrintRawIsa,              OBJC_PRINT_RAW_ISA,              "log classes that require raw pointer isa fields")
+OPTION( PrintSideTableCompaction, OBJC_PRINT_SIDETABLE_COMPACTION, "log memory released by shrinking side table refcount maps")
+OPTION( PrintSideTableLocks,      OBJC_PRINT_SIDETABLE_LOCKS,      "profile side table lock contention and hold time, and log it at exit")
 
 OPTION( DebugUnload,              OBJC_DEBUG_UNLOAD,               "warn about poorly-behaving bundles when unloaded")
 OPTION( DebugFragileSuperclasses, OBJC_DEBUG_FRAGILE_SUPERCLASSES, "warn about subclasses that may have been broken by subsequent changes to superclasses")
@@ -42,3 +46,6 @@ OPTION( DisableTaggedPointers,    OBJC_DISABLE_TAGGED_POINTERS,    "disable tagg
 OPTION( DisableTaggedPointerObfuscation, OBJC_DISABLE_TAG_OBFUSCATION,    "disable obfuscation of tagged pointers")
 OPTION( DisableNonpointerIsa,     OBJC_DISABLE_NONPOINTER_ISA,     "disable non-pointer isa fields")
 OPTION( DisableInitializeForkSafety, OBJC_DISABLE_INITIALIZE_FORK_SAFETY, "disable safety checks for +initialize after fork")
+OPTION( DisableAutoreleaseCoalescing, OBJC_DISABLE_AUTORELEASE_COALESCING, "disable coalescing of repeated autoreleases of the same object into one autorelease pool entry")
+
+OPTION( EnableBiasedRefcounts,    OBJC_BIASED_REFCOUNTS,           "buffer per-thread releases to avoid atomic retain count updates (may delay -dealloc until autorelease pool pop)")
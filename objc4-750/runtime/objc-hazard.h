@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2018 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ *	objc-hazard.h
+ *	Hazard records for objects loaded from shared locations
+ *	without a lock.
+ */
+
+#ifndef _OBJC_HAZARD_H_
+#define _OBJC_HAZARD_H_
+
+#include <atomic>
+
+#include "objc-config.h"
+
+// Each thread's hazard record must be one direct thread key away.
+#if SUPPORT_DIRECT_THREAD_KEYS
+#   define SUPPORT_OBJECT_HAZARDS 1
+#else
+#   define SUPPORT_OBJECT_HAZARDS 0
+#endif
+
+#if SUPPORT_OBJECT_HAZARDS
+
+/*
+  A reader that loads an object from a shared location, such as an
+  atomic property's ivar or a __weak variable, must retain it before
+  a writer that changes the location releases or frees it.
+
+  Each thread owns one ObjectHazard record. The reader publishes the
+  object in its record, re-reads the location, and keeps the object
+  published only while it retains it. The writer changes the location
+  first and then waits in objectHazardsWait() until no record publishes
+  the old object. Either the reader sees the writer's change and tries
+  again, or the writer sees the reader's hazard. For __weak variables
+  the writer is the deallocating thread, which waits after
+  weak_clear_no_lock() has cleared them.
+
+  A thread has a single record, so a reader must not run code that
+  could load another object through a hazard before it calls
+  objectHazardRelease(). In particular it must not call -retain
+  overrides; readers use rootTryRetainFast() and fall back to a lock.
+
+  The writer only waits for readers that published the old object
+  before it scanned their record. Later readers find the location
+  changed, so readers cannot starve a writer. A reader clears its
+  record a few instructions after publishing it, so a writer that
+  still finds it set hands off to the reader, which was preempted.
+
+  Records are never freed. A record is reused after its thread exits.
+*/
+
+struct alignas(CacheLineSize) ObjectHazard {
+    std::atomic<objc_object *> object;  // being retained by this thread
+    std::atomic<bool> inUse;            // owned by a live thread
+    mach_port_t thread;                 // the owner, for handoff
+    ObjectHazard *next;
+
+    ObjectHazard() : object(nil), inUse(true), thread(0), next(nil) { }
+};
+
+extern ObjectHazard *objectHazardForThread_slow(void);
+
+static inline ObjectHazard *objectHazardForThread(void)
+{
+    ObjectHazard *hazard = (ObjectHazard *)tls_get_direct(OBJECT_HAZARD_KEY);
+    if (fastpath(hazard)) return hazard;
+    return objectHazardForThread_slow();
+}
+
+// Returns *location's object. If it is neither nil nor a tagged pointer,
+// it is published in hazard and cannot be freed until
+// objectHazardRelease(hazard), although it may be deallocating.
+static inline objc_object *
+objectHazardAcquire(ObjectHazard *hazard, id *location)
+{
+    objc_object *obj;
+    do {
+        obj = (objc_object *)__atomic_load_n(location, __ATOMIC_RELAXED);
+        if (!obj  ||  obj->isTaggedPointer()) return obj;
+        hazard->object.store(obj, std::memory_order_seq_cst);
+    } while ((objc_object *)__atomic_load_n(location, __ATOMIC_SEQ_CST) != obj);
+    return obj;
+}
+
+static inline void
+objectHazardRelease(ObjectHazard *hazard)
+{
+    hazard->object.store(nil, std::memory_order_release);
+}
+
+// Waits until no thread publishes obj. Call it after every shared
+// location that held obj has been changed and before obj is released.
+// Does nothing for nil and tagged pointers.
+extern void objectHazardsWait(objc_object *obj);
+
+// SUPPORT_OBJECT_HAZARDS
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2018 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ *	objc-hazard.mm
+ *	Hazard records for objects loaded from shared locations
+ *	without a lock.
+ */
+
+#include "objc-private.h"
+#include "objc-hazard.h"
+
+#include <mach/thread_switch.h>
+
+#if SUPPORT_OBJECT_HAZARDS
+
+static std::atomic<ObjectHazard *> ObjectHazards;
+
+static void objectHazardDealloc(void *p)
+{
+    ObjectHazard *hazard = (ObjectHazard *)p;
+    hazard->object.store(nil, std::memory_order_relaxed);
+    hazard->inUse.store(false, std::memory_order_release);
+}
+
+ObjectHazard *objectHazardForThread_slow(void)
+{
+    ObjectHazard *hazard;
+
+    // Take a record left by an exited thread, or add a new one.
+    for (hazard = ObjectHazards.load(std::memory_order_acquire); 
+         hazard; 
+         hazard = hazard->next)
+    {
+        bool expected = false;
+        if (!hazard->inUse.load(std::memory_order_relaxed)  &&  
+            hazard->inUse.compare_exchange_strong(expected, true, 
+                                                  std::memory_order_acquire))
+        {
+            break;
+        }
+    }
+    if (!hazard) {
+        void *mem;
+        if (posix_memalign(&mem, CacheLineSize, sizeof(ObjectHazard))) {
+            _objc_fatal("out of memory for object hazards");
+        }
+        hazard = new (mem) ObjectHazard;
+        ObjectHazard *head = ObjectHazards.load(std::memory_order_relaxed);
+        do {
+            hazard->next = head;
+        } while (!ObjectHazards.compare_exchange_weak(head, hazard, 
+                                                      std::memory_order_release, 
+                                                      std::memory_order_relaxed));
+    }
+
+    hazard->thread = mach_thread_self_direct();
+    tls_set_direct(OBJECT_HAZARD_KEY, hazard);
+    return hazard;
+}
+
+void objectHazardsWait(objc_object *obj)
+{
+    if (!obj  ||  obj->isTaggedPointer()) return;
+
+    // Pairs with the reader's seq_cst re-read of the location.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (ObjectHazard *hazard = ObjectHazards.load(std::memory_order_acquire); 
+         hazard; 
+         hazard = hazard->next)
+    {
+        while (hazard->object.load(std::memory_order_acquire) == obj) {
+            thread_switch(hazard->thread, SWITCH_OPTION_DEPRESS, 1);
+        }
+    }
+}
+
+void hazard_init(void)
+{
+    int r __unused = pthread_key_init_np(OBJECT_HAZARD_KEY, 
+                                         &objectHazardDealloc);
+    assert(r == 0);
+}
+
+// After fork only the forking thread is left, and it is not a reader.
+void ObjectHazardsForceReset(void)
+{
+    ObjectHazard *mine = (ObjectHazard *)tls_get_direct(OBJECT_HAZARD_KEY);
+    for (ObjectHazard *hazard = ObjectHazards.load(std::memory_order_relaxed); 
+         hazard; 
+         hazard = hazard->next)
+    {
+        hazard->object.store(nil, std::memory_order_relaxed);
+        if (hazard != mine) {
+            hazard->inUse.store(false, std::memory_order_relaxed);
+        }
+    }
+}
+
+// SUPPORT_OBJECT_HAZARDS
+#else
+
+void hazard_init(void) { }
+void ObjectHazardsForceReset(void) { }
+
+// !SUPPORT_OBJECT_HAZARDS
+#endif
@@ -662,6 +662,17 @@ objc_autorelease(id _Nullable obj)
     __asm__("_objc_autorelease")
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0, 2.0);
 
+// Retain or release count objects at once. nil elements are ignored.
+// Side table locks are taken once per stripe, and objects whose 
+// retain count reaches zero are deallocated after the rest are released.
+OBJC_EXPORT void
+objc_retainArray(id _Nullable * _Nonnull objs, size_t count)
+    OBJC_AVAILABLE(10.14, 12.0, 12.0, 5.0, 3.0);
+
+OBJC_EXPORT void
+objc_releaseArray(id _Nullable * _Nonnull objs, size_t count)
+    OBJC_AVAILABLE(10.14, 12.0, 12.0, 5.0, 3.0);
+
 // Prepare a value at +1 for return through a +0 autoreleasing convention.
 OBJC_EXPORT id _Nullable
 objc_autoreleaseReturnValue(id _Nullable obj)
@@ -740,6 +751,47 @@ OBJC_EXPORT void
 objc_clear_deallocating(id _Nonnull object)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0, 2.0);
 
+// Shrinks every side table refcount map to fit its live entries.
+// Returns the number of bytes released.
+OBJC_EXPORT size_t
+objc_compactSideTables(void)
+    OBJC_AVAILABLE(10.14, 12.0, 12.0, 5.0, 3.0);
+
+// Logs side table lock contention statistics.
+// Requires OBJC_PRINT_SIDETABLE_LOCKS=YES, which also logs them at exit.
+OBJC_EXPORT void
+objc_printSideTableLockStats(void)
+    OBJC_AVAILABLE(10.14, 12.0, 12.0, 5.0, 3.0);
+
+// Memory used by one side table's weak table and retain counts.
+struct objc_side_table_stats {
+    size_t weak_entries;           // weakly referenced objects
+    size_t weak_capacity;          // buckets, including any being migrated
+    size_t weak_max_displacement;  // longest weak table probe
+    size_t weak_out_of_line;       // entries with out-of-line referrers
+    size_t weak_bytes;             // buckets plus out-of-line referrers
+    size_t refcount_entries;       // objects with side table retain counts
+    size_t refcount_capacity;      // refcount map buckets
+    size_t refcount_bytes;         // refcount map buckets
+};
+
+// Fills stats[0..count) with the statistics of each side table and 
+// *total with their sum (weak_max_displacement is the maximum). 
+// Either may be NULL. Returns the number of side tables.
+// Each side table lock is held only long enough to copy a few counters.
+OBJC_EXPORT unsigned int
+objc_getSideTableStats(struct objc_side_table_stats * _Nullable stats,
+                       unsigned int count,
+                       struct objc_side_table_stats * _Nullable total)
+    OBJC_AVAILABLE(10.14, 12.0, 12.0, 5.0, 3.0);
+
+// Logs the autorelease pool push sites that collected the most objects, 
+// with sampled callers and classes of the objects autoreleased there.
+// Requires OBJC_PRINT_POOL_SITES=YES, which also logs them at exit.
+OBJC_EXPORT void
+objc_printAutoreleasePoolSites(void)
+    OBJC_AVAILABLE(10.14, 12.0, 12.0, 5.0, 3.0);
+
  
 // 现在让 CF 链接
 
@@ -458,6 +458,11 @@ objc_object::retain()
 ALWAYS_INLINE id 
 objc_object::rootRetain()
 {
+#if SUPPORT_BIASED_REFCOUNTS
+    if (slowpath(EnableBiasedRefcounts)  &&  biased_retain()) {
+        return (id)this;
+    }
+#endif
     return rootRetain(false, false);
 }
 
@@ -467,6 +472,37 @@ objc_object::rootTryRetain()
     return rootRetain(true, false) ? true : false;
 }
 
+
+// Retains with a single isa update, without the side table.
+// Returns false instead if this object has a raw isa, is deallocating, 
+// or would overflow extra_rc; the caller then falls back to a locked 
+// path. Unlike rootTryRetain() it needs no side table lock.
+ALWAYS_INLINE bool 
+objc_object::rootTryRetainFast()
+{
+    assert(!isTaggedPointer());
+
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (slowpath(!newisa.nonpointer  ||  newisa.deallocating)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (slowpath(carry)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+    } while (slowpath(!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)));
+
+    return true;
+}
+
 ALWAYS_INLINE id 
 objc_object::rootRetain(bool tryRetain, bool handleOverflow)
 {
@@ -551,6 +587,11 @@ objc_object::release()
 ALWAYS_INLINE bool 
 objc_object::rootRelease()
 {
+#if SUPPORT_BIASED_REFCOUNTS
+    if (slowpath(EnableBiasedRefcounts)  &&  biased_release()) {
+        return false;
+    }
+#endif
     return rootRelease(true, false);
 }
 
@@ -560,6 +601,31 @@ objc_object::rootReleaseShouldDealloc()
     return rootRelease(false, false);
 }
 
+
+// Drop count references with one isa update. Only done when the 
+// inline retain count holds more than count, so the object stays alive.
+// Returns false, having released nothing, if the caller must 
+// release one reference at a time instead.
+inline bool 
+objc_object::rootTryReleaseMany(uintptr_t count)
+{
+    if (isTaggedPointer()) return true;
+
+    isa_t oldisa;
+    isa_t newisa;
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (slowpath(!newisa.nonpointer  ||  newisa.extra_rc < count)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+        newisa.extra_rc -= count;
+    } while (slowpath(!StoreReleaseExclusive(&isa.bits, 
+                                             oldisa.bits, newisa.bits)));
+    return true;
+}
+
 ALWAYS_INLINE bool 
 objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
 {
@@ -721,6 +787,9 @@ objc_object::rootRetainCount()
             rc += sidetable_getExtraRC_nolock();
         }
         sidetable_unlock();
+#if SUPPORT_BIASED_REFCOUNTS
+        if (slowpath(EnableBiasedRefcounts)) rc -= biased_pendingReleases();
+#endif
         return rc;
     }
 
@@ -932,6 +1001,14 @@ objc_object::rootReleaseShouldDealloc()
 }
 
 
+inline bool 
+objc_object::rootTryReleaseMany(uintptr_t count)
+{
+    if (isTaggedPointer()) return true;
+    return false;
+}
+
+
 // Equivalent to [this autorelease], with shortcuts if there is no override
 inline id 
 objc_object::autorelease()
@@ -965,6 +1042,14 @@ objc_object::rootTryRetain()
 }
 
 
+// Raw isa objects always need the side table.
+inline bool 
+objc_object::rootTryRetainFast()
+{
+    return false;
+}
+
+
 inline uintptr_t 
 objc_object::rootRetainCount()
 {
@@ -1028,6 +1113,8 @@ objc_object::rootRetainCount()
   x86_64: Callee looks for `mov rax, rdi` followed by a call or 
     jump instruction to objc_retainAutoreleasedReturnValue or 
     objc_unsafeClaimAutoreleasedReturnValue. 
+    ELF callers may call it directly, through a PLT entry, or through 
+    the GOT (-fno-plt), so all three are followed (objc-elf-return.h).
   i386:  Callee looks for a magic nop `movl %ebp, %ebp` (frame pointer register)
   armv7: Callee looks for a magic nop `mov r7, r7` (frame pointer register). 
   arm64: Callee looks for a magic nop `mov x29, x29` (frame pointer register). 
@@ -1035,9 +1122,17 @@ objc_object::rootRetainCount()
   Tagged pointer objects do participate in the optimized return scheme, 
   because it saves message sends. They are not entered in the autorelease 
   pool in the unoptimized case.
+
+  The disposition lives in a reserved pthread key where libc provides 
+  one (SUPPORT_DIRECT_THREAD_KEYS) and in a __thread variable elsewhere.
 **********************************************************************/
 
-# if __x86_64__
+# if __x86_64__  &&  __ELF__
+
+#include "objc-elf-return.h"
+
+// __x86_64__  &&  __ELF__
+# elif __x86_64__
 
 static ALWAYS_INLINE bool 
 callerAcceptsOptimizedReturn(const void * const ra0)
@@ -1107,7 +1202,7 @@ callerAcceptsOptimizedReturn(const void *ra)
 }
 
 // __arm__
-# elif __arm64__
+# elif __arm64__  ||  __aarch64__
 
 static ALWAYS_INLINE bool 
 callerAcceptsOptimizedReturn(const void *ra)
@@ -1120,7 +1215,7 @@ callerAcceptsOptimizedReturn(const void *ra)
     return false;
 }
 
-// __arm64__
+// __arm64__  ||  __aarch64__
 # elif __i386__
 
 static ALWAYS_INLINE bool 
@@ -1148,6 +1243,8 @@ callerAcceptsOptimizedReturn(const void *ra)
 # endif
 
 
+# if SUPPORT_DIRECT_THREAD_KEYS
+
 static ALWAYS_INLINE ReturnDisposition 
 getReturnDisposition()
 {
@@ -1161,6 +1258,31 @@ setReturnDisposition(ReturnDisposition disposition)
     tls_set_direct(RETURN_DISPOSITION_KEY, (void*)(uintptr_t)disposition);
 }
 
+// SUPPORT_DIRECT_THREAD_KEYS
+# else
+// not SUPPORT_DIRECT_THREAD_KEYS
+
+// Defined in NSObject.mm. initial-exec makes each access a single 
+// thread-pointer-relative load or store, like a direct pthread key.
+extern __thread uintptr_t ReturnDispositionSlot 
+    __attribute__((tls_model("initial-exec")));
+
+static ALWAYS_INLINE ReturnDisposition 
+getReturnDisposition()
+{
+    return (ReturnDisposition)ReturnDispositionSlot;
+}
+
+
+static ALWAYS_INLINE void 
+setReturnDisposition(ReturnDisposition disposition)
+{
+    ReturnDispositionSlot = (uintptr_t)disposition;
+}
+
+// not SUPPORT_DIRECT_THREAD_KEYS
+# endif
+
 
 // Try to prepare for optimized return with the given disposition (+0 or +1).
 // Returns true if the optimized path is successful.
@@ -380,6 +380,11 @@ extern void _objc_fatal_with_reason(uint64_t reason, uint64_t flags,
 # if SUPPORT_RETURN_AUTORELEASE
 #   define RETURN_DISPOSITION_KEY ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY4)
 # endif
+# if SUPPORT_BIASED_REFCOUNTS
+#   define BIASED_REFCOUNT_KEY   ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY5)
+# endif
+#   define AUTORELEASE_POOL_CACHE_KEY ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY6)
+#   define OBJECT_HAZARD_KEY     ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY7)
 #else
 #   define SUPPORT_DIRECT_THREAD_KEYS 0
 #endif
@@ -685,6 +690,11 @@ static bool is_valid_direct_key(tls_key_t k) {
 #   if SUPPORT_RETURN_AUTORELEASE
             || k == RETURN_DISPOSITION_KEY
 #   endif
+#   if SUPPORT_BIASED_REFCOUNTS
+            || k == BIASED_REFCOUNT_KEY
+#   endif
+            || k == AUTORELEASE_POOL_CACHE_KEY
+            || k == OBJECT_HAZARD_KEY
                );
 }
 #endif
@@ -769,6 +779,12 @@ class mutex_tt : nocopy_t {
             (&mLock, OS_UNFAIR_LOCK_DATA_SYNCHRONIZATION);
     }
 
+    bool tryLock() {
+        if (!os_unfair_lock_trylock(&mLock)) return false;
+        lockdebug_mutex_lock(this);
+        return true;
+    }
+
     void unlock() {
         lockdebug_mutex_unlock(this);
 
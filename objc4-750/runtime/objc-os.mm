@@ -505,6 +505,7 @@ void map_images_nolock(unsigned mhCount, const char * const mhPaths[], const str
     if (firstTime) {
         sel_init(selrefCount);//初始化方法列表并注册内部使用的方法
         arr_init();// 初始化自动释放池与哈希表
+        hazard_init();
 
 #if SUPPORT_GC_COMPAT //注：iOS 不兼容 Garbage Collection
         
@@ -653,7 +654,7 @@ static void defineLockOrder()
     lockdebug_lock_precedes_lock(&cacheUpdateLock, &crashlog_lock);
     lockdebug_lock_precedes_lock(&objcMsgLogLock, &crashlog_lock);
     lockdebug_lock_precedes_lock(&AltHandlerDebugLock, &crashlog_lock);
-    lockdebug_lock_precedes_lock(&AssociationsManagerLock, &crashlog_lock);
+    AssociationsLocksPrecedeLock(&crashlog_lock);
     SideTableLocksPrecedeLock(&crashlog_lock);
     PropertyLocks.precedeLock(&crashlog_lock);
     StructLocks.precedeLock(&crashlog_lock);
@@ -675,20 +676,20 @@ static void defineLockOrder()
     lockdebug_lock_precedes_lock(&loadMethodLock, &cacheUpdateLock);
     lockdebug_lock_precedes_lock(&loadMethodLock, &objcMsgLogLock);
     lockdebug_lock_precedes_lock(&loadMethodLock, &AltHandlerDebugLock);
-    lockdebug_lock_precedes_lock(&loadMethodLock, &AssociationsManagerLock);
+    AssociationsLocksSucceedLock(&loadMethodLock);
     SideTableLocksSucceedLock(&loadMethodLock);
     PropertyLocks.succeedLock(&loadMethodLock);
     StructLocks.succeedLock(&loadMethodLock);
     CppObjectLocks.succeedLock(&loadMethodLock);
 
-    // PropertyLocks and CppObjectLocks and AssociationManagerLock 
+    // PropertyLocks and CppObjectLocks and associations locks 
     // precede everything because they are held while objc_retain() 
     // or C++ copy are called.
     // (StructLocks do not precede everything because it calls memmove only.)
     auto PropertyAndCppObjectAndAssocLocksPrecedeLock = [&](const void *lock) {
         PropertyLocks.precedeLock(lock);
         CppObjectLocks.precedeLock(lock);
-        lockdebug_lock_precedes_lock(&AssociationsManagerLock, lock);
+        AssociationsLocksPrecedeLock(lock);
     };
 #if __OBJC2__
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&runtimeLock);
@@ -707,10 +708,10 @@ static void defineLockOrder()
 
     SideTableLocksSucceedLocks(PropertyLocks);
     SideTableLocksSucceedLocks(CppObjectLocks);
-    SideTableLocksSucceedLock(&AssociationsManagerLock);
+    AssociationsLocksPrecedeSideTableLocks();
 
-    PropertyLocks.precedeLock(&AssociationsManagerLock);
-    CppObjectLocks.precedeLock(&AssociationsManagerLock);
+    AssociationsLocksSucceedLocks(PropertyLocks);
+    AssociationsLocksSucceedLocks(CppObjectLocks);
     
 #if __OBJC2__
     lockdebug_lock_precedes_lock(&classInitLock, &runtimeLock);
@@ -744,6 +745,7 @@ static void defineLockOrder()
     PropertyLocks.defineLockOrder();
     StructLocks.defineLockOrder();
     CppObjectLocks.defineLockOrder();
+    AssociationsDefineLockOrder();
 }
 // LOCKDEBUG
 #endif
@@ -760,7 +762,7 @@ void _objc_atfork_prepare()
     loadMethodLock.lock();
     PropertyLocks.lockAll();
     CppObjectLocks.lockAll();
-    AssociationsManagerLock.lock();
+    AssociationsLockAll();
     SideTableLockAll();
     classInitLock.enter();
 #if __OBJC2__
@@ -790,7 +792,7 @@ void _objc_atfork_parent()
     CppObjectLocks.unlockAll();
     StructLocks.unlockAll();
     PropertyLocks.unlockAll();
-    AssociationsManagerLock.unlock();
+    AssociationsUnlockAll();
     AltHandlerDebugLock.unlock();
     objcMsgLogLock.unlock();
     crashlog_lock.unlock();
@@ -824,7 +826,7 @@ void _objc_atfork_child()
     CppObjectLocks.forceResetAll();
     StructLocks.forceResetAll();
     PropertyLocks.forceResetAll();
-    AssociationsManagerLock.forceReset();
+    AssociationsForceResetAll();
     AltHandlerDebugLock.forceReset();
     objcMsgLogLock.forceReset();
     crashlog_lock.forceReset();
@@ -832,6 +834,7 @@ void _objc_atfork_child()
     cacheUpdateLock.forceReset();
     selLock.forceReset();
     SideTableForceResetAll();
+    ObjectHazardsForceReset();
 #if __OBJC2__
     DemangleCacheLock.forceReset();
     runtimeLock.forceReset();
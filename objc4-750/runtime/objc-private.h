@@ -121,12 +121,18 @@ public:
     void release();
     id autorelease();
 
+    // Batched retain/release for objc_retainArray/objc_releaseArray
+    static void retainArray(id *objs, size_t count);
+    static void releaseArray(id *objs, size_t count);
+
     // Implementations of retain/release methods
     id rootRetain();
     bool rootRelease();
     id rootAutorelease();
     bool rootTryRetain();
+    bool rootTryRetainFast();
     bool rootReleaseShouldDealloc();
+    bool rootTryReleaseMany(uintptr_t count);
     uintptr_t rootRetainCount();
 
     // Implementation of dealloc methods
@@ -134,6 +140,11 @@ public:
     void clearDeallocating();
     void rootDealloc();
 
+#if SUPPORT_BIASED_REFCOUNTS
+    // Apply this thread's buffered releases (OBJC_BIASED_REFCOUNTS)
+    static void biasedRefcountsFlush();
+#endif
+
 private:
     void initIsa(Class newCls, bool nonpointer, bool hasCxxDtor);
 
@@ -149,6 +160,7 @@ private:
     bool rootRelease_underflow(bool performDealloc);
 
     void clearDeallocating_slow();
+    static void clearDeallocatingWeak(objc_object **objs, size_t count);
 
     // Side table retain count overflow for nonpointer isa
     void sidetable_lock();
@@ -160,6 +172,13 @@ private:
     size_t sidetable_getExtraRC_nolock();
 #endif
 
+#if SUPPORT_BIASED_REFCOUNTS
+    // Thread-local buffered releases for nonpointer isa
+    bool biased_retain();
+    bool biased_release();
+    uintptr_t biased_pendingReleases();
+#endif
+
     // Side-table-only retain count
     bool sidetable_isDeallocating();
     void sidetable_clearDeallocating();
@@ -169,9 +188,11 @@ private:
 
     id sidetable_retain();
     id sidetable_retain_slow(SideTable& table);
+    id sidetable_retain_nolock(SideTable& table);
 
     uintptr_t sidetable_release(bool performDealloc = true);
     uintptr_t sidetable_release_slow(SideTable& table, bool performDealloc = true);
+    bool sidetable_release_nolock(SideTable& table);
 
     bool sidetable_tryRetain();
 
@@ -583,10 +604,24 @@ extern char *encoding_copyArgumentType(const char *t, unsigned int index);
 // sync.h
 extern void _destroySyncCache(struct SyncCache *cache);
 
+// Idle @synchronized records each lock stripe keeps for reuse.
+// Set from OBJC_SYNC_IDLE_RECORDS.
+extern unsigned int SyncDataIdleLimit;
+
 // arr
 extern void arr_init(void);
+extern void hazard_init(void);
 extern id objc_autoreleaseReturnValue(id obj);
 
+// Autorelease pool pages kept for reuse per thread and process-wide.
+// Set from OBJC_POOL_PAGE_CACHE_THREAD and OBJC_POOL_PAGE_CACHE_GLOBAL.
+extern unsigned int PoolPageThreadCacheLimit;
+extern unsigned int PoolPageGlobalCacheLimit;
+
+// One in this many autoreleases is sampled under OBJC_PRINT_POOL_SITES.
+// Set from OBJC_POOL_SITES_INTERVAL.
+extern unsigned int PoolSiteSampleInterval;
+
 // block trampolines
 extern IMP _imp_implementationWithBlockNoCopy(id block);
 
@@ -821,6 +856,19 @@ class StripedMap {
         if (i < StripeCount) return &array[i].value;
         else return nil;
     }
+
+    // Direct access to every stripe, for maintenance that visits them all.
+    unsigned int getStripeCount() const {
+        return StripeCount;
+    }
+
+    T& getStripe(unsigned int i) {
+        if (i >= StripeCount) {
+            _objc_fatal("StripedMap stripe %u out of range (%u stripes)", 
+                        i, (unsigned int)StripeCount);
+        }
+        return array[i].value;
+    }
     
 #if DEBUG
     StripedMap() {
@@ -165,16 +165,120 @@ namespace objc_references_support {
         bool hasValue() { return _value != nil; }
     };
 
-#if TARGET_OS_WIN32
-    typedef hash_map<void *, ObjcAssociation> ObjectAssociationMap;
-    typedef hash_map<disguised_ptr_t, ObjectAssociationMap *> AssociationsHashMap;
-#else
-    typedef ObjcAllocator<std::pair<void * const, ObjcAssociation> > ObjectAssociationMapAllocator;
-    class ObjectAssociationMap : public std::map<void *, ObjcAssociation, ObjectPointerLess, ObjectAssociationMapAllocator> {
+    // The associations of one object. Most objects carry only one to three
+    // keys, so the first ASSOCIATION_INLINE_COUNT associations are stored 
+    // in place and searched linearly. Adding one more moves all of them 
+    // into a std::map built in the same storage, which is kept until the 
+    // map is freed. Objects with more keys cost what they did when every 
+    // ObjectAssociationMap was a std::map, plus the unused inline bytes.
+#define ASSOCIATION_INLINE_COUNT 3
+
+    class ObjectAssociationMap {
+        typedef ObjcAllocator<std::pair<void * const, ObjcAssociation> > LargeMapAllocator;
+        typedef std::map<void *, ObjcAssociation, ObjectPointerLess, LargeMapAllocator> LargeMap;
+
+        struct InlineEntry {
+            void *key;
+            ObjcAssociation association;
+        };
+
+        // Number of inline entries in use, or ASSOCIATIONS_OUT_OF_LINE.
+        uintptr_t _count;
+        union {
+            InlineEntry _inline[ASSOCIATION_INLINE_COUNT];
+            LargeMap _large;
+        };
+
+        enum { ASSOCIATIONS_OUT_OF_LINE = ASSOCIATION_INLINE_COUNT + 1 };
+
+        bool out_of_line() const {
+            return _count == ASSOCIATIONS_OUT_OF_LINE;
+        }
+
+        void grow_out_of_line() {
+            // _large overlaps the inline entries. Build it only after 
+            // copying them out.
+            InlineEntry entries[ASSOCIATION_INLINE_COUNT];
+            for (uintptr_t i = 0; i < _count; i++) entries[i] = _inline[i];
+            new (&_large) LargeMap;
+            for (uintptr_t i = 0; i < _count; i++) {
+                _large[entries[i].key] = entries[i].association;
+            }
+            _count = ASSOCIATIONS_OUT_OF_LINE;
+        }
+
     public:
+        ObjectAssociationMap() : _count(0) { }
+        ~ObjectAssociationMap() {
+            if (out_of_line()) _large.~LargeMap();
+        }
+
         void *operator new(size_t n) { return ::malloc(n); }
         void operator delete(void *ptr) { ::free(ptr); }
+
+        // Returns the association for key, or NULL if there is none.
+        ObjcAssociation *find(void *key) {
+            if (out_of_line()) {
+                LargeMap::iterator j = _large.find(key);
+                return j != _large.end() ? &j->second : NULL;
+            }
+            for (uintptr_t i = 0; i < _count; i++) {
+                if (_inline[i].key == key) return &_inline[i].association;
+            }
+            return NULL;
+        }
+
+        // Adds an association for a key that is not yet present.
+        void insert(void *key, const ObjcAssociation &association) {
+            if (!out_of_line()) {
+                if (_count < ASSOCIATION_INLINE_COUNT) {
+                    _inline[_count].key = key;
+                    _inline[_count].association = association;
+                    _count++;
+                    return;
+                }
+                grow_out_of_line();
+            }
+            _large[key] = association;
+        }
+
+        // Removes the association for key and copies it to old.
+        // Returns false if there was no association for key.
+        bool erase(void *key, ObjcAssociation &old) {
+            if (out_of_line()) {
+                LargeMap::iterator j = _large.find(key);
+                if (j == _large.end()) return false;
+                old = j->second;
+                _large.erase(j);
+                return true;
+            }
+            for (uintptr_t i = 0; i < _count; i++) {
+                if (_inline[i].key == key) {
+                    old = _inline[i].association;
+                    _inline[i] = _inline[--_count];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        template <typename Fn>
+        void forEach(const Fn &fn) {
+            if (out_of_line()) {
+                for (LargeMap::iterator j = _large.begin(), end = _large.end(); j != end; ++j) {
+                    fn(j->second);
+                }
+                return;
+            }
+            for (uintptr_t i = 0; i < _count; i++) {
+                fn(_inline[i].association);
+            }
+        }
     };
+
+#if TARGET_OS_WIN32
+    typedef hash_map<disguised_ptr_t, ObjectAssociationMap *> AssociationsHashMap;
+#else
     typedef ObjcAllocator<std::pair<const disguised_ptr_t, ObjectAssociationMap*> > AssociationsHashMapAllocator;
     class AssociationsHashMap : public unordered_map<disguised_ptr_t, ObjectAssociationMap *, DisguisedPointerHash, DisguisedPointerEqual, AssociationsHashMapAllocator> {
     public:
@@ -186,27 +290,83 @@ namespace objc_references_support {
 
 using namespace objc_references_support;
 
-// class AssociationsManager manages a lock / hash table singleton pair.
+// Associations are sharded by object address. Each shard is a lock / 
+// hash table pair, so threads working on unrelated objects do not contend.
+// The pair shares one StripedMap entry, so a lookup computes one index 
+// and touches one cache line for both.
+// class AssociationsManager manages the pair for one object's shard.
 // Allocating an instance acquires the lock, and calling its assocations()
 // method lazily allocates the hash table.
 
-spinlock_t AssociationsManagerLock;
+struct AssociationsShard {
+    // First, so the shard's address is its lock's for lockdebug.
+    spinlock_t slock;
+    // associative references: object pointer -> PtrPtrHashMap.
+    AssociationsHashMap *map;
+
+    constexpr AssociationsShard() : map(NULL) { }
+
+    void lock() { slock.lock(); }
+    void unlock() { slock.unlock(); }
+    void forceReset() { slock.forceReset(); }
+};
+
+static StripedMap<AssociationsShard> AssociationsShards;
 
 class AssociationsManager {
-    // associative references: object pointer -> PtrPtrHashMap.
-    static AssociationsHashMap *_map;
+    AssociationsShard &_shard;
 public:
-    AssociationsManager()   { AssociationsManagerLock.lock(); }
-    ~AssociationsManager()  { AssociationsManagerLock.unlock(); }
+    AssociationsManager(id object) : _shard(AssociationsShards[object]) {
+        _shard.lock();
+    }
+    ~AssociationsManager()  { _shard.unlock(); }
     
     AssociationsHashMap &associations() {
-        if (_map == NULL)
-            _map = new AssociationsHashMap();
-        return *_map;
+        if (_shard.map == NULL)
+            _shard.map = new AssociationsHashMap();
+        return *_shard.map;
     }
 };
 
-AssociationsHashMap *AssociationsManager::_map = NULL;
+void AssociationsLockAll() {
+    AssociationsShards.lockAll();
+}
+
+void AssociationsUnlockAll() {
+    AssociationsShards.unlockAll();
+}
+
+void AssociationsForceResetAll() {
+    AssociationsShards.forceResetAll();
+}
+
+void AssociationsDefineLockOrder() {
+    AssociationsShards.defineLockOrder();
+}
+
+void AssociationsLocksPrecedeLock(const void *newlock) {
+    AssociationsShards.precedeLock(newlock);
+}
+
+void AssociationsLocksSucceedLock(const void *oldlock) {
+    AssociationsShards.succeedLock(oldlock);
+}
+
+void AssociationsLocksSucceedLocks(StripedMap<spinlock_t>& oldlocks) {
+    int i = 0;
+    const void *oldlock;
+    while ((oldlock = oldlocks.getLock(i++))) {
+        AssociationsShards.succeedLock(oldlock);
+    }
+}
+
+void AssociationsLocksPrecedeSideTableLocks() {
+    int i = 0;
+    const void *lock;
+    while ((lock = AssociationsShards.getLock(i++))) {
+        SideTableLocksSucceedLock(lock);
+    }
+}
 
 // expanded policy bits.
 
@@ -223,17 +383,16 @@ id _object_get_associative_reference(id object, void *key) {
     id value = nil;
     uintptr_t policy = OBJC_ASSOCIATION_ASSIGN;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         disguised_ptr_t disguised_object = DISGUISE(object);
         AssociationsHashMap::iterator i = associations.find(disguised_object);
         if (i != associations.end()) {
             ObjectAssociationMap *refs = i->second;
-            ObjectAssociationMap::iterator j = refs->find(key);
-            if (j != refs->end()) {
-                ObjcAssociation &entry = j->second;
-                value = entry.value();
-                policy = entry.policy();
+            ObjcAssociation *entry = refs->find(key);
+            if (entry) {
+                value = entry->value();
+                policy = entry->policy();
                 if (policy & OBJC_ASSOCIATION_GETTER_RETAIN) {
                     objc_retain(value);
                 }
@@ -273,7 +432,7 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
     ObjcAssociation old_association(0, nil);
     id new_value = value ? acquireValue(value, policy) : nil;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         disguised_ptr_t disguised_object = DISGUISE(object);
         if (new_value) {
@@ -282,18 +441,18 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
             if (i != associations.end()) {
                 // secondary table exists
                 ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    j->second = ObjcAssociation(policy, new_value);
+                ObjcAssociation *entry = refs->find(key);
+                if (entry) {
+                    old_association = *entry;
+                    *entry = ObjcAssociation(policy, new_value);
                 } else {
-                    (*refs)[key] = ObjcAssociation(policy, new_value);
+                    refs->insert(key, ObjcAssociation(policy, new_value));
                 }
             } else {
                 // create the new association (first time).
                 ObjectAssociationMap *refs = new ObjectAssociationMap;
                 associations[disguised_object] = refs;
-                (*refs)[key] = ObjcAssociation(policy, new_value);
+                refs->insert(key, ObjcAssociation(policy, new_value));
                 object->setHasAssociatedObjects();
             }
         } else {
@@ -301,11 +460,7 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
             AssociationsHashMap::iterator i = associations.find(disguised_object);
             if (i !=  associations.end()) {
                 ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    refs->erase(j);
-                }
+                refs->erase(key, old_association);
             }
         }
     }
@@ -316,7 +471,7 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
 void _object_remove_assocations(id object) {
     vector< ObjcAssociation,ObjcAllocator<ObjcAssociation> > elements;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         if (associations.size() == 0) return;
         disguised_ptr_t disguised_object = DISGUISE(object);
@@ -324,9 +479,9 @@ void _object_remove_assocations(id object) {
         if (i != associations.end()) {
             // copy all of the associations that need to be removed.
             ObjectAssociationMap *refs = i->second;
-            for (ObjectAssociationMap::iterator j = refs->begin(), end = refs->end(); j != end; ++j) {
-                elements.push_back(j->second);
-            }
+            refs->forEach([&](const ObjcAssociation &association) {
+                elements.push_back(association);
+            });
             // remove the secondary table.
             delete refs;
             associations.erase(i);
@@ -248,6 +248,23 @@ void removeHeader(header_info *hi)
     }
 }
 
+/***********************************************************************
+* environ_count
+* Parse a numeric setting such as OBJC_POOL_PAGE_CACHE_THREAD=8 into 
+* *count. Complains and leaves *count alone if the value is not a number.
+**********************************************************************/
+static void environ_count(const char *setting, unsigned int *count)
+{
+    const char *value = strchr(setting, '=') + 1;
+    char *end;
+    unsigned long n = strtoul(value, &end, 10);
+    if (end == value  ||  *end != '\0'  ||  n > UINT_MAX) {
+        _objc_inform("%s is not a number; ignoring it", setting);
+        return;
+    }
+    *count = (unsigned int)n;
+}
+
 /* environ_init 环境初始化
  * 读取影响运行时的环境变量。
  * 如果需要，还可以打印环境变量帮助。
@@ -281,6 +298,22 @@ void environ_init(void)
             PrintOptions = true;
             continue;
         }
+        if (0 == strncmp(*p, "OBJC_POOL_PAGE_CACHE_THREAD=", 28)) {
+            environ_count(*p, &PoolPageThreadCacheLimit);
+            continue;
+        }
+        if (0 == strncmp(*p, "OBJC_POOL_PAGE_CACHE_GLOBAL=", 28)) {
+            environ_count(*p, &PoolPageGlobalCacheLimit);
+            continue;
+        }
+        if (0 == strncmp(*p, "OBJC_POOL_SITES_INTERVAL=", 25)) {
+            environ_count(*p, &PoolSiteSampleInterval);
+            continue;
+        }
+        if (0 == strncmp(*p, "OBJC_SYNC_IDLE_RECORDS=", 23)) {
+            environ_count(*p, &SyncDataIdleLimit);
+            continue;
+        }
         
         const char *value = strchr(*p, '=');
         if (!*value) continue;
@@ -322,9 +355,25 @@ void environ_init(void)
                 _objc_inform("OBJC_HELP is set");
             }
             _objc_inform("OBJC_PRINT_OPTIONS: list which options are set");
+            _objc_inform("OBJC_POOL_PAGE_CACHE_THREAD: autorelease pool "
+                         "pages each thread keeps for reuse");
+            _objc_inform("OBJC_POOL_PAGE_CACHE_GLOBAL: autorelease pool "
+                         "pages kept for reuse by any thread");
+            _objc_inform("OBJC_POOL_SITES_INTERVAL: sample one in this many "
+                         "autoreleases under OBJC_PRINT_POOL_SITES");
+            _objc_inform("OBJC_SYNC_IDLE_RECORDS: idle @synchronized "
+                         "records each lock stripe keeps for reuse");
         }
         if (PrintOptions) {
             _objc_inform("OBJC_PRINT_OPTIONS is set");
+            _objc_inform("OBJC_POOL_PAGE_CACHE_THREAD is %u", 
+                         PoolPageThreadCacheLimit);
+            _objc_inform("OBJC_POOL_PAGE_CACHE_GLOBAL is %u", 
+                         PoolPageGlobalCacheLimit);
+            _objc_inform("OBJC_POOL_SITES_INTERVAL is %u", 
+                         PoolSiteSampleInterval);
+            _objc_inform("OBJC_SYNC_IDLE_RECORDS is %u", 
+                         SyncDataIdleLimit);
         }
 
         for (size_t i = 0; i < sizeof(Settings)/sizeof(Settings[0]); i++) {
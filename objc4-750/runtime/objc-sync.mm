@@ -25,16 +25,20 @@
 #include "objc-sync.h"
 
 //
-// Allocate a lock only when needed.  Since few locks are needed at any point
-// in time, keep them on a single list.
+// Allocate a lock only when needed.  Locks are found by object in 
+// a small open-addressed table per stripe, so servers that synchronize 
+// on many distinct objects do not walk long chains.
 //
 
 
 typedef struct alignas(CacheLineSize) SyncData {
-    struct SyncData* nextData;
     DisguisedPtr<objc_object> object;
     int32_t threadCount;  // number of THREADS using this block
     recursive_mutex_t mutex;
+#if SUPPORT_THIN_SYNC
+    // Non-nil for a stripe's thin record, whose object is kept there.
+    std::atomic<uintptr_t> *thinState;
+#endif
 } SyncData;
 
 typedef struct {
@@ -42,6 +46,9 @@ typedef struct {
     unsigned int lockCount;  // number of times THIS THREAD locked this block
 } SyncCacheItem;
 
+// Items are kept in move-to-front order with the front at list[used-1]: 
+// searches start from the most recently used item, which is usually 
+// the innermost @synchronized.
 typedef struct SyncCache {
     unsigned int allocated;
     unsigned int used;
@@ -56,18 +63,204 @@ typedef struct SyncCache {
   SYNC_COUNT_DIRECT_KEY == SyncCacheItem.lockCount
  */
 
+/*
+  Thin records (SUPPORT_THIN_SYNC): most @synchronized blocks are 
+  uncontended, and few objects are locked at once per stripe. Each 
+  stripe therefore has one extra SyncData, the thin record, that an 
+  object can take without the stripe lock. SyncList::thinState holds 
+  the object using it and the number of threads using it, and a single 
+  compare-and-swap claims it or joins it. Once found, the thin record 
+  is an ordinary SyncData: its recursive mutex provides the exclusion, 
+  threads that contend for it block on that mutex, and the per-thread 
+  caches count recursion. The last thread to leave empties it.
+  No object may have a thin record and a table record in use at once. 
+  An object only joins the thin record if it already holds it. It only 
+  claims an empty thin record without the stripe lock if the stripe 
+  has no table records in use (SYNC_THIN_BUSY clear). Under the lock, 
+  id2data() either joins or claims the thin record, or sets 
+  SYNC_THIN_BUSY in the same compare-and-swap before using a table 
+  record. SYNC_THIN_BUSY is cleared under the lock once the table 
+  records in use (SyncList::inUse) drop to zero.
+ */
+
+/*
+  Each stripe's SyncData records live in a linear-probing hash table 
+  keyed by object. A record no thread is using (threadCount == 0) is 
+  handed to the next new object, as the old list did:
+  - in place, if it lies on the new object's probe path. Every slot 
+    before the first empty one is searched, so it is still found.
+  - otherwise, only when the table would have to grow, by moving an 
+    idle record from elsewhere. So the number of records still tracks 
+    the peak number of objects locked at once.
+  Every so often the stripe is swept: idle records beyond 
+  SyncDataIdleLimit are freed and the table shrinks to fit the rest, 
+  so memory and probe lengths follow current lock usage instead of 
+  the historical peak.
+  All table access is under the stripe lock.
+ */
 struct SyncList {
-    SyncData *data;
+    SyncData **table;      // nil slots are empty
+    uintptr_t mask;        // table size - 1
+    uintptr_t count;       // records in the table
+    uintptr_t cursor;      // where the next search for an idle record starts
+    uintptr_t sinceSweep;  // table lookups since the last sweep
     spinlock_t lock;
+#if SUPPORT_THIN_SYNC
+    std::atomic<SyncData *> thin;          // allocated under lock, then fixed
+    std::atomic<uintptr_t> thinState;      // SYNC_THIN_* and thin's object
+    std::atomic<uintptr_t> inUse;          // table records with threads
+#endif
 
-    constexpr SyncList() : data(nil), lock(fork_unsafe_lock) { }
+    constexpr SyncList() 
+        : table(nil), mask(0), count(0), cursor(0), sinceSweep(0), 
+          lock(fork_unsafe_lock)
+#if SUPPORT_THIN_SYNC
+        , thin(nil), thinState(0), inUse(0)
+#endif
+    { }
 };
 
 // Use multiple parallel lists to decrease contention among unrelated objects.
 #define LOCK_FOR_OBJ(obj) sDataLists[obj].lock
-#define LIST_FOR_OBJ(obj) sDataLists[obj].data
+#define LIST_FOR_OBJ(obj) sDataLists[obj]
 static StripedMap<SyncList> sDataLists;
 
+// Idle records each stripe keeps for reuse when it is swept.
+// Set from OBJC_SYNC_IDLE_RECORDS.
+unsigned int SyncDataIdleLimit = 4;
+
+
+// Returns object's record, or nil. If there is none, *unused is set 
+// to the first idle record on object's probe path, if any.
+static SyncData *sync_list_find(SyncList *list, id object, SyncData **unused)
+{
+    if (!list->table) return nil;
+
+    uintptr_t index = ptr_hash((uintptr_t)object) & list->mask;
+    SyncData *p;
+    while ((p = list->table[index])) {
+        if (p->object == object) return p;
+        if (!*unused  &&  p->threadCount == 0) *unused = p;
+        index = (index + 1) & list->mask;
+    }
+    return nil;
+}
+
+static uintptr_t sync_list_home(SyncList *list, SyncData *data)
+{
+    return ptr_hash((uintptr_t)(objc_object *)data->object) & list->mask;
+}
+
+static void sync_list_place(SyncList *list, SyncData *data)
+{
+    uintptr_t index = sync_list_home(list, data);
+    while (list->table[index]) {
+        index = (index + 1) & list->mask;
+    }
+    list->table[index] = data;
+}
+
+// Whether adding a record would grow the table past 3/4 full.
+static bool sync_list_full(SyncList *list)
+{
+    uintptr_t size = list->table ? list->mask + 1 : 0;
+    return (list->count + 1) * 4 > size * 3;
+}
+
+// Removes and returns an idle record, or returns nil if every record 
+// is in use. The caller must re-key the record and place it again.
+static SyncData *sync_list_take_unused(SyncList *list)
+{
+    if (!list->table) return nil;
+
+    uintptr_t size = list->mask + 1;
+    for (uintptr_t n = 0; n < size; n++) {
+        uintptr_t index = (list->cursor + n) & list->mask;
+        SyncData *result = list->table[index];
+        if (!result  ||  result->threadCount != 0) continue;
+        list->cursor = index + 1;
+
+        // Backward-shift deletion: pull later records in the run 
+        // into the hole unless that would move them before their home.
+        uintptr_t hole = index;
+        for (uintptr_t i = (index + 1) & list->mask; 
+             list->table[i]; 
+             i = (i + 1) & list->mask) 
+        {
+            uintptr_t home = sync_list_home(list, list->table[i]);
+            if (((i - home) & list->mask) >= ((i - hole) & list->mask)) {
+                list->table[hole] = list->table[i];
+                hole = i;
+            }
+        }
+        list->table[hole] = nil;
+        return result;
+    }
+    return nil;
+}
+
+// Frees idle records beyond SyncDataIdleLimit and rebuilds the table 
+// at the smallest size that holds the rest.
+// A record is idle once its threadCount is zero. Releasing threads 
+// unlock the mutex before that, so nobody else can still be using it.
+static void sync_list_sweep(SyncList *list)
+{
+    list->sinceSweep = 0;
+    if (!list->table) return;
+
+    uintptr_t size = list->mask + 1;
+    uintptr_t idle = 0;
+    uintptr_t keep = 0;
+    for (uintptr_t i = 0; i < size; i++) {
+        SyncData *p = list->table[i];
+        if (!p) continue;
+        if (p->threadCount == 0  &&  ++idle > SyncDataIdleLimit) continue;
+        keep++;
+    }
+    if (keep == list->count) return;
+
+    // Records may go idle during the second pass too. 
+    // That only frees a few more; count is recomputed.
+    uintptr_t newSize = 8;
+    while ((keep + 1) * 4 > newSize * 3) newSize *= 2;
+    SyncData **oldTable = list->table;
+    list->table = (SyncData **)calloc(newSize, sizeof(SyncData *));
+    list->mask = newSize - 1;
+    list->count = 0;
+    list->cursor = 0;
+    idle = 0;
+    for (uintptr_t i = 0; i < size; i++) {
+        SyncData *p = oldTable[i];
+        if (!p) continue;
+        if (p->threadCount == 0  &&  ++idle > SyncDataIdleLimit) {
+            free(p);
+            continue;
+        }
+        sync_list_place(list, p);
+        list->count++;
+    }
+    free(oldTable);
+}
+
+// Adds a new record, growing the table to keep it at most 3/4 full.
+static void sync_list_insert(SyncList *list, SyncData *data)
+{
+    uintptr_t size = list->table ? list->mask + 1 : 0;
+    if (sync_list_full(list)) {
+        SyncData **oldTable = list->table;
+        uintptr_t newSize = size ? size * 2 : 8;
+        list->table = (SyncData **)calloc(newSize, sizeof(SyncData *));
+        list->mask = newSize - 1;
+        for (uintptr_t i = 0; i < size; i++) {
+            if (oldTable[i]) sync_list_place(list, oldTable[i]);
+        }
+        free(oldTable);
+    }
+
+    sync_list_place(list, data);
+    list->count++;
+}
+
 
 enum usage { ACQUIRE, RELEASE, CHECK };
 
@@ -107,10 +300,164 @@ void _destroySyncCache(struct SyncCache *cache)
 }
 
 
+#if SUPPORT_THIN_SYNC
+
+// SyncList::thinState: the thin record's object above 
+// SYNC_THIN_OBJECT_SHIFT, the number of threads using it, and 
+// SYNC_THIN_BUSY. An empty thin record has no object and no users.
+#define SYNC_THIN_BUSY          1UL     // table records are in use
+#define SYNC_THIN_USER          2UL     // one thread using the thin record
+#define SYNC_THIN_USERS_MASK    0xfffeUL
+#define SYNC_THIN_OBJECT_SHIFT  16
+
+static inline uintptr_t sync_thin_object(uintptr_t state)
+{
+    return state >> SYNC_THIN_OBJECT_SHIFT;
+}
+
+static bool sync_data_is(SyncData *data, id object)
+{
+    if (data->thinState) {
+        uintptr_t state = data->thinState->load(std::memory_order_relaxed);
+        return sync_thin_object(state) == (uintptr_t)object;
+    }
+    return data->object == object;
+}
+
+// Tagged pointers and other objects with high address bits 
+// always use table records.
+static inline bool sync_thin_fits(id object)
+{
+    uintptr_t objectState = (uintptr_t)object << SYNC_THIN_OBJECT_SHIFT;
+    return sync_thin_object(objectState) == (uintptr_t)object;
+}
+
+// Joins or claims list's thin record for object. Without the stripe 
+// lock, gives up if the record is taken by another object or the 
+// stripe has table records in use. With the lock held, sets 
+// SYNC_THIN_BUSY instead of giving up; the caller then uses a table 
+// record, and must already have checked for one object is using.
+static SyncData *sync_thin_acquire(SyncList *list, id object, 
+                                   bool locked, bool tableInUse = false)
+{
+    SyncData *thin = list->thin.load(std::memory_order_acquire);
+    if (!thin) return nil;
+    if (!sync_thin_fits(object)) tableInUse = true;
+
+    uintptr_t objectState = (uintptr_t)object << SYNC_THIN_OBJECT_SHIFT;
+    uintptr_t state = list->thinState.load(std::memory_order_relaxed);
+    uintptr_t newState;
+    bool joined;
+    do {
+        uintptr_t holder = sync_thin_object(state);
+        joined = true;
+        if (holder == (uintptr_t)object) {
+            if ((state & SYNC_THIN_USERS_MASK) == SYNC_THIN_USERS_MASK) {
+                _objc_fatal("too many threads synchronizing on %p", 
+                            (void*)object);
+            }
+            newState = state + SYNC_THIN_USER;
+        } else if (holder == 0  &&  !tableInUse  &&  
+                   (locked  ||  !(state & SYNC_THIN_BUSY))) 
+        {
+            newState = objectState | SYNC_THIN_USER | (state & SYNC_THIN_BUSY);
+        } else if (locked) {
+            joined = false;
+            newState = state | SYNC_THIN_BUSY;
+        } else {
+            return nil;
+        }
+    } while (!list->thinState.compare_exchange_weak(state, newState, 
+                                                    std::memory_order_acquire, 
+                                                    std::memory_order_relaxed));
+    return joined ? thin : nil;
+}
+
+// Called after unlocking the thin record's mutex.
+static void sync_thin_release(SyncList *list)
+{
+    uintptr_t state = list->thinState.load(std::memory_order_relaxed);
+    uintptr_t newState;
+    do {
+        newState = state - SYNC_THIN_USER;
+        if (!(newState & SYNC_THIN_USERS_MASK)) newState &= SYNC_THIN_BUSY;
+    } while (!list->thinState.compare_exchange_weak(state, newState, 
+                                                    std::memory_order_release, 
+                                                    std::memory_order_relaxed));
+}
+
+// Called under the stripe lock.
+static void sync_thin_init(SyncList *list)
+{
+    if (list->thin.load(std::memory_order_relaxed)) return;
+
+    SyncData *thin;
+    posix_memalign((void **)&thin, alignof(SyncData), sizeof(SyncData));
+    thin->object = nil;
+    thin->threadCount = 1;  // never idle, never in the table
+    new (&thin->mutex) recursive_mutex_t(fork_unsafe_lock);
+    thin->thinState = &list->thinState;
+    list->thin.store(thin, std::memory_order_release);
+}
+
+// Lets the stripe's thin record be claimed without the lock again 
+// once no table record is in use. Lookups that take the thin record 
+// that way never reach the table's periodic sweep, so sweep it now.
+static void sync_list_idle(SyncList *list)
+{
+    if (list->inUse.fetch_sub(1, std::memory_order_release) != 1) return;
+
+    list->lock.lock();
+    if (list->inUse.load(std::memory_order_acquire) == 0) {
+        list->thinState.fetch_and(~SYNC_THIN_BUSY, std::memory_order_relaxed);
+        if (list->count > SyncDataIdleLimit) sync_list_sweep(list);
+    }
+    list->lock.unlock();
+}
+
+#else
+
+static inline bool sync_data_is(SyncData *data, id object)
+{
+    return data->object == object;
+}
+
+// SUPPORT_THIN_SYNC
+#endif
+
+// Called under the stripe lock when one of its table records 
+// goes from no threads to one.
+static inline void sync_list_used(SyncList *list __unused)
+{
+#if SUPPORT_THIN_SYNC
+    list->inUse.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+// Called after unlocking data's mutex, when this thread stops using it.
+static void sync_data_release(SyncList *list __unused, SyncData *data)
+{
+#if SUPPORT_THIN_SYNC
+    if (data->thinState) {
+        sync_thin_release(list);
+        return;
+    }
+#endif
+    // atomic because may collide with concurrent ACQUIRE
+    if (OSAtomicDecrement32Barrier(&data->threadCount) == 0) {
+#if SUPPORT_THIN_SYNC
+        sync_list_idle(list);
+#endif
+    }
+}
+
+
+// RELEASE also unlocks the mutex, and returns nil 
+// if this thread did not hold it.
 static SyncData* id2data(id object, enum usage why)
 {
     spinlock_t *lockp = &LOCK_FOR_OBJ(object);
-    SyncData **listp = &LIST_FOR_OBJ(object);
+    SyncList *listp = &LIST_FOR_OBJ(object);
     SyncData* result = NULL;
 
 #if SUPPORT_DIRECT_THREAD_KEYS
@@ -120,7 +467,7 @@ static SyncData* id2data(id object, enum usage why)
     if (data) {
         fastCacheOccupied = YES;
 
-        if (data->object == object) {
+        if (sync_data_is(data, object)) {
             // Found a match in fast cache.
             uintptr_t lockCount;
 
@@ -137,13 +484,15 @@ static SyncData* id2data(id object, enum usage why)
                 break;
             }
             case RELEASE:
+                // Unlock first: once threadCount drops to zero 
+                // the record may be freed.
+                if (!data->mutex.tryUnlock()) result = nil;
                 lockCount--;
                 tls_set_direct(SYNC_COUNT_DIRECT_KEY, (void*)lockCount);
                 if (lockCount == 0) {
                     // remove from fast cache
                     tls_set_direct(SYNC_DATA_DIRECT_KEY, NULL);
-                    // atomic because may collide with concurrent ACQUIRE
-                    OSAtomicDecrement32Barrier(&result->threadCount);
+                    sync_data_release(listp, data);
                 }
                 break;
             case CHECK:
@@ -160,11 +509,18 @@ static SyncData* id2data(id object, enum usage why)
     SyncCache *cache = fetch_cache(NO);
     if (cache) {
         unsigned int i;
-        for (i = 0; i < cache->used; i++) {
+        for (i = cache->used; i-- > 0; ) {
             SyncCacheItem *item = &cache->list[i];
-            if (item->data->object != object) continue;
-
-            // Found a match.
+            if (!sync_data_is(item->data, object)) continue;
+
+            // Found a match. Move it to the front.
+            SyncCacheItem *front = &cache->list[cache->used - 1];
+            if (item != front) {
+                SyncCacheItem tmp = *item;
+                *item = *front;
+                *front = tmp;
+                item = front;
+            }
             result = item->data;
             if (result->threadCount <= 0  ||  item->lockCount <= 0) {
                 _objc_fatal("id2data cache is buggy");
@@ -175,12 +531,14 @@ static SyncData* id2data(id object, enum usage why)
                 item->lockCount++;
                 break;
             case RELEASE:
+                // Unlock first: once threadCount drops to zero 
+                // the record may be freed.
+                if (!item->data->mutex.tryUnlock()) result = nil;
                 item->lockCount--;
                 if (item->lockCount == 0) {
                     // remove from per-thread cache
-                    cache->list[i] = cache->list[--cache->used];
-                    // atomic because may collide with concurrent ACQUIRE
-                    OSAtomicDecrement32Barrier(&result->threadCount);
+                    cache->used--;
+                    sync_data_release(listp, item->data);
                 }
                 break;
             case CHECK:
@@ -193,26 +551,45 @@ static SyncData* id2data(id object, enum usage why)
     }
 
     // Thread cache didn't find anything.
-    // Walk in-use list looking for matching object
+#if SUPPORT_THIN_SYNC
+    // Try the stripe's thin record first.
+    if (why == ACQUIRE  &&  (result = sync_thin_acquire(listp, object, false))) {
+        goto found;
+    }
+#endif
+
+    // Look up the object in the stripe's table.
     // Spinlock prevents multiple threads from creating multiple 
     // locks for the same new object.
-    // We could keep the nodes in some hash table if we find that there are
-    // more than 20 or so distinct locks active, but we don't do that now.
     
     lockp->lock();
 
+    // Sweeps cost O(table size), so run them in proportion to lookups.
+    if (++listp->sinceSweep > 2 * (listp->mask + 1) + 64) {
+        sync_list_sweep(listp);
+    }
+
     {
-        SyncData* p;
         SyncData* firstUnused = NULL;
-        for (p = *listp; p != NULL; p = p->nextData) {
-            if ( p->object == object ) {
-                result = p;
-                // atomic because may collide with concurrent RELEASE
-                OSAtomicIncrement32Barrier(&result->threadCount);
+        result = sync_list_find(listp, object, &firstUnused);
+#if SUPPORT_THIN_SYNC
+        // Use the thin record unless object's table record is in use.
+        if (why == ACQUIRE) {
+            sync_thin_init(listp);
+            SyncData *thin = sync_thin_acquire(listp, object, true, 
+                                               result && result->threadCount > 0);
+            if (thin) {
+                result = thin;
                 goto done;
             }
-            if ( (firstUnused == NULL) && (p->threadCount == 0) )
-                firstUnused = p;
+        }
+#endif
+        if (result) {
+            // atomic because may collide with concurrent RELEASE
+            if (OSAtomicIncrement32Barrier(&result->threadCount) == 1) {
+                sync_list_used(listp);
+            }
+            goto done;
         }
     
         // no SyncData currently associated with object
@@ -224,6 +601,18 @@ static SyncData* id2data(id object, enum usage why)
             result = firstUnused;
             result->object = (objc_object *)object;
             result->threadCount = 1;
+            sync_list_used(listp);
+            goto done;
+        }
+
+        // Rather than grow the table, move an idle record from elsewhere.
+        if (sync_list_full(listp)  &&  
+            (result = sync_list_take_unused(listp))) 
+        {
+            result->object = (objc_object *)object;
+            result->threadCount = 1;
+            sync_list_used(listp);
+            sync_list_place(listp, result);
             goto done;
         }
     }
@@ -231,16 +620,23 @@ static SyncData* id2data(id object, enum usage why)
     // Allocate a new SyncData and add to list.
     // XXX allocating memory with a global lock held is bad practice,
     // might be worth releasing the lock, allocating, and searching again.
-    // But since we never free these guys we won't be stuck in allocation very often.
+    // But since idle records are kept for reuse we won't be stuck in 
+    // allocation very often.
     posix_memalign((void **)&result, alignof(SyncData), sizeof(SyncData));
     result->object = (objc_object *)object;
     result->threadCount = 1;
     new (&result->mutex) recursive_mutex_t(fork_unsafe_lock);
-    result->nextData = *listp;
-    *listp = result;
+#if SUPPORT_THIN_SYNC
+    result->thinState = nil;
+#endif
+    sync_list_used(listp);
+    sync_list_insert(listp, result);
     
  done:
     lockp->unlock();
+#if SUPPORT_THIN_SYNC
+ found:
+#endif
     if (result) {
         // Only new ACQUIRE should get here.
         // All RELEASE and CHECK and recursive ACQUIRE are 
@@ -251,7 +647,7 @@ static SyncData* id2data(id object, enum usage why)
             return nil;
         }
         if (why != ACQUIRE) _objc_fatal("id2data is buggy");
-        if (result->object != object) _objc_fatal("id2data is buggy");
+        if (!sync_data_is(result, object)) _objc_fatal("id2data is buggy");
 
 #if SUPPORT_DIRECT_THREAD_KEYS
         if (!fastCacheOccupied) {
@@ -311,11 +707,6 @@ int objc_sync_exit(id obj)
         SyncData* data = id2data(obj, RELEASE); 
         if (!data) {
             result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
-        } else {
-            bool okay = data->mutex.tryUnlock();
-            if (!okay) {
-                result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
-            }
         }
     } else {
         // @synchronized(nil) does nothing
@@ -27,8 +27,6 @@
 #include <objc/objc.h>
 #include "objc-config.h"
 
-__BEGIN_DECLS
-
 /*
 The weak table is a hash table governed by a single spin lock.
 An allocated blob of memory, most often an object, but under GC any such 
@@ -113,16 +111,54 @@ struct weak_entry_t {
 };
 
 /**
- * The global weak references table. Stores object ids as keys,
- * and weak_entry_t structs as their values.
+ * An object with exactly one weak reference, such as most delegates.
+ * These are kept in their own table of two-word entries and move to 
+ * a weak_entry_t when a second weak reference is registered.
  */
-struct weak_table_t {
-    weak_entry_t *weak_entries;
+struct weak_single_t {
+    DisguisedPtr<objc_object> referent;
+    weak_referrer_t referrer;
+};
+
+/**
+ * A hash table of Entry structs keyed by referent.
+ * weak_entries uses Robin Hood probing with backward-shift deletion.
+ * While resizing, entries not yet migrated stay in old_entries; 
+ * each register/unregister/clear moves a few of them into weak_entries 
+ * so no single store pays for rehashing the whole table.
+ * num_entries counts the entries in both arrays.
+ */
+template <typename Entry>
+struct weak_hash_t {
+    Entry    *weak_entries;
     size_t    num_entries;
     uintptr_t mask;
     uintptr_t max_hash_displacement;
+
+    Entry    *old_entries;
+    uintptr_t old_mask;
+    uintptr_t old_max_hash_displacement;
+    size_t    migrate_index;
 };
 
+/**
+ * The global weak references table. Stores object ids as keys,
+ * and weak_entry_t structs as their values, except that objects 
+ * with a single weak reference are stored in singles instead.
+ * An object is in at most one of the two.
+ * num_out_of_line and referrer_bytes track out-of-line referrer arrays 
+ * so memory statistics need not walk the table.
+ */
+struct weak_table_t {
+    weak_hash_t<weak_entry_t>  entries;
+    weak_hash_t<weak_single_t> singles;
+
+    size_t    num_out_of_line;
+    size_t    referrer_bytes;
+};
+
+__BEGIN_DECLS
+
 /// Adds an (object, weak pointer) pair to the weak table.
 id weak_register_no_lock(weak_table_t *weak_table, id referent, 
                          id *referrer, bool crashIfDeallocating);
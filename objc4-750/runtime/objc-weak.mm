@@ -38,12 +38,22 @@ BREAKPOINT_FUNCTION(
     void objc_weak_error(void)
 );
 
-static void bad_weak_table(weak_entry_t *entries)
+static void bad_weak_table(const void *entries)
 {
     _objc_fatal("bad weak table at %p. This may be a runtime bug or a "
                 "memory error somewhere else.", entries);
 }
 
+static void bad_weak_referrer(objc_object **referrer)
+{
+    _objc_inform("Attempted to unregister unknown __weak variable "
+                 "at %p. This is probably incorrect use of "
+                 "objc_storeWeak() and objc_loadWeak(). "
+                 "Break on objc_weak_error to debug.\n", 
+                 referrer);
+    objc_weak_error();
+}
+
 /** 
  * Unique hash function for object pointers only.
  * 
@@ -174,12 +184,7 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
                 return;
             }
         }
-        _objc_inform("Attempted to unregister unknown __weak variable "
-                     "at %p. This is probably incorrect use of "
-                     "objc_storeWeak() and objc_loadWeak(). "
-                     "Break on objc_weak_error to debug.\n", 
-                     old_referrer);
-        objc_weak_error();
+        bad_weak_referrer(old_referrer);
         return;
     }
 
@@ -191,12 +196,7 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
         if (index == begin) bad_weak_table(entry);
         hash_displacement++;
         if (hash_displacement > entry->max_hash_displacement) {
-            _objc_inform("Attempted to unregister unknown __weak variable "
-                         "at %p. This is probably incorrect use of "
-                         "objc_storeWeak() and objc_loadWeak(). "
-                         "Break on objc_weak_error to debug.\n", 
-                         old_referrer);
-            objc_weak_error();
+            bad_weak_referrer(old_referrer);
             return;
         }
     }
@@ -204,21 +204,74 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
     entry->num_refs--;
 }
 
+// Bytes of entry's out-of-line referrer array, if any.
+static inline size_t weak_entry_referrer_bytes(weak_entry_t *entry)
+{
+    if (!entry->out_of_line()) return 0;
+    return TABLE_SIZE(entry) * sizeof(weak_referrer_t);
+}
+
+// Number of old buckets migrated by each weak table operation 
+// while an incremental resize is in progress.
+#define WEAK_MIGRATE_STEP 16
+
+template <typename Entry>
+static inline void weak_entry_swap(Entry *a, Entry *b)
+{
+    uint8_t tmp[sizeof(Entry)];
+    memcpy(tmp, a, sizeof(tmp));
+    memcpy(a, b, sizeof(tmp));
+    memcpy(b, tmp, sizeof(tmp));
+}
+
+/** 
+ * Distance of the entry at index from its home bucket.
+ */
+template <typename Entry>
+static inline size_t weak_entry_displacement(Entry *entry, 
+                                             size_t index, uintptr_t mask)
+{
+    return (index - (hash_pointer(entry->referent) & mask)) & mask;
+}
+
+template <typename Entry>
+static inline bool weak_entry_is_old(weak_hash_t<Entry> *weak_table, 
+                                     Entry *entry)
+{
+    return (weak_table->old_entries  &&  
+            entry >= weak_table->old_entries  &&  
+            entry <= weak_table->old_entries + weak_table->old_mask);
+}
+
 /** 
  * Add new_entry to the object's table of weak references.
  * Does not check whether the referent is already in the table.
+ * Robin Hood probing: an entry closer to its home bucket gives up its 
+ * slot to the one being inserted, which keeps displacements short.
+ * new_entry is used as scratch space and is garbage afterwards.
  */
-static void weak_entry_insert(weak_table_t *weak_table, weak_entry_t *new_entry)
+template <typename Entry>
+static void weak_entry_insert(weak_hash_t<Entry> *weak_table, Entry *new_entry)
 {
-    weak_entry_t *weak_entries = weak_table->weak_entries;
+    Entry *weak_entries = weak_table->weak_entries;
     assert(weak_entries != nil);
 
-    size_t begin = hash_pointer(new_entry->referent) & (weak_table->mask);
-    size_t index = begin;
+    uintptr_t mask = weak_table->mask;
+    size_t index = hash_pointer(new_entry->referent) & mask;
     size_t hash_displacement = 0;
+    size_t probes = 0;
     while (weak_entries[index].referent != nil) {
-        index = (index+1) & weak_table->mask;
-        if (index == begin) bad_weak_table(weak_entries);
+        if (++probes > mask) bad_weak_table(weak_entries);
+        size_t resident = 
+            weak_entry_displacement(&weak_entries[index], index, mask);
+        if (resident < hash_displacement) {
+            if (hash_displacement > weak_table->max_hash_displacement) {
+                weak_table->max_hash_displacement = hash_displacement;
+            }
+            weak_entry_swap(new_entry, &weak_entries[index]);
+            hash_displacement = resident;
+        }
+        index = (index+1) & mask;
         hash_displacement++;
     }
 
@@ -231,33 +284,72 @@ static void weak_entry_insert(weak_table_t *weak_table, weak_entry_t *new_entry)
 }
 
 
-static void weak_resize(weak_table_t *weak_table, size_t new_size)
+// Move up to count old buckets into the current table.
+template <typename Entry>
+static void weak_migrate_some(weak_hash_t<Entry> *weak_table, size_t count)
 {
+    Entry *old_entries = weak_table->old_entries;
+    if (!old_entries) return;
+
+    size_t old_size = weak_table->old_mask + 1;
+    size_t end = weak_table->migrate_index + MIN(count, old_size);
+    if (end > old_size) end = old_size;
+
+    for (size_t i = weak_table->migrate_index; i < end; i++) {
+        Entry *entry = &old_entries[i];
+        if (entry->referent) {
+            weak_table->num_entries--;  // restored by weak_entry_insert
+            weak_entry_insert(weak_table, entry);
+            bzero(entry, sizeof(*entry));
+        }
+    }
+    weak_table->migrate_index = end;
+
+    if (end == old_size) {
+        free(old_entries);
+        weak_table->old_entries = nil;
+        weak_table->old_mask = 0;
+        weak_table->old_max_hash_displacement = 0;
+        weak_table->migrate_index = 0;
+    }
+}
+
+
+// Start moving the table to new_size buckets. 
+// Entries migrate incrementally; see weak_migrate_some().
+template <typename Entry>
+static void weak_resize(weak_hash_t<Entry> *weak_table, size_t new_size)
+{
+    // Finish any previous resize first.
+    if (weak_table->old_entries) {
+        weak_migrate_some(weak_table, weak_table->old_mask + 1);
+    }
+
     size_t old_size = TABLE_SIZE(weak_table);
 
-    weak_entry_t *old_entries = weak_table->weak_entries;
-    weak_entry_t *new_entries = (weak_entry_t *)
-        calloc(new_size, sizeof(weak_entry_t));
+    Entry *old_entries = weak_table->weak_entries;
+    Entry *new_entries = (Entry *)calloc(new_size, sizeof(Entry));
 
-    weak_table->mask = new_size - 1;
-    weak_table->weak_entries = new_entries;
-    weak_table->max_hash_displacement = 0;
-    weak_table->num_entries = 0;  // restored by weak_entry_insert below
-    
     if (old_entries) {
-        weak_entry_t *entry;
-        weak_entry_t *end = old_entries + old_size;
-        for (entry = old_entries; entry < end; entry++) {
-            if (entry->referent) {
-                weak_entry_insert(weak_table, entry);
-            }
+        if (weak_table->num_entries > 0) {
+            weak_table->old_entries = old_entries;
+            weak_table->old_mask = old_size - 1;
+            weak_table->old_max_hash_displacement = 
+                weak_table->max_hash_displacement;
+            weak_table->migrate_index = 0;
+        } else {
+            free(old_entries);
         }
-        free(old_entries);
     }
+
+    weak_table->mask = new_size - 1;
+    weak_table->weak_entries = new_entries;
+    weak_table->max_hash_displacement = 0;
 }
 
 // Grow the given zone's table of weak references if it is full.
-static void weak_grow_maybe(weak_table_t *weak_table)
+template <typename Entry>
+static void weak_grow_maybe(weak_hash_t<Entry> *weak_table)
 {
     size_t old_size = TABLE_SIZE(weak_table);
 
@@ -268,10 +360,14 @@ static void weak_grow_maybe(weak_table_t *weak_table)
 }
 
 // Shrink the table if it is mostly empty.
-static void weak_compact_maybe(weak_table_t *weak_table)
+template <typename Entry>
+static void weak_compact_maybe(weak_hash_t<Entry> *weak_table)
 {
     size_t old_size = TABLE_SIZE(weak_table);
 
+    // Don't start shrinking while the last resize is still migrating.
+    if (weak_table->old_entries) return;
+
     // Shrink if larger than 1024 buckets and at most 1/16 full.
     if (old_size >= 1024  && old_size / 16 >= weak_table->num_entries) {
         weak_resize(weak_table, old_size / 8);
@@ -282,11 +378,30 @@ static void weak_compact_maybe(weak_table_t *weak_table)
 
 /**
  * Remove entry from the zone's table of weak references.
+ * In the current table, later entries of the same probe run shift back 
+ * one bucket, so no tombstones are left behind. In a table that is 
+ * still migrating the bucket is simply cleared.
  */
-static void weak_entry_remove(weak_table_t *weak_table, weak_entry_t *entry)
+template <typename Entry>
+static void weak_entry_remove(weak_hash_t<Entry> *weak_table, Entry *entry)
 {
-    // remove entry
-    if (entry->out_of_line()) free(entry->referrers);
+    if (!weak_entry_is_old(weak_table, entry)) {
+        Entry *weak_entries = weak_table->weak_entries;
+        uintptr_t mask = weak_table->mask;
+        size_t index = entry - weak_entries;
+        while (true) {
+            size_t next = (index+1) & mask;
+            Entry *next_entry = &weak_entries[next];
+            if (next_entry->referent == nil  ||  
+                weak_entry_displacement(next_entry, next, mask) == 0)
+            {
+                break;
+            }
+            weak_entries[index] = *next_entry;
+            index = next;
+        }
+        entry = &weak_entries[index];
+    }
     bzero(entry, sizeof(*entry));
 
     weak_table->num_entries--;
@@ -294,6 +409,19 @@ static void weak_entry_remove(weak_table_t *weak_table, weak_entry_t *entry)
     weak_compact_maybe(weak_table);
 }
 
+/**
+ * Remove a multi-referrer entry, freeing its out-of-line referrers.
+ */
+static void weak_entry_destroy(weak_table_t *weak_table, weak_entry_t *entry)
+{
+    if (entry->out_of_line()) {
+        weak_table->num_out_of_line--;
+        weak_table->referrer_bytes -= weak_entry_referrer_bytes(entry);
+        free(entry->referrers);
+    }
+    weak_entry_remove(&weak_table->entries, entry);
+}
+
 
 /** 
  * Return the weak reference table entry for the given referent. 
@@ -305,28 +433,76 @@ static void weak_entry_remove(weak_table_t *weak_table, weak_entry_t *entry)
  * 
  * @return The table of weak referrers to this object. 
  */
-static weak_entry_t *
-weak_entry_for_referent(weak_table_t *weak_table, objc_object *referent)
+template <typename Entry>
+static Entry *
+weak_entry_for_referent(weak_hash_t<Entry> *weak_table, objc_object *referent)
 {
     assert(referent);
 
-    weak_entry_t *weak_entries = weak_table->weak_entries;
+    Entry *weak_entries = weak_table->weak_entries;
 
     if (!weak_entries) return nil;
 
-    size_t begin = hash_pointer(referent) & weak_table->mask;
-    size_t index = begin;
+    // Robin Hood order lets the search stop at the first entry 
+    // that is closer to its home bucket than we are to ours.
+    uintptr_t mask = weak_table->mask;
+    size_t index = hash_pointer(referent) & mask;
     size_t hash_displacement = 0;
-    while (weak_table->weak_entries[index].referent != referent) {
-        index = (index+1) & weak_table->mask;
-        if (index == begin) bad_weak_table(weak_table->weak_entries);
+    while (weak_entries[index].referent != nil  &&  
+           hash_displacement <= weak_table->max_hash_displacement  &&  
+           weak_entry_displacement(&weak_entries[index], index, mask) >= 
+           hash_displacement)
+    {
+        if (weak_entries[index].referent == referent) {
+            return &weak_entries[index];
+        }
+        index = (index+1) & mask;
         hash_displacement++;
-        if (hash_displacement > weak_table->max_hash_displacement) {
-            return nil;
+        if (hash_displacement > mask) bad_weak_table(weak_entries);
+    }
+
+    // Entries not yet migrated. Migrated and removed buckets are 
+    // cleared without shifting, so scan the whole probe run.
+    Entry *old_entries = weak_table->old_entries;
+    if (!old_entries) return nil;
+
+    mask = weak_table->old_mask;
+    index = hash_pointer(referent) & mask;
+    for (hash_displacement = 0; 
+         hash_displacement <= weak_table->old_max_hash_displacement; 
+         hash_displacement++)
+    {
+        if (old_entries[index].referent == referent) {
+            return &old_entries[index];
         }
+        index = (index+1) & mask;
+    }
+    return nil;
+}
+
+// Advance any incremental resizes of the weak table.
+static inline void weak_migrate_some(weak_table_t *weak_table)
+{
+    weak_migrate_some(&weak_table->entries, WEAK_MIGRATE_STEP);
+    weak_migrate_some(&weak_table->singles, WEAK_MIGRATE_STEP);
+}
+
+/** 
+ * Set a weak pointer to referent to nil. 
+ */
+static void weak_clear_referrer(objc_object **referrer, objc_object *referent)
+{
+    if (*referrer == referent) {
+        *referrer = nil;
+    }
+    else if (*referrer) {
+        _objc_inform("__weak variable at %p holds %p instead of %p. "
+                     "This is probably incorrect use of "
+                     "objc_storeWeak() and objc_loadWeak(). "
+                     "Break on objc_weak_error to debug.\n", 
+                     referrer, (void*)*referrer, (void*)referent);
+        objc_weak_error();
     }
-    
-    return &weak_table->weak_entries[index];
 }
 
 /** 
@@ -352,10 +528,13 @@ weak_unregister_no_lock(weak_table_t *weak_table, id referent_id,
     objc_object **referrer = (objc_object **)referrer_id;
 
     weak_entry_t *entry;
+    weak_single_t *single;
 
     if (!referent) return;
 
-    if ((entry = weak_entry_for_referent(weak_table, referent))) {
+    weak_migrate_some(weak_table);
+
+    if ((entry = weak_entry_for_referent(&weak_table->entries, referent))) {
         remove_referrer(entry, referrer);
         bool empty = true;
         if (entry->out_of_line()  &&  entry->num_refs != 0) {
@@ -371,7 +550,16 @@ weak_unregister_no_lock(weak_table_t *weak_table, id referent_id,
         }
 
         if (empty) {
-            weak_entry_remove(weak_table, entry);
+            weak_entry_destroy(weak_table, entry);
+        }
+    }
+    else if ((single = weak_entry_for_referent(&weak_table->singles, 
+                                               referent))) 
+    {
+        if (single->referrer == referrer) {
+            weak_entry_remove(&weak_table->singles, single);
+        } else {
+            bad_weak_referrer(referrer);
         }
     }
 
@@ -424,15 +612,35 @@ weak_register_no_lock(weak_table_t *weak_table, id referent_id,
         }
     }
 
+    weak_migrate_some(weak_table);
+
     // now remember it and where it is being stored
     weak_entry_t *entry;
-    if ((entry = weak_entry_for_referent(weak_table, referent))) {
+    weak_single_t *single;
+    if ((entry = weak_entry_for_referent(&weak_table->entries, referent))) {
+        bool was_out_of_line = entry->out_of_line();
+        size_t old_bytes = weak_entry_referrer_bytes(entry);
         append_referrer(entry, referrer);
+        if (!was_out_of_line  &&  entry->out_of_line()) {
+            weak_table->num_out_of_line++;
+        }
+        weak_table->referrer_bytes += 
+            weak_entry_referrer_bytes(entry) - old_bytes;
     } 
+    else if ((single = weak_entry_for_referent(&weak_table->singles, 
+                                               referent))) 
+    {
+        // Second weak reference. Promote to an inline weak_entry_t.
+        weak_entry_t new_entry(referent, single->referrer);
+        append_referrer(&new_entry, referrer);
+        weak_entry_remove(&weak_table->singles, single);
+        weak_grow_maybe(&weak_table->entries);
+        weak_entry_insert(&weak_table->entries, &new_entry);
+    }
     else {
-        weak_entry_t new_entry(referent, referrer);
-        weak_grow_maybe(weak_table);
-        weak_entry_insert(weak_table, &new_entry);
+        weak_single_t new_single = { referent, referrer };
+        weak_grow_maybe(&weak_table->singles);
+        weak_entry_insert(&weak_table->singles, &new_single);
     }
 
     // Do not set *referrer. objc_storeWeak() requires that the 
@@ -446,7 +654,9 @@ weak_register_no_lock(weak_table_t *weak_table, id referent_id,
 bool
 weak_is_registered_no_lock(weak_table_t *weak_table, id referent_id) 
 {
-    return weak_entry_for_referent(weak_table, (objc_object *)referent_id);
+    objc_object *referent = (objc_object *)referent_id;
+    return (weak_entry_for_referent(&weak_table->entries, referent)  ||  
+            weak_entry_for_referent(&weak_table->singles, referent));
 }
 #endif
 
@@ -463,10 +673,20 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
 {
     objc_object *referent = (objc_object *)referent_id;
 
-    weak_entry_t *entry = weak_entry_for_referent(weak_table, referent);
+    weak_migrate_some(weak_table);
+
+    weak_entry_t *entry = 
+        weak_entry_for_referent(&weak_table->entries, referent);
     if (entry == nil) {
-        /// XXX shouldn't happen, but does with mismatched CF/objc
-        //printf("XXX no entry for clear deallocating %p\n", referent);
+        weak_single_t *single = 
+            weak_entry_for_referent(&weak_table->singles, referent);
+        if (single == nil) {
+            /// XXX shouldn't happen, but does with mismatched CF/objc
+            //printf("XXX no entry for clear deallocating %p\n", referent);
+            return;
+        }
+        weak_clear_referrer(single->referrer, referent);
+        weak_entry_remove(&weak_table->singles, single);
         return;
     }
 
@@ -486,20 +706,9 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
     for (size_t i = 0; i < count; ++i) {
         objc_object **referrer = referrers[i];
         if (referrer) {
-            if (*referrer == referent) {
-                *referrer = nil;
-            }
-            else if (*referrer) {
-                _objc_inform("__weak variable at %p holds %p instead of %p. "
-                             "This is probably incorrect use of "
-                             "objc_storeWeak() and objc_loadWeak(). "
-                             "Break on objc_weak_error to debug.\n", 
-                             referrer, (void*)*referrer, (void*)referent);
-                objc_weak_error();
-            }
+            weak_clear_referrer(referrer, referent);
         }
     }
     
-    weak_entry_remove(weak_table, entry);
+    weak_entry_destroy(weak_table, entry);
 }
-
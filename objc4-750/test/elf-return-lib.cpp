@@ -0,0 +1,50 @@
+/*
+ * elf-return-lib.cpp
+ * Stands in for libobjc: the two optimized return callees, and a 
+ * callee that runs objc-elf-return.h's check on its caller.
+ */
+
+#include <stdint.h>
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+typedef uint16_t unaligned_uint16_t __attribute__((aligned(1)));
+typedef uint32_t unaligned_uint32_t __attribute__((aligned(1)));
+typedef int32_t unaligned_int32_t __attribute__((aligned(1)));
+
+typedef struct objc_object *id;
+
+extern "C" id objc_retainAutoreleasedReturnValue(id obj);
+extern "C" id objc_unsafeClaimAutoreleasedReturnValue(id obj);
+
+#include "objc-elf-return.h"
+
+extern "C" {
+
+int objc_test_accepted = -1;
+
+id objc_retainAutoreleasedReturnValue(id obj)
+{
+    return obj;
+}
+
+id objc_unsafeClaimAutoreleasedReturnValue(id obj)
+{
+    return obj;
+}
+
+// Not an optimized return callee.
+id objc_test_other(id obj)
+{
+    return obj;
+}
+
+// What objc_autoreleaseReturnValue() asks about its caller.
+__attribute__((noinline)) id objc_test_returnValue(void)
+{
+    objc_test_accepted = 
+        callerAcceptsOptimizedReturn(__builtin_return_address(0));
+    return (id)&objc_test_accepted;
+}
+
+}
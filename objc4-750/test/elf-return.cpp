@@ -0,0 +1,80 @@
+/*
+ * elf-return.cpp
+ * Checks objc-elf-return.h's caller check against callers 
+ * linked directly, through a PLT, and through the GOT.
+ *
+ * usage: elf-return [lazy]
+ * With lazy, calls through a lazily bound PLT slot are expected to 
+ * be unoptimized the first time, until the slot is bound.
+ * Callers through the GOT are left out of lazily bound builds 
+ * (see elf-return-callers.S) and are skipped there.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct objc_object *id;
+
+extern "C" {
+extern int objc_test_accepted;
+id retainThroughPLT(void);
+id claimThroughPLT(void);
+id otherThroughPLT(void);
+id retainWithoutMove(void);
+id retainAfterOtherMove(void);
+id retainThroughBndPLT(void);
+id retainThroughIbtBndPLT(void);
+id retainThroughGOT(void) __attribute__((weak));
+id claimThroughGOT(void) __attribute__((weak));
+id otherThroughGOT(void) __attribute__((weak));
+}
+
+struct Case {
+    const char *name;
+    id (*caller)(void);
+    bool accepted;
+    bool lazy;      // through a PLT slot that may not be bound yet
+};
+
+static const Case Cases[] = {
+    { "retainThroughPLT",       retainThroughPLT,       true,  true  },
+    { "claimThroughPLT",        claimThroughPLT,        true,  true  },
+    { "retainThroughBndPLT",    retainThroughBndPLT,    true,  false },
+    { "retainThroughIbtBndPLT", retainThroughIbtBndPLT, true,  false },
+    { "retainThroughGOT",       retainThroughGOT,       true,  false },
+    { "claimThroughGOT",        claimThroughGOT,        true,  false },
+    { "otherThroughPLT",        otherThroughPLT,        false, true  },
+    { "otherThroughGOT",        otherThroughGOT,        false, false },
+    { "retainWithoutMove",      retainWithoutMove,      false, false },
+    { "retainAfterOtherMove",   retainAfterOtherMove,   false, false },
+};
+
+int main(int argc, char **argv)
+{
+    bool lazy = argc > 1  &&  0 == strcmp(argv[1], "lazy");
+    int failures = 0;
+    int skipped = 0;
+
+    for (const Case& c : Cases) {
+        if (!c.caller) {
+            skipped++;
+            continue;
+        }
+        for (int call = 0; call < 2; call++) {
+            bool expected = c.accepted  &&  !(lazy  &&  c.lazy  &&  call == 0);
+            objc_test_accepted = -1;
+            if (c.caller() != (id)&objc_test_accepted) {
+                printf("FAIL %s: wrong return value\n", c.name);
+                failures++;
+            } else if (objc_test_accepted != (int)expected) {
+                printf("FAIL %s call %d: %s, expected %s\n", c.name, call, 
+                       objc_test_accepted ? "optimized" : "not optimized", 
+                       expected ? "optimized" : "not optimized");
+                failures++;
+            }
+        }
+    }
+
+    printf("%s: %d failures, %d cases skipped\n", argv[0], failures, skipped);
+    return failures ? 1 : 0;
+}